@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "cache.h"
+
+#include "dropon.h"
+#include "libmodjpeg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void mj_init_cache(mj_cache_t *c, size_t max_size) {
+    if(c == NULL) {
+        return;
+    }
+
+    memset(c, 0, sizeof(mj_cache_t));
+
+    c->max_size = max_size;
+
+    return;
+}
+
+void mj_free_cache(mj_cache_t *c) {
+    if(c == NULL) {
+        return;
+    }
+
+    mj_cacheentry_t *e;
+
+    while(c->head != NULL) {
+        e = c->head;
+
+        mj_cache_unlink(c, e);
+
+        mj_free_compileddropon(&e->cd);
+        free(e);
+    }
+
+    c->size = 0;
+
+    memset(c->buckets, 0, sizeof(c->buckets));
+
+    return;
+}
+
+mj_cache_t *mj_dropon_cache(mj_dropon_t *d) {
+    // the cache of a dropon is only allocated when something is put into it
+    if(d->cache != NULL) {
+        return d->cache;
+    }
+
+    d->cache = (mj_cache_t *)malloc(sizeof(mj_cache_t));
+    if(d->cache == NULL) {
+        return NULL;
+    }
+
+    mj_init_cache(d->cache, d->cache_max_size);
+
+    return d->cache;
+}
+
+void mj_make_cachekey(mj_cachekey_t *key, J_COLOR_SPACE colorspace, mj_sampling_t *sampling, int blockoffset_x, int blockoffset_y, int crop_x, int crop_y, int crop_w, int crop_h) {
+    // the key is compared with memcmp(), so we have to make sure that
+    // there are no random bytes in the padding
+    memset(key, 0, sizeof(mj_cachekey_t));
+
+    key->colorspace = colorspace;
+    key->sampling = *sampling;
+
+    key->blockoffset_x = blockoffset_x;
+    key->blockoffset_y = blockoffset_y;
+
+    key->crop_x = crop_x;
+    key->crop_y = crop_y;
+    key->crop_w = crop_w;
+    key->crop_h = crop_h;
+
+    return;
+}
+
+void mj_cache_unlink(mj_cache_t *c, mj_cacheentry_t *e) {
+    if(e->prev != NULL) {
+        e->prev->next = e->next;
+    }
+    else {
+        c->head = e->next;
+    }
+
+    if(e->next != NULL) {
+        e->next->prev = e->prev;
+    }
+    else {
+        c->tail = e->prev;
+    }
+
+    e->prev = NULL;
+    e->next = NULL;
+
+    return;
+}
+
+void mj_cache_unchain(mj_cache_t *c, mj_cacheentry_t *e) {
+    mj_cacheentry_t **p;
+
+    for(p = &c->buckets[e->hash % MJ_CACHE_NBUCKETS]; *p != NULL; p = &(*p)->chain) {
+        if(*p == e) {
+            *p = e->chain;
+            break;
+        }
+    }
+
+    e->chain = NULL;
+
+    return;
+}
+
+void mj_cache_link(mj_cache_t *c, mj_cacheentry_t *e) {
+    e->prev = NULL;
+    e->next = c->head;
+
+    if(c->head != NULL) {
+        c->head->prev = e;
+    }
+    else {
+        c->tail = e;
+    }
+
+    c->head = e;
+
+    return;
+}
+
+size_t mj_cache_entry_size(mj_compileddropon_t *cd, int pinned) {
+    // a pinned compiled dropon is never evicted, only the quantized and the fixed-point blocks the
+    // compose kernels derive from it count towards the size of the cache
+    if(pinned != 0) {
+        return mj_compileddropon_derived_size(cd);
+    }
+
+    return sizeof(mj_cacheentry_t) + mj_compileddropon_size(cd);
+}
+
+mj_compileddropon_t *mj_cache_lookup(mj_cache_t *c, mj_cachekey_t *key) {
+    if(c == NULL || key == NULL) {
+        return NULL;
+    }
+
+    mj_cacheentry_t *e;
+
+    uint64_t hash = mj_hash(MJ_HASH_INIT, key, sizeof(mj_cachekey_t));
+
+    for(e = c->buckets[hash % MJ_CACHE_NBUCKETS]; e != NULL; e = e->chain) {
+        if(e->hash != hash || memcmp(&e->key, key, sizeof(mj_cachekey_t)) != 0) {
+            continue;
+        }
+
+        // move the entry to the front, it is now the most recently used one
+        if(e != c->head) {
+            mj_cache_unlink(c, e);
+            mj_cache_link(c, e);
+        }
+
+        return &e->cd;
+    }
+
+    return NULL;
+}
+
+mj_compileddropon_t *mj_cache_insert(mj_cache_t *c, mj_cachekey_t *key, mj_compileddropon_t *cd, int pinned) {
+    if(c == NULL || key == NULL || cd == NULL) {
+        return NULL;
+    }
+
+    size_t size = mj_cache_entry_size(cd, pinned);
+
+    // the compiled dropon will not be cached if it is bigger than the whole cache.
+    // the caller remains the owner of the compiled dropon in this case.
+    if(size > c->max_size) {
+        if(pinned == 0) {
+            return NULL;
+        }
+
+        mj_free_compileddropon_derived(cd);
+        size = 0;
+    }
+
+    mj_cache_evict(c, c->max_size - size);
+
+    mj_cacheentry_t *e = (mj_cacheentry_t *)calloc(1, sizeof(mj_cacheentry_t));
+    if(e == NULL) {
+        return NULL;
+    }
+
+    // the cache takes over the ownership of the compiled dropon
+    e->key = *key;
+    e->hash = mj_hash(MJ_HASH_INIT, key, sizeof(mj_cachekey_t));
+    e->cd = *cd;
+    e->size = size;
+    e->pinned = pinned;
+
+    mj_cache_link(c, e);
+    c->size += size;
+
+    e->chain = c->buckets[e->hash % MJ_CACHE_NBUCKETS];
+    c->buckets[e->hash % MJ_CACHE_NBUCKETS] = e;
+
+    memset(cd, 0, sizeof(mj_compileddropon_t));
+
+    return &e->cd;
+}
+
+void mj_cache_evict(mj_cache_t *c, size_t max_size) {
+    if(c == NULL) {
+        return;
+    }
+
+    mj_cacheentry_t *e, *prev;
+
+    // remove the least recently used entries until the cache fits into max_size
+    for(e = c->tail; e != NULL && c->size > max_size; e = prev) {
+        prev = e->prev;
+
+        // the blocks of a pinned entry stay, only the blocks derived from them are removed
+        if(e->pinned != 0) {
+            mj_free_compileddropon_derived(&e->cd);
+            c->size -= e->size;
+            e->size = 0;
+
+            continue;
+        }
+
+        mj_cache_unlink(c, e);
+        mj_cache_unchain(c, e);
+        c->size -= e->size;
+
+        mj_free_compileddropon(&e->cd);
+        free(e);
+    }
+
+    return;
+}
+
+void mj_cache_update(mj_cache_t *c) {
+    if(c == NULL) {
+        return;
+    }
+
+    mj_cacheentry_t *e;
+    size_t           size;
+
+    // the quantized and the fixed-point blocks are added to a compiled dropon after it has been inserted
+    for(e = c->head; e != NULL; e = e->next) {
+        size = mj_cache_entry_size(&e->cd, e->pinned);
+
+        c->size = c->size - e->size + size;
+        e->size = size;
+    }
+
+    mj_cache_evict(c, c->max_size);
+
+    return;
+}
+
+void mj_cache_pin(mj_cache_t *c, mj_compileddropon_t *cd) {
+    if(c == NULL || cd == NULL) {
+        return;
+    }
+
+    mj_cacheentry_t *e;
+
+    for(e = c->head; e != NULL; e = e->next) {
+        if(&e->cd != cd || e->pinned != 0) {
+            continue;
+        }
+
+        c->size -= e->size;
+        e->size = mj_cache_entry_size(&e->cd, 1);
+        e->pinned = 1;
+        c->size += e->size;
+
+        break;
+    }
+
+    return;
+}
+
+uint64_t mj_hash(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    size_t               i;
+
+    // FNV-1a
+    for(i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= MJ_HASH_PRIME;
+    }
+
+    return hash;
+}
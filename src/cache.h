@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _LIBMODJPEG_CACHE_H_
+#define _LIBMODJPEG_CACHE_H_
+
+#include <stdint.h>
+
+#include "libmodjpeg.h"
+
+// FNV-1a
+#define MJ_HASH_INIT  14695981039346656037ULL
+#define MJ_HASH_PRIME 1099511628211ULL
+
+#define MJ_CACHE_NBUCKETS 256
+
+typedef struct {
+    int           colorspace;
+    mj_sampling_t sampling;
+
+    int blockoffset_x;
+    int blockoffset_y;
+
+    int crop_x;
+    int crop_y;
+    int crop_w;
+    int crop_h;
+} mj_cachekey_t;
+
+typedef struct mj_cacheentry_t {
+    mj_cachekey_t       key;
+    unsigned long long  hash;
+    mj_compileddropon_t cd;
+    size_t              size;
+    int                 pinned;
+
+    struct mj_cacheentry_t *prev;
+    struct mj_cacheentry_t *next;
+
+    // the next entry in the same bucket of the hash table
+    struct mj_cacheentry_t *chain;
+} mj_cacheentry_t;
+
+struct mj_cache_t {
+    size_t size;
+    size_t max_size;
+
+    // the most recently used entry is at the head, the least recently used at the tail
+    mj_cacheentry_t *head;
+    mj_cacheentry_t *tail;
+
+    // the entries are also in a hash table for a lookup in constant time
+    mj_cacheentry_t *buckets[MJ_CACHE_NBUCKETS];
+};
+
+void        mj_init_cache(mj_cache_t *c, size_t max_size);
+void        mj_free_cache(mj_cache_t *c);
+mj_cache_t *mj_dropon_cache(mj_dropon_t *d);
+
+void mj_make_cachekey(mj_cachekey_t *key, J_COLOR_SPACE colorspace, mj_sampling_t *sampling, int blockoffset_x, int blockoffset_y, int crop_x, int crop_y, int crop_w, int crop_h);
+
+mj_compileddropon_t *mj_cache_lookup(mj_cache_t *c, mj_cachekey_t *key);
+mj_compileddropon_t *mj_cache_insert(mj_cache_t *c, mj_cachekey_t *key, mj_compileddropon_t *cd, int pinned);
+void                 mj_cache_pin(mj_cache_t *c, mj_compileddropon_t *cd);
+void                 mj_cache_update(mj_cache_t *c);
+size_t               mj_cache_entry_size(mj_compileddropon_t *cd, int pinned);
+
+uint64_t mj_hash(uint64_t hash, const void *data, size_t len);
+
+void mj_cache_evict(mj_cache_t *c, size_t max_size);
+void mj_cache_link(mj_cache_t *c, mj_cacheentry_t *e);
+void mj_cache_unlink(mj_cache_t *c, mj_cacheentry_t *e);
+void mj_cache_unchain(mj_cache_t *c, mj_cacheentry_t *e);
+
+#endif
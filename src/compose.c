@@ -22,19 +22,208 @@
 
 #include "compose.h"
 
+#include "cache.h"
 #include "convolve.h"
 #include "dropon.h"
+#include "fixed.h"
 #include "libmodjpeg.h"
 
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 int mj_compose(mj_jpeg_t *m, mj_dropon_t *d, unsigned int align, int offset_x, int offset_y) {
+    return mj_compose_with_options(m, d, align, offset_x, offset_y, NULL);
+}
+
+void mj_init_composeoptions(mj_composeoptions_t *o) {
+    if(o == NULL) {
+        return;
+    }
+
+    memset(o, 0, sizeof(mj_composeoptions_t));
+
+    o->opacity = MJ_BLEND_FULL;
+
+    return;
+}
+
+int mj_compose_with_options(mj_jpeg_t *m, mj_dropon_t *d, unsigned int align, int offset_x, int offset_y, const mj_composeoptions_t *o) {
+    if(m == NULL || d == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    mj_placeddropon_t p;
+    int               rv;
+
+    // a fully transparent dropon doesn't change the image
+    if(o != NULL && o->opacity <= MJ_BLEND_NONE) {
+        return MJ_OK;
+    }
+
+    rv = mj_place_dropon(&p, m, d, align, offset_x, offset_y, MJ_PLACE_CACHE);
+    if(rv != MJ_OK || p.cd == NULL) {
+        return rv;
+    }
+
+    // compose the dropon and the image
+    rv = mj_compose_with_mask(m, p.cd, p.block_x, p.block_y, p.mcu_x, p.mcu_y, p.mcu_w, p.mcu_h, p.fixed_point, 0, o);
+
+    mj_free_placeddropon(&p);
+
+    // the composition may have quantized the compiled dropon in the cache for another quantization table
+    mj_cache_update(d->cache);
+
+    return rv;
+}
+
+int mj_compose_tiled(mj_jpeg_t *m, mj_dropon_t *d, int offset_x, int offset_y, int stride_x, int stride_y) {
+    return mj_compose_tiled_with_options(m, d, offset_x, offset_y, stride_x, stride_y, NULL);
+}
+
+int mj_compose_tiled_with_options(mj_jpeg_t *m, mj_dropon_t *d, int offset_x, int offset_y, int stride_x, int stride_y, const mj_composeoptions_t *o) {
     if(m == NULL || d == NULL) {
         return MJ_ERR_NULL_DATA;
     }
 
+    mj_placeddropon_t p;
+    int               x, y, rv;
+
+    if(d->blend == MJ_BLEND_NONE || (o != NULL && o->opacity <= MJ_BLEND_NONE)) {
+        return MJ_OK;
+    }
+
+    // without a stride the tiles are next to each other
+    if(stride_x <= 0) {
+        stride_x = d->width;
+    }
+
+    if(stride_y <= 0) {
+        stride_y = d->height;
+    }
+
+    if(stride_x <= 0 || stride_y <= 0) {
+        return MJ_ERR_DROPON_DIMENSIONS;
+    }
+
+    // with strides that are multiples of the size of an MCU all tiles have the same block offset and share
+    // one compiled dropon from the cache. only the tiles that are cropped at the borders are compiled separately.
+    stride_x = ((stride_x + m->sampling.h_factor - 1) / m->sampling.h_factor) * m->sampling.h_factor;
+    stride_y = ((stride_y + m->sampling.v_factor - 1) / m->sampling.v_factor) * m->sampling.v_factor;
+
+    // the first tile is at the top-left corner of the image or partially off the image
+    offset_x %= stride_x;
+    if(offset_x > 0) {
+        offset_x -= stride_x;
+    }
+
+    offset_y %= stride_y;
+    if(offset_y > 0) {
+        offset_y -= stride_y;
+    }
+
+    rv = MJ_OK;
+
+    for(y = offset_y; y < m->height && rv == MJ_OK; y += stride_y) {
+        for(x = offset_x; x < m->width && rv == MJ_OK; x += stride_x) {
+            rv = mj_place_dropon(&p, m, d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, x, y, MJ_PLACE_CACHE);
+            if(rv != MJ_OK || p.cd == NULL) {
+                continue;
+            }
+
+            rv = mj_compose_with_mask(m, p.cd, p.block_x, p.block_y, p.mcu_x, p.mcu_y, p.mcu_w, p.mcu_h, p.fixed_point, 0, o);
+
+            mj_free_placeddropon(&p);
+        }
+    }
+
+    mj_cache_update(d->cache);
+
+    return rv;
+}
+
+int mj_compile_dropon_for(mj_placeddropon_t *p, mj_dropon_t *d, mj_jpeg_t *m, unsigned int align, int offset_x, int offset_y) {
+    if(p == NULL || d == NULL || m == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    mj_component_t *       imagecomp, *alphacomp;
+    mj_fixedquantization_t fq;
+    UINT16 *               quantval;
+    int                    c, rv;
+    size_t                 n;
+
+    // the placed dropon owns its compiled dropon, such that it is independent from the cache of the dropon
+    rv = mj_place_dropon(p, m, d, align, offset_x, offset_y, MJ_PLACE_NOCACHE);
+    if(rv != MJ_OK || p->cd == NULL) {
+        return rv;
+    }
+
+    // the blocks that the compose kernels create on demand are created now, such that mj_compose_compiled()
+    // never changes the compiled dropon. the blocks are quantized for the quantization tables of this image.
+    for(c = 0; c < p->cd->image_ncomponents; c++) {
+        imagecomp = &p->cd->image[c];
+        alphacomp = &p->cd->alpha[c];
+        quantval = m->cinfo.comp_info[c].quant_table->quantval;
+
+        if(alphacomp->classes == NULL) {
+            continue;
+        }
+
+        for(n = 0; n < (size_t)alphacomp->nblocks; n++) {
+            if(alphacomp->classes[n] == MJ_BLOCK_OPAQUE) {
+                break;
+            }
+        }
+
+        if(n != (size_t)alphacomp->nblocks && mj_quantize_component(imagecomp, quantval) == NULL) {
+            mj_free_placeddropon(p);
+            return MJ_ERR_MEMORY;
+        }
+
+        if(p->fixed_point != 0 && mj_init_fixed_quantization(&fq, quantval) != 0) {
+            if(mj_fix_component(imagecomp, alphacomp) == NULL || mj_fix_component(alphacomp, alphacomp) == NULL) {
+                mj_free_placeddropon(p);
+                return MJ_ERR_MEMORY;
+            }
+        }
+    }
+
+    return MJ_OK;
+}
+
+int mj_compose_compiled(mj_jpeg_t *m, const mj_placeddropon_t *p) {
+    return mj_compose_compiled_with_options(m, p, NULL);
+}
+
+int mj_compose_compiled_with_options(mj_jpeg_t *m, const mj_placeddropon_t *p, const mj_composeoptions_t *o) {
+    if(m == NULL || p == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    // the dropon is not visible on the image
+    if(p->cd == NULL || (o != NULL && o->opacity <= MJ_BLEND_NONE)) {
+        return MJ_OK;
+    }
+
+    if(m->width != p->width || m->height != p->height) {
+        return MJ_ERR_IMAGE_SIZE;
+    }
+
+    if(m->cinfo.jpeg_color_space != p->colorspace || memcmp(&m->sampling, &p->sampling, sizeof(mj_sampling_t)) != 0) {
+        return MJ_ERR_UNSUPPORTED_COLORSPACE;
+    }
+
+    // the compiled dropon is only read, i.e. several threads can compose it with different images at the same time
+    return mj_compose_with_mask(m, p->cd, p->block_x, p->block_y, p->mcu_x, p->mcu_y, p->mcu_w, p->mcu_h, p->fixed_point, 1, o);
+}
+
+int mj_place_dropon(mj_placeddropon_t *p, mj_jpeg_t *m, mj_dropon_t *d, unsigned int align, int offset_x, int offset_y, int cache) {
+    memset(p, 0, sizeof(mj_placeddropon_t));
+
     if(d->blend == MJ_BLEND_NONE) {
         return MJ_OK;
     }
@@ -150,193 +339,1077 @@ int mj_compose(mj_jpeg_t *m, mj_dropon_t *d, unsigned int align, int offset_x, i
         blockoffset_y = 0;
     }
 
+    mj_cachekey_t key;
+    int           rv;
+
+    // the part of the compiled dropon that will be composed with the image in MCUs
+    int mcu_x = 0, mcu_y = 0;
+    int mcu_w = (blockoffset_x + crop_w + m->sampling.h_factor - 1) / m->sampling.h_factor;
+    int mcu_h = (blockoffset_y + crop_h + m->sampling.v_factor - 1) / m->sampling.v_factor;
+
+    // if the crop area starts and ends at the border of an MCU of the image, the cropped dropon
+    // is the same as a part of the whole dropon compiled for the block offset it would have if
+    // it wasn't cropped. instead of compiling the cropped dropon, we use this part of the whole
+    // compiled dropon, which can be in the cache already. if it isn't, the whole dropon is only
+    // compiled if most of it is visible, otherwise compiling the cropped dropon is cheaper.
+    if(crop_x != 0 || crop_y != 0 || crop_w != d->width || crop_h != d->height) {
+        int aligned_x = (crop_x + crop_w == d->width || (position_x + crop_x + crop_w) % m->sampling.h_factor == 0);
+        int aligned_y = (crop_y + crop_h == d->height || (position_y + crop_y + crop_h) % m->sampling.v_factor == 0);
+        int fulloffset_x = ((position_x % m->sampling.h_factor) + m->sampling.h_factor) % m->sampling.h_factor;
+        int fulloffset_y = ((position_y % m->sampling.v_factor) + m->sampling.v_factor) % m->sampling.v_factor;
+        int use_view = 0;
+
+        if(aligned_x != 0 && aligned_y != 0) {
+            mj_make_cachekey(&key, m->cinfo.jpeg_color_space, &m->sampling, fulloffset_x, fulloffset_y, 0, 0, d->width, d->height);
+
+            if(mj_cache_lookup(d->cache, &key) != NULL || 2 * (size_t)crop_w * (size_t)crop_h >= (size_t)d->width * (size_t)d->height) {
+                use_view = 1;
+            }
+        }
+
+        if(use_view != 0) {
+            blockoffset_x = fulloffset_x;
+            blockoffset_y = fulloffset_y;
+
+            mcu_x = (blockoffset_x + crop_x) / m->sampling.h_factor;
+            mcu_y = (blockoffset_y + crop_y) / m->sampling.v_factor;
+            mcu_w = (blockoffset_x + crop_x + crop_w + m->sampling.h_factor - 1) / m->sampling.h_factor - mcu_x;
+            mcu_h = (blockoffset_y + crop_y + crop_h + m->sampling.v_factor - 1) / m->sampling.v_factor - mcu_y;
+
+            crop_x = 0;
+            crop_y = 0;
+            crop_w = d->width;
+            crop_h = d->height;
+        }
+    }
+
     // with all these information together with the colorspace and sampling setting from the image
-    // we can generate the apropriate dropon.
-    mj_compileddropon_t cd;
+    // we can generate the apropriate dropon. a dropon that has been compiled before for the same
+    // setting can be taken from the cache.
+    mj_make_cachekey(&key, m->cinfo.jpeg_color_space, &m->sampling, blockoffset_x, blockoffset_y, crop_x, crop_y, crop_w, crop_h);
 
-    int rv = mj_compile_dropon(&cd, d, m->cinfo.jpeg_color_space, &m->sampling, blockoffset_x, blockoffset_y, crop_x, crop_y, crop_w, crop_h);
-    if(rv != MJ_OK) {
-        return rv;
+    if(cache != MJ_PLACE_NOCACHE) {
+        p->cd = mj_cache_lookup(d->cache, &key);
+    }
+
+    if(p->cd == NULL) {
+        // a compiled dropon from the registry is shared with other processes. only its components and the
+        // blocks derived from it count towards the size of the cache, evicting it keeps the blocks in the registry.
+        rv = mj_compile_cachekey(&p->compiled, d, &key);
+        if(rv != MJ_OK) {
+            return rv;
+        }
+
+        // if the compiled dropon doesn't go into the cache, we still own it
+        if(cache == MJ_PLACE_CACHE) {
+            p->cd = mj_cache_insert(mj_dropon_cache(d), &key, &p->compiled, 0);
+        }
+
+        if(p->cd == NULL) {
+            p->cd = &p->compiled;
+        }
     }
 
     // after the dropon is ready we calculate which block of the image the dropon starts
-    int block_x = position_x / m->sampling.h_factor;
-    int block_y = position_y / m->sampling.v_factor;
+    p->block_x = position_x / m->sampling.h_factor;
+    p->block_y = position_y / m->sampling.v_factor;
 
-    if(block_x < 0) {
-        block_x = 0;
+    if(p->block_x < 0) {
+        p->block_x = 0;
     }
 
-    if(block_y < 0) {
-        block_y = 0;
+    if(p->block_y < 0) {
+        p->block_y = 0;
     }
 
-    // compoese the dropon and the image
-    rv = mj_compose_with_mask(m, &cd, block_x, block_y);
+    p->mcu_x = mcu_x;
+    p->mcu_y = mcu_y;
+    p->mcu_w = mcu_w;
+    p->mcu_h = mcu_h;
 
-    mj_free_compileddropon(&cd);
+    p->colorspace = m->cinfo.jpeg_color_space;
+    p->sampling = m->sampling;
+    p->width = m->width;
+    p->height = m->height;
 
-    return rv;
+    p->fixed_point = d->fixed_point;
+
+    return MJ_OK;
 }
 
-int mj_compose_without_mask(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y) {
-    if(m == NULL || cd == NULL) {
+void mj_free_placeddropon(mj_placeddropon_t *p) {
+    if(p == NULL) {
+        return;
+    }
+
+    if(p->cd == &p->compiled) {
+        mj_free_compileddropon(&p->compiled);
+    }
+
+    p->cd = NULL;
+
+    return;
+}
+
+int mj_compose_many(mj_jpeg_t *m, const mj_placement_t *placements, int nplacements) {
+    return mj_compose_many_with_options(m, placements, nplacements, NULL);
+}
+
+int mj_compose_many_with_options(mj_jpeg_t *m, const mj_placement_t *placements, int nplacements, const mj_composeoptions_t *o) {
+    if(m == NULL || placements == NULL) {
         return MJ_ERR_NULL_DATA;
     }
 
-    int                            c, k, l, i;
+    mj_placeddropon_t *p;
+    mj_overlap_t       overlaps[MAX_COMPONENTS];
+    int                nplaced = 0, cache, i, j, c;
+    int                rv = MJ_OK;
+
+    // without placements or fully transparent the dropons don't change the image
+    if(nplacements <= 0 || (o != NULL && o->opacity <= MJ_BLEND_NONE)) {
+        return MJ_OK;
+    }
+
+    p = (mj_placeddropon_t *)calloc(nplacements, sizeof(mj_placeddropon_t));
+    if(p == NULL) {
+        return MJ_ERR_MEMORY;
+    }
+
+    memset(overlaps, 0, sizeof(overlaps));
+
+    for(i = 0; i < nplacements; i++) {
+        if(placements[i].dropon == NULL) {
+            rv = MJ_ERR_NULL_DATA;
+            break;
+        }
+
+        // putting a compiled dropon into the cache can evict the one of an earlier placement of the same dropon
+        cache = MJ_PLACE_CACHE;
+        for(j = 0; j < i; j++) {
+            if(placements[j].dropon == placements[i].dropon) {
+                cache = MJ_PLACE_LOOKUP;
+            }
+        }
+
+        rv = mj_place_dropon(&p[nplaced], m, placements[i].dropon, placements[i].align, placements[i].offset_x, placements[i].offset_y, cache);
+        if(rv != MJ_OK) {
+            break;
+        }
+
+        if(p[nplaced].cd != NULL) {
+            nplaced++;
+        }
+    }
+
+    // the blocks where dropons overlap are de-quantized before the image is changed
+    if(nplaced > 1) {
+        for(c = 0; c < m->cinfo.num_components && rv == MJ_OK; c++) {
+            rv = mj_find_overlaps(&overlaps[c], m, p, nplaced, c);
+        }
+    }
+
+    // all other blocks are composed with only one dropon as with mj_compose()
+    for(i = 0; i < nplaced && rv == MJ_OK; i++) {
+        rv = mj_compose_with_mask(m, p[i].cd, p[i].block_x, p[i].block_y, p[i].mcu_x, p[i].mcu_y, p[i].mcu_w, p[i].mcu_h, p[i].fixed_point, 0, o);
+    }
+
+    // the overlapping blocks are blended with all dropons in order and quantized once. this replaces what the
+    // composition above has written into these blocks.
+    for(c = 0; c < MAX_COMPONENTS; c++) {
+        if(rv == MJ_OK && overlaps[c].nblocks != 0) {
+            for(i = 0; i < nplaced; i++) {
+                mj_blend_overlaps(&overlaps[c], m, &p[i], c, o);
+            }
+
+            mj_quantize_overlaps(&overlaps[c], m, c);
+        }
+
+        mj_free_overlaps(&overlaps[c]);
+    }
+
+    for(i = 0; i < nplaced; i++) {
+        mj_free_placeddropon(&p[i]);
+    }
+
+    free(p);
+
+    for(i = 0; i < nplacements; i++) {
+        if(placements[i].dropon != NULL) {
+            mj_cache_update(placements[i].dropon->cache);
+        }
+    }
+
+    return rv;
+}
+
+// the blocks of component c of the image that are covered by the placed dropon
+static void mj_placeddropon_area(mj_area_t *area, mj_jpeg_t *m, mj_placeddropon_t *p, int c) {
+    mj_component_t *imagecomp = &p->cd->image[c];
+
+    area->x = p->block_x * m->cinfo.comp_info[c].h_samp_factor;
+    area->y = p->block_y * m->cinfo.comp_info[c].v_samp_factor;
+    area->w = p->mcu_w * imagecomp->h_samp_factor;
+    area->h = p->mcu_h * imagecomp->v_samp_factor;
+    area->start_x = p->mcu_x * imagecomp->h_samp_factor;
+    area->start_y = p->mcu_y * imagecomp->v_samp_factor;
+
+    return;
+}
+
+int mj_find_overlaps(mj_overlap_t *o, mj_jpeg_t *m, mj_placeddropon_t *p, int nplaced, int c) {
+    struct jpeg_decompress_struct *cinfo_m = &m->cinfo;
+    JBLOCKARRAY                    blocks_m;
+    unsigned char *                coverage;
+    mj_area_t *                    areas;
+    int                            min_x, max_x, min_y, max_y;
+    int                            i, k, x, y, pass;
+
+    memset(o, 0, sizeof(mj_overlap_t));
+
+    areas = (mj_area_t *)calloc(nplaced, sizeof(mj_area_t));
+    if(areas == NULL) {
+        return MJ_ERR_MEMORY;
+    }
+
+    min_x = min_y = INT_MAX;
+    max_x = max_y = 0;
+
+    for(i = 0; i < nplaced; i++) {
+        mj_placeddropon_area(&areas[i], m, &p[i], c);
+
+        if(areas[i].w == 0 || areas[i].h == 0) {
+            continue;
+        }
+
+        min_x = (areas[i].x < min_x ? areas[i].x : min_x);
+        min_y = (areas[i].y < min_y ? areas[i].y : min_y);
+        max_x = (areas[i].x + areas[i].w > max_x ? areas[i].x + areas[i].w : max_x);
+        max_y = (areas[i].y + areas[i].h > max_y ? areas[i].y + areas[i].h : max_y);
+    }
+
+    if(min_x >= max_x || min_y >= max_y) {
+        free(areas);
+        return MJ_OK;
+    }
+
+    coverage = (unsigned char *)malloc(max_x);
+    if(coverage == NULL) {
+        free(areas);
+        return MJ_ERR_MEMORY;
+    }
+
+    // the blocks covered by more than one dropon are counted in the first pass and collected in the second
+    for(pass = 0; pass < 2; pass++) {
+        o->nblocks = 0;
+
+        for(y = min_y; y < max_y; y++) {
+            memset(&coverage[min_x], 0, max_x - min_x);
+
+            for(i = 0; i < nplaced; i++) {
+                if(y < areas[i].y || y >= areas[i].y + areas[i].h) {
+                    continue;
+                }
+
+                for(x = areas[i].x; x < areas[i].x + areas[i].w; x++) {
+                    if(coverage[x] < 2) {
+                        coverage[x]++;
+                    }
+                }
+            }
+
+            for(x = min_x; x < max_x; x++) {
+                if(coverage[x] < 2) {
+                    continue;
+                }
+
+                if(o->position != NULL) {
+                    o->position[o->nblocks * 2] = x;
+                    o->position[o->nblocks * 2 + 1] = y;
+                }
+
+                o->nblocks++;
+            }
+        }
+
+        if(o->nblocks == 0 || o->position != NULL) {
+            break;
+        }
+
+        o->position = (int *)malloc((size_t)o->nblocks * 2 * sizeof(int));
+        o->blocks = (mj_block_t *)malloc((size_t)o->nblocks * DCTSIZE2 * sizeof(mj_block_t));
+        if(o->position == NULL || o->blocks == NULL) {
+            free(coverage);
+            free(areas);
+            mj_free_overlaps(o);
+            return MJ_ERR_MEMORY;
+        }
+    }
+
+    free(coverage);
+    free(areas);
+
+    // the blocks are collected row by row, i.e. each row of the image is accessed once
+    const UINT16 *quantval = cinfo_m->comp_info[c].quant_table->quantval;
+
+    for(i = 0, blocks_m = NULL; i < o->nblocks; i++) {
+        x = o->position[i * 2];
+        y = o->position[i * 2 + 1];
+
+        if(i == 0 || y != o->position[i * 2 - 1]) {
+            blocks_m = (*cinfo_m->mem->access_virt_barray)((j_common_ptr)cinfo_m, m->coef[c], y, 1, FALSE);
+        }
+
+        for(k = 0; k < DCTSIZE2; k++) {
+            o->blocks[i * DCTSIZE2 + k] = (float)blocks_m[0][x][k] * (float)quantval[k];
+        }
+    }
+
+    return MJ_OK;
+}
+
+// the opacity of the dropon from 0 to 1, see mj_composeoptions_t
+static float mj_compose_opacity(const mj_composeoptions_t *o) {
+    if(o == NULL || o->opacity >= MJ_BLEND_FULL) {
+        return 1.0f;
+    }
+
+    return (float)o->opacity / (float)MJ_BLEND_FULL;
+}
+
+// the value that is added to the DC coefficients of a component of the dropon, see mj_composeoptions_t. a DC
+// coefficient is 8 times the average of the samples, i.e. larger values move all samples out of range anyways.
+static int mj_recolor_offset(mj_jpeg_t *m, const mj_composeoptions_t *o, int c) {
+    int value = 0;
+
+    if(o == NULL) {
+        return 0;
+    }
+
+    if(c == 0 && (m->cinfo.jpeg_color_space == JCS_YCbCr || m->cinfo.jpeg_color_space == JCS_GRAYSCALE)) {
+        value = o->luminance;
+    }
+    else if(c == 1 && m->cinfo.jpeg_color_space == JCS_YCbCr) {
+        value = o->cb_value;
+    }
+    else if(c == 2 && m->cinfo.jpeg_color_space == JCS_YCbCr) {
+        value = o->cr_value;
+    }
+
+    if(value > 2047) {
+        value = 2047;
+    }
+    else if(value < -2047) {
+        value = -2047;
+    }
+
+    return value;
+}
+
+// the block of the dropon, or a copy of it with the DC coefficient moved by dc if the dropon is recolored
+static inline mj_block_t *mj_recolor_block(mj_block_t *recolored, mj_block_t *block, float dc) {
+    if(dc == 0.0f) {
+        return block;
+    }
+
+    mj_shift_block(recolored, block, dc);
+
+    return recolored;
+}
+
+static inline int16_t *mj_recolor_block_fixed(int16_t *recolored, int16_t *block, int dc) {
+    if(dc == 0) {
+        return block;
+    }
+
+    mj_shift_block_fixed(recolored, block, dc);
+
+    return recolored;
+}
+
+// the overlapping blocks are always blended in floating point, also for dropons in fixed point, because they
+// stay de-quantized until all dropons are blended
+void mj_blend_overlaps(mj_overlap_t *o, mj_jpeg_t *m, mj_placeddropon_t *p, int c, const mj_composeoptions_t *options) {
+    mj_component_t *imagecomp = &p->cd->image[c], *alphacomp = &p->cd->alpha[c];
+    mj_block_t *    x1, *imageblock, *alphablock;
+    mj_block_t      recolored[DCTSIZE2], scaledalpha[DCTSIZE2];
+    mj_area_t       area;
+    int             i, x, y;
+    size_t          n;
+    float           opacity, dc;
+
+    mj_placeddropon_area(&area, m, p, c);
+
+    opacity = mj_compose_opacity(options);
+    dc = (float)mj_recolor_offset(m, options, c);
+
+    for(i = 0; i < o->nblocks; i++) {
+        x = o->position[i * 2] - area.x;
+        y = o->position[i * 2 + 1] - area.y;
+
+        if(x < 0 || x >= area.w || y < 0 || y >= area.h) {
+            continue;
+        }
+
+        n = (size_t)imagecomp->width_in_blocks * (area.start_y + y) + area.start_x + x;
+        x1 = &o->blocks[i * DCTSIZE2];
+
+        imageblock = mj_recolor_block(recolored, MJ_BLOCK(imagecomp, n), dc);
+        alphablock = MJ_BLOCK(alphacomp, n);
+
+        // the same as in mj_compose_with_mask(), but without the quantization
+        switch(alphacomp->classes != NULL ? alphacomp->classes[n] : MJ_BLOCK_PARTIAL) {
+            case MJ_BLOCK_TRANSPARENT:
+                break;
+            case MJ_BLOCK_OPAQUE:
+                if(opacity < 1.0f) {
+                    mj_blend_block_uniform_dequantized(x1, imageblock, opacity);
+                    break;
+                }
+
+                memcpy(x1, imageblock, DCTSIZE2 * sizeof(mj_block_t));
+                break;
+            case MJ_BLOCK_SAMPLES:
+                if(opacity < 1.0f) {
+                    mj_scale_block(scaledalpha, alphablock, opacity);
+                    alphablock = scaledalpha;
+                }
+
+                mj_blend_block_samples_dequantized(x1, imageblock, alphablock);
+                break;
+            default:
+                if(alphacomp->nonzero != NULL && alphacomp->nonzero[n] == 1) {
+                    mj_blend_block_uniform_dequantized(x1, imageblock, alphablock[0] * 4.0f * opacity);
+                    break;
+                }
+
+                if(opacity < 1.0f) {
+                    mj_scale_block(scaledalpha, alphablock, opacity);
+                    alphablock = scaledalpha;
+                }
+
+                mj_blend_block_dequantized(x1, imageblock, alphablock, alphacomp->nonzero != NULL ? alphacomp->nonzero[n] : ~0ULL);
+                break;
+        }
+    }
+
+    return;
+}
+
+void mj_quantize_overlaps(mj_overlap_t *o, mj_jpeg_t *m, int c) {
+    struct jpeg_decompress_struct *cinfo_m = &m->cinfo;
+    JBLOCKARRAY                    blocks_m = NULL;
+    mj_quantization_t              q;
+    int                            i, k, x, y;
+
+    mj_init_quantization(&q, cinfo_m->comp_info[c].quant_table->quantval);
+
+    for(i = 0; i < o->nblocks; i++) {
+        x = o->position[i * 2];
+        y = o->position[i * 2 + 1];
+
+        if(i == 0 || y != o->position[i * 2 - 1]) {
+            blocks_m = (*cinfo_m->mem->access_virt_barray)((j_common_ptr)cinfo_m, m->coef[c], y, 1, TRUE);
+        }
+
+        for(k = 0; k < DCTSIZE2; k++) {
+            blocks_m[0][x][k] = mj_quantize_coefficient(o->blocks[i * DCTSIZE2 + k], q.reciprocal[k]);
+        }
+    }
+
+    return;
+}
+
+void mj_free_overlaps(mj_overlap_t *o) {
+    if(o->position != NULL) {
+        free(o->position);
+    }
+
+    if(o->blocks != NULL) {
+        free(o->blocks);
+    }
+
+    memset(o, 0, sizeof(mj_overlap_t));
+
+    return;
+}
+
+// the layouts of the image with a specialized compose kernel, see mj_compose_layout()
+#define MJ_LAYOUT_GENERIC 0
+#define MJ_LAYOUT_GRAY    1
+#define MJ_LAYOUT_444     2
+#define MJ_LAYOUT_420     3
+
+// generate the compose kernels for a layout from the inline body. ncomponents, h_samp_factor, and v_samp_factor
+// are constants, such that the compiler can fold the loop bounds and offsets. 0 means to take them from the image.
+// only the first component is subsampled in these layouts.
+#define MJ_COMPOSE_KERNELS(layout, ncomponents, h_samp_factor, v_samp_factor)                                                                                \
+    static int mj_compose_without_mask_##layout(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y, int mcu_x, int mcu_y, int mcu_w, int mcu_h) { \
+        return mj_compose_without_mask_layout(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h, ncomponents, h_samp_factor, v_samp_factor);             \
+    }                                                                                                                                                      \
+                                                                                                                                                           \
+    static int mj_compose_with_mask_##layout(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y, int mcu_x, int mcu_y, int mcu_w, int mcu_h,   \
+                                             int fixed_point, JBLOCKROW **rows, int readonly, const mj_composeoptions_t *o) {                              \
+        return mj_compose_with_mask_layout(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h, fixed_point, rows, readonly, o, ncomponents,               \
+                                           h_samp_factor, v_samp_factor);                                                                                  \
+    }
+
+int mj_compose_layout(mj_jpeg_t *m, mj_compileddropon_t *cd) {
+    struct jpeg_decompress_struct *cinfo_m = &m->cinfo;
+    int                            c;
+
+    if(cd->image_ncomponents != cinfo_m->num_components) {
+        return MJ_LAYOUT_GENERIC;
+    }
+
+    for(c = 0; c < cinfo_m->num_components; c++) {
+        // the dropon is compiled for the sampling of the image
+        if(cd->image[c].h_samp_factor != cinfo_m->comp_info[c].h_samp_factor || cd->image[c].v_samp_factor != cinfo_m->comp_info[c].v_samp_factor) {
+            return MJ_LAYOUT_GENERIC;
+        }
+
+        // the chroma components are never subsampled in these layouts
+        if(c != 0 && (cinfo_m->comp_info[c].h_samp_factor != 1 || cinfo_m->comp_info[c].v_samp_factor != 1)) {
+            return MJ_LAYOUT_GENERIC;
+        }
+    }
+
+    if(cinfo_m->jpeg_color_space == JCS_GRAYSCALE && cinfo_m->num_components == 1 && cinfo_m->comp_info[0].h_samp_factor == 1 && cinfo_m->comp_info[0].v_samp_factor == 1) {
+        return MJ_LAYOUT_GRAY;
+    }
+
+    if(cinfo_m->jpeg_color_space != JCS_YCbCr || cinfo_m->num_components != 3) {
+        return MJ_LAYOUT_GENERIC;
+    }
+
+    if(cinfo_m->comp_info[0].h_samp_factor == 1 && cinfo_m->comp_info[0].v_samp_factor == 1) {
+        return MJ_LAYOUT_444;
+    }
+
+    if(cinfo_m->comp_info[0].h_samp_factor == 2 && cinfo_m->comp_info[0].v_samp_factor == 2) {
+        return MJ_LAYOUT_420;
+    }
+
+    return MJ_LAYOUT_GENERIC;
+}
+
+static inline __attribute__((always_inline)) int mj_compose_without_mask_layout(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y, int mcu_x, int mcu_y, int mcu_w, int mcu_h, int ncomponents, int h_samp_factor, int v_samp_factor) {
+    int                            c, k, l;
+    size_t                         n;
     int                            width_offset = 0, height_offset = 0;
     int                            width_in_blocks = 0, height_in_blocks = 0;
+    int                            start_x = 0, start_y = 0;
     struct jpeg_decompress_struct *cinfo_m;
     jpeg_component_info *          component_m;
     JBLOCKARRAY                    blocks_m;
-    JCOEFPTR                       coefs_m;
+    JCOEF *                        quantized;
+    mj_quantization_t              q;
+
+    int                            h, v;
 
     mj_component_t *imagecomp;
-    mj_block_t *    imageblock;
 
     cinfo_m = &m->cinfo;
 
-    for(c = 0; c < cd->image_ncomponents; c++) {
+    if(ncomponents == 0) {
+        ncomponents = cd->image_ncomponents;
+    }
+
+    for(c = 0; c < ncomponents; c++) {
         component_m = &cinfo_m->comp_info[c];
         imagecomp = &cd->image[c];
 
-        width_in_blocks = imagecomp->width_in_blocks;
-        height_in_blocks = imagecomp->height_in_blocks;
+        // the blocks of the dropon quantized with the quantization table of the image
+        quantized = mj_quantize_component(imagecomp, component_m->quant_table->quantval);
+        if(quantized == NULL) {
+            mj_init_quantization(&q, component_m->quant_table->quantval);
+        }
+
+        h = (h_samp_factor == 0 ? imagecomp->h_samp_factor : (c == 0 ? h_samp_factor : 1));
+        v = (v_samp_factor == 0 ? imagecomp->v_samp_factor : (c == 0 ? v_samp_factor : 1));
 
-        width_offset = block_x * component_m->h_samp_factor;
-        height_offset = block_y * component_m->v_samp_factor;
+        // the part of the blocks of the dropon that is composed
+        width_in_blocks = mcu_w * h;
+        height_in_blocks = mcu_h * v;
+
+        start_x = mcu_x * h;
+        start_y = mcu_y * v;
+
+        width_offset = block_x * (h_samp_factor == 0 ? component_m->h_samp_factor : h);
+        height_offset = block_y * (v_samp_factor == 0 ? component_m->v_samp_factor : v);
 
         // copy the values from the dropon into the image
         for(l = 0; l < height_in_blocks; l++) {
-            blocks_m = (*cinfo_m->mem->access_virt_barray)((j_common_ptr)&cinfo_m, m->coef[c], height_offset + l, 1, TRUE);
+            blocks_m = (*cinfo_m->mem->access_virt_barray)((j_common_ptr)cinfo_m, m->coef[c], height_offset + l, 1, TRUE);
+
+            n = (size_t)imagecomp->width_in_blocks * (start_y + l) + start_x;
+
+            if(quantized != NULL) {
+                memcpy(blocks_m[0][width_offset], &quantized[n * DCTSIZE2], (size_t)width_in_blocks * DCTSIZE2 * sizeof(JCOEF));
+                continue;
+            }
 
             for(k = 0; k < width_in_blocks; k++) {
-                coefs_m = blocks_m[0][width_offset + k];
-                imageblock = imagecomp->blocks[width_in_blocks * l + k];
-
-                for(i = 0; i < DCTSIZE2; i += 8) {
-                    coefs_m[i + 0] = (int)imageblock[i + 0] / component_m->quant_table->quantval[i + 0];
-                    coefs_m[i + 1] = (int)imageblock[i + 1] / component_m->quant_table->quantval[i + 1];
-                    coefs_m[i + 2] = (int)imageblock[i + 2] / component_m->quant_table->quantval[i + 2];
-                    coefs_m[i + 3] = (int)imageblock[i + 3] / component_m->quant_table->quantval[i + 3];
-                    coefs_m[i + 4] = (int)imageblock[i + 4] / component_m->quant_table->quantval[i + 4];
-                    coefs_m[i + 5] = (int)imageblock[i + 5] / component_m->quant_table->quantval[i + 5];
-                    coefs_m[i + 6] = (int)imageblock[i + 6] / component_m->quant_table->quantval[i + 6];
-                    coefs_m[i + 7] = (int)imageblock[i + 7] / component_m->quant_table->quantval[i + 7];
-                }
+                mj_replace_block(blocks_m[0][width_offset + k], MJ_BLOCK(imagecomp, n + k), &q);
             }
         }
-
-        break;
     }
 
     return MJ_OK;
 }
 
-int mj_compose_with_mask(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y) {
-    if(m == NULL || cd == NULL) {
-        return MJ_ERR_NULL_DATA;
-    }
-
-    int                            c, k, l, i;
+static inline __attribute__((always_inline)) int mj_compose_with_mask_layout(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y, int mcu_x, int mcu_y, int mcu_w, int mcu_h, int fixed_point, JBLOCKROW **rows, int readonly, const mj_composeoptions_t *o, int ncomponents, int h_samp_factor, int v_samp_factor) {
+    int                            c, k, l;
+    size_t                         n;
     int                            width_offset = 0, height_offset = 0;
     int                            width_in_blocks = 0, height_in_blocks = 0;
+    int                            start_x = 0, start_y = 0;
     struct jpeg_decompress_struct *cinfo_m;
     jpeg_component_info *          component_m;
-    JBLOCKARRAY                    blocks_m;
-    JCOEFPTR                       coefs_m;
-    float                          X[DCTSIZE2], Y[DCTSIZE2];
+    JBLOCKROW                      row_m;
+    UINT16 *                       quantval;
+    JCOEF *                        quantized;
+    mj_quantization_t              q;
+    int                            npair;
+    JCOEFPTR                       pair_coefs[MJ_FIXED_PAIR];
+    mj_fixedquantization_t         fq;
+    mj_fixed_t *                   fixedimage, *fixedalpha;
+    int16_t *                      pair_fixedimage[MJ_FIXED_PAIR], *pair_fixedalpha[MJ_FIXED_PAIR];
+    float                          opacity;
+    int                            fixedopacity, fixeduniform;
+    mj_block_t                     scaledalpha[DCTSIZE2];
+    int16_t                        pair_fixedscaledalpha[MJ_FIXED_PAIR][DCTSIZE2];
+    float                          dc;
+    int                            fixeddc;
+    mj_block_t                     recolored[DCTSIZE2];
+    int16_t                        fixedrecolored[DCTSIZE2], pair_fixedrecolored[MJ_FIXED_PAIR][DCTSIZE2];
+
+    int                            h, v;
 
     mj_component_t *imagecomp, *alphacomp;
-    mj_block_t *    imageblock, *alphablock;
 
     cinfo_m = &m->cinfo;
 
-    for(c = 0; c < cd->image_ncomponents; c++) {
+    if(ncomponents == 0) {
+        ncomponents = cd->image_ncomponents;
+    }
+
+    // the blend is linear in the mask, i.e. the opacity scales each block of the mask right before it is blended
+    opacity = mj_compose_opacity(o);
+
+    // in Q15 an opacity below 1 is at most 32767, and it is at least 1 such that the blend is not skipped
+    fixedopacity = mj_clamp_fixed_alpha((int)(opacity * (1 << MJ_FIXED_UNIFORM_BITS) + 0.5f));
+
+    for(c = 0; c < ncomponents; c++) {
         component_m = &cinfo_m->comp_info[c];
         imagecomp = &cd->image[c];
         alphacomp = &cd->alpha[c];
+        quantval = component_m->quant_table->quantval;
+        quantized = NULL;
+
+        // a read-only compiled dropon is not changed, i.e. only blocks that were quantized before are used
+        if(readonly != 0) {
+            quantized = mj_find_quantized(imagecomp, quantval);
+        }
+
+        // the reciprocals of the quantization table are shared by all blocks of the component
+        mj_init_quantization(&q, quantval);
+
+        // a uniform change of the color of the dropon only moves the DC coefficients of its blocks
+        fixeddc = mj_recolor_offset(m, o, c);
+        dc = (float)fixeddc;
+        fixeddc *= (1 << MJ_FIXED_IMAGE_BITS);
 
-        width_in_blocks = imagecomp->width_in_blocks;
-        height_in_blocks = imagecomp->height_in_blocks;
+        // the blocks in the pixel domain and the blocks with a uniform mask are blended in fixed point if the
+        // quantization table fits, all other blocks in floating point
+        fixedimage = NULL;
+        fixedalpha = NULL;
 
-        width_offset = block_x * component_m->h_samp_factor;
-        height_offset = block_y * component_m->v_samp_factor;
+        if(fixed_point != 0 && alphacomp->classes != NULL && mj_init_fixed_quantization(&fq, quantval) != 0) {
+            if(readonly != 0) {
+                fixedimage = mj_fixed_blocks(imagecomp);
+                fixedalpha = mj_fixed_blocks(alphacomp);
+            }
+            else {
+                fixedimage = mj_fix_component(imagecomp, alphacomp);
+                fixedalpha = mj_fix_component(alphacomp, alphacomp);
+            }
+
+            if(fixedalpha == NULL) {
+                fixedimage = NULL;
+            }
+        }
+
+        h = (h_samp_factor == 0 ? imagecomp->h_samp_factor : (c == 0 ? h_samp_factor : 1));
+        v = (v_samp_factor == 0 ? imagecomp->v_samp_factor : (c == 0 ? v_samp_factor : 1));
+
+        // the part of the blocks of the dropon that is composed
+        width_in_blocks = mcu_w * h;
+        height_in_blocks = mcu_h * v;
+
+        start_x = mcu_x * h;
+        start_y = mcu_y * v;
+
+        width_offset = block_x * (h_samp_factor == 0 ? component_m->h_samp_factor : h);
+        height_offset = block_y * (v_samp_factor == 0 ? component_m->v_samp_factor : v);
 
         // blend the values from the dropon with the image
         for(l = 0; l < height_in_blocks; l++) {
-            blocks_m = (*cinfo_m->mem->access_virt_barray)((j_common_ptr)&cinfo_m, m->coef[c], height_offset + l, 1, TRUE);
+            // the rows are realized before if the bands of the dropon are composed in parallel
+            if(rows != NULL) {
+                row_m = rows[c][l];
+            }
+            else {
+                row_m = (*cinfo_m->mem->access_virt_barray)((j_common_ptr)cinfo_m, m->coef[c], height_offset + l, 1, TRUE)[0];
+            }
+
+            npair = 0;
 
             for(k = 0; k < width_in_blocks; k++) {
-                coefs_m = blocks_m[0][width_offset + k];
-                imageblock = imagecomp->blocks[width_in_blocks * l + k];
-                alphablock = alphacomp->blocks[width_in_blocks * l + k];
-
-                // de-quantize
-                for(i = 0; i < DCTSIZE2; i += 8) {
-                    coefs_m[i + 0] *= component_m->quant_table->quantval[i + 0];
-                    coefs_m[i + 1] *= component_m->quant_table->quantval[i + 1];
-                    coefs_m[i + 2] *= component_m->quant_table->quantval[i + 2];
-                    coefs_m[i + 3] *= component_m->quant_table->quantval[i + 3];
-                    coefs_m[i + 4] *= component_m->quant_table->quantval[i + 4];
-                    coefs_m[i + 5] *= component_m->quant_table->quantval[i + 5];
-                    coefs_m[i + 6] *= component_m->quant_table->quantval[i + 6];
-                    coefs_m[i + 7] *= component_m->quant_table->quantval[i + 7];
-                }
+                n = (size_t)imagecomp->width_in_blocks * (start_y + l) + start_x + k;
 
-                // x = x0 - x1
-                for(i = 0; i < DCTSIZE2; i += 8) {
-                    X[i + 0] = imageblock[i + 0] - coefs_m[i + 0];
-                    X[i + 1] = imageblock[i + 1] - coefs_m[i + 1];
-                    X[i + 2] = imageblock[i + 2] - coefs_m[i + 2];
-                    X[i + 3] = imageblock[i + 3] - coefs_m[i + 3];
-                    X[i + 4] = imageblock[i + 4] - coefs_m[i + 4];
-                    X[i + 5] = imageblock[i + 5] - coefs_m[i + 5];
-                    X[i + 6] = imageblock[i + 6] - coefs_m[i + 6];
-                    X[i + 7] = imageblock[i + 7] - coefs_m[i + 7];
-                }
+                // only the blocks where the mask is neither fully transparent nor fully opaque need to be blended
+                switch(alphacomp->classes != NULL ? alphacomp->classes[n] : MJ_BLOCK_PARTIAL) {
+                    case MJ_BLOCK_TRANSPARENT:
+                        break;
+                    case MJ_BLOCK_OPAQUE:
+                        // with less opacity the mask of an opaque block is uniform
+                        if(opacity < 1.0f) {
+                            if(fixedimage != NULL) {
+                                mj_blend_block_uniform_fixed(row_m[width_offset + k], mj_recolor_block_fixed(fixedrecolored, mj_fixed_block(fixedimage, n), fixeddc), fixedopacity, &fq);
+                            }
+                            else {
+                                mj_blend_block_uniform(row_m[width_offset + k], mj_recolor_block(recolored, MJ_BLOCK(imagecomp, n), dc), opacity, &q);
+                            }
+                            break;
+                        }
 
-                memset(Y, 0, DCTSIZE2 * sizeof(float));
-
-                // y' = w * x (convolution)
-                for(i = 0; i < DCTSIZE; i++) {
-                    mj_convolve(X, Y, alphablock[(i * DCTSIZE) + 0], i, 0);
-                    mj_convolve(X, Y, alphablock[(i * DCTSIZE) + 1], i, 1);
-                    mj_convolve(X, Y, alphablock[(i * DCTSIZE) + 2], i, 2);
-                    mj_convolve(X, Y, alphablock[(i * DCTSIZE) + 3], i, 3);
-                    mj_convolve(X, Y, alphablock[(i * DCTSIZE) + 4], i, 4);
-                    mj_convolve(X, Y, alphablock[(i * DCTSIZE) + 5], i, 5);
-                    mj_convolve(X, Y, alphablock[(i * DCTSIZE) + 6], i, 6);
-                    mj_convolve(X, Y, alphablock[(i * DCTSIZE) + 7], i, 7);
-                }
+                        // the dropon is quantized once per quantization table on the first opaque block
+                        if(quantized == NULL && readonly == 0) {
+                            quantized = mj_quantize_component(imagecomp, quantval);
+                        }
 
-                // y = x1 + y'
-                for(i = 0; i < DCTSIZE2; i += 8) {
-                    coefs_m[i + 0] += (int)Y[i + 0];
-                    coefs_m[i + 1] += (int)Y[i + 1];
-                    coefs_m[i + 2] += (int)Y[i + 2];
-                    coefs_m[i + 3] += (int)Y[i + 3];
-                    coefs_m[i + 4] += (int)Y[i + 4];
-                    coefs_m[i + 5] += (int)Y[i + 5];
-                    coefs_m[i + 6] += (int)Y[i + 6];
-                    coefs_m[i + 7] += (int)Y[i + 7];
-                }
+                        if(quantized != NULL) {
+                            memcpy(row_m[width_offset + k], &quantized[n * DCTSIZE2], DCTSIZE2 * sizeof(JCOEF));
+                        }
+                        else {
+                            mj_replace_block(row_m[width_offset + k], MJ_BLOCK(imagecomp, n), &q);
+                        }
+
+                        // the coefficients are quantized independently, i.e. only the DC coefficient changes
+                        if(dc != 0.0f) {
+                            row_m[width_offset + k][0] = mj_quantize_coefficient(MJ_BLOCK(imagecomp, n)[0] + dc, q.reciprocal[0]);
+                        }
+                        break;
+                    case MJ_BLOCK_SAMPLES:
+                        if(fixedimage == NULL) {
+                            if(opacity < 1.0f) {
+                                mj_scale_block(scaledalpha, MJ_BLOCK(alphacomp, n), opacity);
+                                mj_blend_block_samples(row_m[width_offset + k], mj_recolor_block(recolored, MJ_BLOCK(imagecomp, n), dc), scaledalpha, &q);
+                                break;
+                            }
+
+                            mj_blend_block_samples(row_m[width_offset + k], mj_recolor_block(recolored, MJ_BLOCK(imagecomp, n), dc), MJ_BLOCK(alphacomp, n), &q);
+                            break;
+                        }
+
+                        // the fixed point kernel blends two blocks at once, so they are collected in pairs
+                        pair_coefs[npair] = row_m[width_offset + k];
+                        pair_fixedimage[npair] = mj_recolor_block_fixed(pair_fixedrecolored[npair], mj_fixed_block(fixedimage, n), fixeddc);
+                        pair_fixedalpha[npair] = mj_fixed_block(fixedalpha, n);
+
+                        if(opacity < 1.0f) {
+                            mj_scale_block_fixed(pair_fixedscaledalpha[npair], pair_fixedalpha[npair], fixedopacity);
+                            pair_fixedalpha[npair] = pair_fixedscaledalpha[npair];
+                        }
+
+                        if(++npair == MJ_FIXED_PAIR) {
+                            mj_blend_blocks_samples_fixed(pair_coefs, pair_fixedimage, pair_fixedalpha, npair, &fq);
+                            npair = 0;
+                        }
+                        break;
+                    default:
+                        // a mask with only a DC coefficient has the same value for all samples. the weight of the
+                        // DC coefficient is alpha / 1020, see mj_weight_alpha_component().
+                        if(alphacomp->nonzero != NULL && alphacomp->nonzero[n] == 1) {
+                            if(fixedimage != NULL) {
+                                fixeduniform = (opacity < 1.0f ? mj_scale_fixed(mj_fixed_block(fixedalpha, n)[0], fixedopacity) : mj_fixed_block(fixedalpha, n)[0]);
 
-                // quantize
-                for(i = 0; i < DCTSIZE2; i += 8) {
-                    coefs_m[i + 0] /= component_m->quant_table->quantval[i + 0];
-                    coefs_m[i + 1] /= component_m->quant_table->quantval[i + 1];
-                    coefs_m[i + 2] /= component_m->quant_table->quantval[i + 2];
-                    coefs_m[i + 3] /= component_m->quant_table->quantval[i + 3];
-                    coefs_m[i + 4] /= component_m->quant_table->quantval[i + 4];
-                    coefs_m[i + 5] /= component_m->quant_table->quantval[i + 5];
-                    coefs_m[i + 6] /= component_m->quant_table->quantval[i + 6];
-                    coefs_m[i + 7] /= component_m->quant_table->quantval[i + 7];
+                                // the mask is transparent in Q15 with the opacity applied, i.e. the block doesn't change
+                                if(fixeduniform <= 0) {
+                                    break;
+                                }
+
+                                mj_blend_block_uniform_fixed(row_m[width_offset + k], mj_recolor_block_fixed(fixedrecolored, mj_fixed_block(fixedimage, n), fixeddc),
+                                                             mj_clamp_fixed_alpha(fixeduniform), &fq);
+                                break;
+                            }
+
+                            mj_blend_block_uniform(row_m[width_offset + k], mj_recolor_block(recolored, MJ_BLOCK(imagecomp, n), dc), MJ_BLOCK(alphacomp, n)[0] * 4.0f * opacity, &q);
+                            break;
+                        }
+
+                        if(opacity < 1.0f) {
+                            mj_scale_block(scaledalpha, MJ_BLOCK(alphacomp, n), opacity);
+                            mj_blend_block(row_m[width_offset + k], mj_recolor_block(recolored, MJ_BLOCK(imagecomp, n), dc), scaledalpha, alphacomp->nonzero != NULL ? alphacomp->nonzero[n] : ~0ULL, &q);
+                            break;
+                        }
+
+                        mj_blend_block(row_m[width_offset + k], mj_recolor_block(recolored, MJ_BLOCK(imagecomp, n), dc), MJ_BLOCK(alphacomp, n), alphacomp->nonzero != NULL ? alphacomp->nonzero[n] : ~0ULL, &q);
+                        break;
                 }
             }
+
+            if(npair != 0) {
+                mj_blend_blocks_samples_fixed(pair_coefs, pair_fixedimage, pair_fixedalpha, npair, &fq);
+            }
         }
     }
 
     return MJ_OK;
 }
+
+MJ_COMPOSE_KERNELS(generic, 0, 0, 0)
+MJ_COMPOSE_KERNELS(gray, 1, 1, 1)
+MJ_COMPOSE_KERNELS(444, 3, 1, 1)
+MJ_COMPOSE_KERNELS(420, 3, 2, 2)
+
+int mj_compose_without_mask(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y, int mcu_x, int mcu_y, int mcu_w, int mcu_h) {
+    if(m == NULL || cd == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    switch(mj_compose_layout(m, cd)) {
+        case MJ_LAYOUT_GRAY:
+            return mj_compose_without_mask_gray(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h);
+        case MJ_LAYOUT_444:
+            return mj_compose_without_mask_444(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h);
+        case MJ_LAYOUT_420:
+            return mj_compose_without_mask_420(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h);
+        default:
+            break;
+    }
+
+    return mj_compose_without_mask_generic(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h);
+}
+
+static int mj_compose_with_mask_rows(int layout, mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y, int mcu_x, int mcu_y, int mcu_w, int mcu_h, int fixed_point, JBLOCKROW **rows, int readonly, const mj_composeoptions_t *o) {
+    switch(layout) {
+        case MJ_LAYOUT_GRAY:
+            return mj_compose_with_mask_gray(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h, fixed_point, rows, readonly, o);
+        case MJ_LAYOUT_444:
+            return mj_compose_with_mask_444(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h, fixed_point, rows, readonly, o);
+        case MJ_LAYOUT_420:
+            return mj_compose_with_mask_420(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h, fixed_point, rows, readonly, o);
+        default:
+            break;
+    }
+
+    return mj_compose_with_mask_generic(m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h, fixed_point, rows, readonly, o);
+}
+
+int mj_compose_with_mask(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y, int mcu_x, int mcu_y, int mcu_w, int mcu_h, int fixed_point, int readonly, const mj_composeoptions_t *o) {
+    if(m == NULL || cd == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    mj_composejob_t job;
+    int             layout, nthreads, rv;
+
+    layout = mj_compose_layout(m, cd);
+
+    // each thread gets at least MJ_BAND_MCUS MCUs of the dropon
+    nthreads = m->nthreads;
+    if(nthreads > MJ_MAX_THREADS) {
+        nthreads = MJ_MAX_THREADS;
+    }
+    if(nthreads > (mcu_w * mcu_h) / MJ_BAND_MCUS) {
+        nthreads = (mcu_w * mcu_h) / MJ_BAND_MCUS;
+    }
+    if(nthreads > mcu_h) {
+        nthreads = mcu_h;
+    }
+
+    if(nthreads > 1) {
+        memset(&job, 0, sizeof(mj_composejob_t));
+
+        job.m = m;
+        job.cd = cd;
+        job.layout = layout;
+        job.block_x = block_x;
+        job.block_y = block_y;
+        job.mcu_x = mcu_x;
+        job.mcu_y = mcu_y;
+        job.mcu_w = mcu_w;
+        job.mcu_h = mcu_h;
+        job.fixed_point = fixed_point;
+        job.readonly = readonly;
+        job.options = o;
+
+        // if the rows can't be realized the dropon is composed in one thread
+        if(mj_prepare_composejob(&job) != 0) {
+            rv = mj_run_composejob(&job, nthreads);
+
+            mj_free_composejob(&job);
+
+            return rv;
+        }
+
+        mj_free_composejob(&job);
+    }
+
+    return mj_compose_with_mask_rows(layout, m, cd, block_x, block_y, mcu_x, mcu_y, mcu_w, mcu_h, fixed_point, NULL, readonly, o);
+}
+
+int mj_prepare_composejob(mj_composejob_t *job) {
+    struct jpeg_decompress_struct *cinfo_m = &job->m->cinfo;
+    jpeg_component_info *          component_m;
+    mj_component_t *               imagecomp, *alphacomp;
+    mj_fixedquantization_t         fq;
+    JBLOCKARRAY                    first, last;
+    JDIMENSION                     nrows;
+    int                            c, k, l, height_offset, height_in_blocks, opaque;
+    size_t                         n;
+
+    for(c = 0; c < cinfo_m->num_components; c++) {
+        component_m = &cinfo_m->comp_info[c];
+        imagecomp = &job->cd->image[c];
+        alphacomp = &job->cd->alpha[c];
+
+        // the threads can only share the rows of the image if libjpeg keeps the whole coefficient array in
+        // memory. otherwise the rows are swapped in and out of a window and the window moves when the last
+        // row is accessed.
+        nrows = (component_m->height_in_blocks + component_m->v_samp_factor - 1) / component_m->v_samp_factor * component_m->v_samp_factor;
+
+        last = (*cinfo_m->mem->access_virt_barray)((j_common_ptr)cinfo_m, job->m->coef[c], nrows - 1, 1, TRUE);
+        first = (*cinfo_m->mem->access_virt_barray)((j_common_ptr)cinfo_m, job->m->coef[c], 0, 1, TRUE);
+
+        if(last - first != (ptrdiff_t)nrows - 1) {
+            return 0;
+        }
+
+        height_offset = job->block_y * component_m->v_samp_factor;
+        height_in_blocks = job->mcu_h * imagecomp->v_samp_factor;
+
+        job->rows[c] = (JBLOCKROW *)calloc(height_in_blocks, sizeof(JBLOCKROW));
+        if(job->rows[c] == NULL) {
+            return 0;
+        }
+
+        for(l = 0; l < height_in_blocks; l++) {
+            job->rows[c][l] = first[height_offset + l];
+        }
+
+        // a read-only compiled dropon is never changed by the compose kernels
+        if(alphacomp->classes == NULL || job->readonly != 0) {
+            continue;
+        }
+
+        // the blocks that the compose kernels create on demand are created before the threads are started
+        opaque = 0;
+
+        for(l = 0; l < height_in_blocks && opaque == 0; l++) {
+            n = (size_t)imagecomp->width_in_blocks * (job->mcu_y * imagecomp->v_samp_factor + l) + job->mcu_x * imagecomp->h_samp_factor;
+
+            for(k = 0; k < job->mcu_w * imagecomp->h_samp_factor; k++) {
+                if(alphacomp->classes[n + k] == MJ_BLOCK_OPAQUE) {
+                    opaque = 1;
+                    break;
+                }
+            }
+        }
+
+        if(opaque != 0 && mj_quantize_component(imagecomp, component_m->quant_table->quantval) == NULL) {
+            return 0;
+        }
+
+        if(job->fixed_point != 0 && mj_init_fixed_quantization(&fq, component_m->quant_table->quantval) != 0) {
+            if(mj_fix_component(imagecomp, alphacomp) == NULL || mj_fix_component(alphacomp, alphacomp) == NULL) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+int mj_run_composejob(mj_composejob_t *job, int nthreads) {
+    pthread_t threads[MJ_MAX_THREADS];
+    int       nstarted = 0, i;
+
+    // a few bands per thread even out the different costs of the blocks
+    job->nbands = nthreads * 4;
+    if(job->nbands > job->mcu_h) {
+        job->nbands = job->mcu_h;
+    }
+
+    job->bandheight = (job->mcu_h + job->nbands - 1) / job->nbands;
+    job->nbands = (job->mcu_h + job->bandheight - 1) / job->bandheight;
+
+    atomic_init(&job->next, 0);
+    atomic_init(&job->rv, MJ_OK);
+
+    for(i = 1; i < nthreads; i++) {
+        if(pthread_create(&threads[nstarted], NULL, mj_compose_thread, job) != 0) {
+            break;
+        }
+
+        nstarted++;
+    }
+
+    mj_compose_thread(job);
+
+    for(i = 0; i < nstarted; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    return atomic_load(&job->rv);
+}
+
+void *mj_compose_thread(void *arg) {
+    mj_composejob_t *job = (mj_composejob_t *)arg;
+    JBLOCKROW *      rows[MAX_COMPONENTS];
+    int              band, y, h, c, rv;
+
+    // each thread takes the next band that nobody is working on yet
+    while((band = atomic_fetch_add(&job->next, 1)) < job->nbands) {
+        y = band * job->bandheight;
+        h = job->mcu_h - y;
+        if(h > job->bandheight) {
+            h = job->bandheight;
+        }
+
+        for(c = 0; c < job->m->cinfo.num_components; c++) {
+            rows[c] = job->rows[c] + y * job->cd->image[c].v_samp_factor;
+        }
+
+        rv = mj_compose_with_mask_rows(job->layout, job->m, job->cd, job->block_x, job->block_y + y, job->mcu_x, job->mcu_y + y, job->mcu_w, h, job->fixed_point, rows, job->readonly, job->options);
+        if(rv != MJ_OK) {
+            atomic_store(&job->rv, rv);
+        }
+    }
+
+    return NULL;
+}
+
+void mj_free_composejob(mj_composejob_t *job) {
+    int c;
+
+    for(c = 0; c < MAX_COMPONENTS; c++) {
+        if(job->rows[c] != NULL) {
+            free(job->rows[c]);
+            job->rows[c] = NULL;
+        }
+    }
+
+    return;
+}
+
+void mj_replace_block(JCOEFPTR coefs_m, mj_block_t *imageblock, const mj_quantization_t *q) {
+    int i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        coefs_m[i] = mj_quantize_coefficient(imageblock[i], q->reciprocal[i]);
+    }
+
+    return;
+}
@@ -23,9 +23,81 @@
 #ifndef _LIBMODJPEG_COMPOSE_H_
 #define _LIBMODJPEG_COMPOSE_H_
 
+#include <stdatomic.h>
+
+#include "convolve.h"
 #include "libmodjpeg.h"
 
-int mj_compose_without_mask(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y);
-int mj_compose_with_mask(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y);
+// how mj_place_dropon() uses the cache of the dropon. with MJ_PLACE_NOCACHE the placed dropon always
+// owns its compiled dropon, with MJ_PLACE_LOOKUP a new compiled dropon is not put into the cache.
+#define MJ_PLACE_NOCACHE 0
+#define MJ_PLACE_LOOKUP  1
+#define MJ_PLACE_CACHE   2
+
+// the blocks x to x + w and y to y + h of a component of the image that are covered by a dropon, starting
+// with the block (start_x, start_y) of the compiled dropon
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+    int start_x;
+    int start_y;
+} mj_area_t;
+
+// the blocks of a component of the image that are covered by more than one dropon. they are kept
+// de-quantized until all dropons are blended and quantized only once.
+typedef struct {
+    int         nblocks;
+    int *       position;
+    mj_block_t *blocks;
+} mj_overlap_t;
+
+int  mj_place_dropon(mj_placeddropon_t *p, mj_jpeg_t *m, mj_dropon_t *d, unsigned int align, int offset_x, int offset_y, int cache);
+
+int  mj_find_overlaps(mj_overlap_t *o, mj_jpeg_t *m, mj_placeddropon_t *p, int nplaced, int c);
+void mj_blend_overlaps(mj_overlap_t *o, mj_jpeg_t *m, mj_placeddropon_t *p, int c, const mj_composeoptions_t *options);
+void mj_quantize_overlaps(mj_overlap_t *o, mj_jpeg_t *m, int c);
+void mj_free_overlaps(mj_overlap_t *o);
+
+// the minimum number of MCUs of a dropon for each thread if the bands of the dropon are composed in parallel
+#define MJ_BAND_MCUS 512
+
+// the bands of MCU rows of a dropon that are composed in parallel, see mj_set_jpeg_threads()
+typedef struct {
+    mj_jpeg_t *          m;
+    mj_compileddropon_t *cd;
+    int                  layout;
+
+    int block_x;
+    int block_y;
+    int mcu_x;
+    int mcu_y;
+    int mcu_w;
+    int mcu_h;
+
+    int                        fixed_point;
+    int                        readonly;
+    const mj_composeoptions_t *options;
+
+    // the rows of each component of the image that are covered by the dropon, realized before the threads start
+    JBLOCKROW *rows[MAX_COMPONENTS];
+
+    int        nbands;
+    int        bandheight;
+    atomic_int next;
+    atomic_int rv;
+} mj_composejob_t;
+
+int   mj_prepare_composejob(mj_composejob_t *job);
+int   mj_run_composejob(mj_composejob_t *job, int nthreads);
+void *mj_compose_thread(void *arg);
+void  mj_free_composejob(mj_composejob_t *job);
+
+int mj_compose_layout(mj_jpeg_t *m, mj_compileddropon_t *cd);
+int mj_compose_without_mask(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y, int mcu_x, int mcu_y, int mcu_w, int mcu_h);
+int mj_compose_with_mask(mj_jpeg_t *m, mj_compileddropon_t *cd, int block_x, int block_y, int mcu_x, int mcu_y, int mcu_w, int mcu_h, int fixed_point, int readonly, const mj_composeoptions_t *o);
+
+void mj_replace_block(JCOEFPTR coefs_m, mj_block_t *imageblock, const mj_quantization_t *q);
 
 #endif
\ No newline at end of file
@@ -33,8 +33,10 @@ static struct option longopts[] = {
     { "input",       required_argument, NULL, 'i' },
     { "output",      required_argument, NULL, 'o' },
     { "dropon",      required_argument, NULL, 'd' },
+    { "compile",     required_argument, NULL, 'c' },
     { "position",    required_argument, NULL, 'p' },
     { "offset",      required_argument, NULL, 'm' },
+    { "tile",        required_argument, NULL, 't' },
     { "luminance",   required_argument, NULL, 'y' },
     { "tintblue",    required_argument, NULL, 'b' },
     { "tintred",     required_argument, NULL, 'r' },
@@ -51,6 +53,7 @@ void help(void);
 
 int main(int argc, char *argv[]) {
     int c, t, position = MJ_ALIGN_TOP | MJ_ALIGN_LEFT, offset_x = 0, offset_y = 0, options = 0, rv = MJ_OK;
+    int tile = 0, stride_x = 0, stride_y = 0;
     char *str;
     mj_jpeg_t m;
     mj_dropon_t d;
@@ -60,7 +63,7 @@ int main(int argc, char *argv[]) {
 
     opterr = 1;
 
-    while((c = getopt_long(argc, argv, ":i: :o: :d: :p: :m: :y: :b: :r: xgPOAh", longopts, NULL)) != -1) {
+    while((c = getopt_long(argc, argv, ":i: :o: :d: :c: :p: :m: :t: :y: :b: :r: xgPOAh", longopts, NULL)) != -1) {
         switch(c) {
             case 'i':
                 if(mj_read_jpeg_from_file(&m, optarg, 0) != MJ_OK) {
@@ -91,11 +94,30 @@ int main(int argc, char *argv[]) {
                     exit(1);
                 }
 
-                if(mj_compose(&m, &d, position, offset_x, offset_y) != MJ_OK) {
+                if(tile != 0) {
+                    rv = mj_compose_tiled(&m, &d, offset_x, offset_y, stride_x, stride_y);
+                }
+                else {
+                    rv = mj_compose(&m, &d, position, offset_x, offset_y);
+                }
+
+                if(rv != MJ_OK) {
                     fprintf(stderr, "Failed to apply the dropon onto the image\n");
                     exit(1);
                 }
 
+                break;
+            case 'c':
+                if(mj_precompile_dropon(&d, &m) != MJ_OK) {
+                    fprintf(stderr, "Failed to compile the dropon for the image\n");
+                    exit(1);
+                }
+
+                if(mj_write_dropon_to_file(&d, optarg) != MJ_OK) {
+                    fprintf(stderr, "Can't write compiled dropon to '%s'\n", optarg);
+                    exit(1);
+                }
+
                 break;
             case 'p':
                 if(strlen(optarg) != 2) {
@@ -132,6 +154,14 @@ int main(int argc, char *argv[]) {
                     offset_y = (int)strtol(++str, NULL, 10);
                 }
                 break;
+            case 't':
+                tile = 1;
+                stride_x = (int)strtol(optarg, NULL, 10);
+                str = strchr(optarg, ',');
+                if(str != NULL) {
+                    stride_y = (int)strtol(++str, NULL, 10);
+                }
+                break;
             case 'y':
                 t = (int)strtol(optarg, NULL, 10);
                 mj_effect_luminance(&m, t);
@@ -197,6 +227,13 @@ void help(void) {
     fprintf(stderr, "\t--dropon, -d file[,mask]\n");
     fprintf(stderr, "\t\tPath to the image that should be used as dropon. The path to the mask is optional.\n");
     fprintf(stderr, "\t\tThe dropon and the mask have to be a JPEG and of the same dimension.\n");
+    fprintf(stderr, "\t\tThe dropon can also be a compiled dropon written by --compile.\n");
+    fprintf(stderr, "\n");
+
+    fprintf(stderr, "\t--compile, -c file\n");
+    fprintf(stderr, "\t\tPath to a file to store the compiled dropon in. The dropon will be compiled for all\n");
+    fprintf(stderr, "\t\tpositions on the image with the colorspace and sampling of the image. The file contains\n");
+    fprintf(stderr, "\t\tall previously compiled dropons and can be used with --dropon instead of the dropon.\n");
     fprintf(stderr, "\n");
 
     fprintf(stderr, "\t--position, -p [t|b][c][l|r]\n");
@@ -207,6 +244,12 @@ void help(void) {
     fprintf(stderr, "\t\tThe offset to the given position in pixels. Default: 0,0\n");
     fprintf(stderr, "\n");
 
+    fprintf(stderr, "\t--tile, -t [horizontal],[vertical]\n");
+    fprintf(stderr, "\t\tRepeat the following dropons across the whole image with this distance in pixels. The\n");
+    fprintf(stderr, "\t\tdistance is rounded up to the size of an MCU of the image, 0 is the size of the dropon.\n");
+    fprintf(stderr, "\t\tThe offset moves the tiles, the position is ignored. Default: no tiling\n");
+    fprintf(stderr, "\n");
+
     fprintf(stderr, "\t--luminance, -y value\n");
     fprintf(stderr, "\t\tChanges the brightness of the image according to the value. Use a negative value\n");
     fprintf(stderr, "\t\tto darken the image, and a positive value to brighten the image.\n");
@@ -257,6 +300,11 @@ void help(void) {
     fprintf(stderr, "\t\tmodjpeg --input in.jpg --position tr --dropon logo.jpg --pixelate --output out.jpg\n");
     fprintf(stderr, "\n");
 
+    fprintf(stderr, "\tCompile a logo for the layouts of two images, and place it with the compiled file:\n");
+    fprintf(stderr, "\t\tmodjpeg --input a.jpg --dropon logo.png --compile logo.mjd --input b.jpg --compile logo.mjd\n");
+    fprintf(stderr, "\t\tmodjpeg --input in.jpg --position tr --dropon logo.mjd --output out.jpg\n");
+    fprintf(stderr, "\n");
+
     fprintf(stderr, "\n");
     return;
 }
@@ -21,10 +21,815 @@
  */
 
 #include "convolve.h"
+#include "dct.h"
 
 #include "libmodjpeg.h"
 
 #include <math.h>
+#include <string.h>
+
+#ifdef MJ_CONVOLVE_X86
+#    include <immintrin.h>
+#endif
+
+// the convolution of two blocks in the DCT domain is y = sum over k, l of w[k][l] * M_k * x * M_l^T, where
+// M_k is the 1-D operator for the frequency k. M_k is sparse, each output coefficient j is the sum of at most
+// two input coefficients, i.e. z[j] = mj_operator_coef[0][k][j] * x[mj_operator_index[0][k][j]] +
+// mj_operator_coef[1][k][j] * x[mj_operator_index[1][k][j]]. these are the same operators as in mj_convolve().
+static const int mj_operator_index[2][DCTSIZE][DCTSIZE] = {
+    {
+        {0, 1, 2, 3, 4, 5, 6, 7},
+        {1, 0, 1, 2, 3, 4, 5, 6},
+        {2, 1, 0, 1, 2, 3, 4, 5},
+        {3, 2, 1, 0, 1, 2, 3, 4},
+        {4, 3, 2, 1, 0, 1, 2, 3},
+        {5, 4, 3, 2, 1, 0, 1, 2},
+        {6, 5, 4, 3, 2, 1, 0, 1},
+        {7, 6, 5, 4, 3, 2, 1, 0},
+    },
+    {
+        {0, 1, 2, 3, 4, 5, 6, 7},
+        {1, 2, 3, 4, 5, 6, 7, 6},
+        {2, 3, 4, 5, 6, 7, 4, 7},
+        {3, 4, 5, 6, 7, 2, 7, 6},
+        {4, 5, 6, 7, 0, 7, 6, 5},
+        {5, 6, 7, 2, 7, 6, 5, 4},
+        {6, 7, 4, 7, 6, 5, 4, 3},
+        {7, 6, 7, 6, 5, 4, 3, 2},
+    },
+};
+
+static const float mj_operator_coef[2][DCTSIZE][DCTSIZE] = {
+    {
+        {2.0, 2.0, 2.0, 2.0, 2.0, 2.0, 2.0, 2.0},
+        {M_SQRT2, M_SQRT2, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0},
+        {M_SQRT2, 1.0, M_SQRT2, 1.0, 1.0, 1.0, 1.0, 1.0},
+        {M_SQRT2, 1.0, 1.0, M_SQRT2, 1.0, 1.0, 1.0, 1.0},
+        {M_SQRT2, 1.0, 1.0, 1.0, M_SQRT2, 1.0, 1.0, 1.0},
+        {M_SQRT2, 1.0, 1.0, 1.0, 1.0, M_SQRT2, 1.0, 1.0},
+        {M_SQRT2, 1.0, 1.0, 1.0, 1.0, 1.0, M_SQRT2, 1.0},
+        {M_SQRT2, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, M_SQRT2},
+    },
+    {
+        {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+        {0.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.0},
+        {0.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.0, -1.0},
+        {0.0, 1.0, 1.0, 1.0, 1.0, 0.0, -1.0, -1.0},
+        {0.0, 1.0, 1.0, 1.0, 0.0, -1.0, -1.0, -1.0},
+        {0.0, 1.0, 1.0, 0.0, -1.0, -1.0, -1.0, -1.0},
+        {0.0, 1.0, 0.0, -1.0, -1.0, -1.0, -1.0, -1.0},
+        {0.0, 0.0, -1.0, -1.0, -1.0, -1.0, -1.0, -1.0},
+    },
+};
+
+// the kernel for the CPU, selected when the library is loaded
+static void (*mj_blend_block_kernel)(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q) = mj_blend_block_scalar;
+static void (*mj_blend_block_uniform_kernel)(JCOEFPTR coefs, mj_block_t *imageblock, float alpha, const mj_quantization_t *q) = mj_blend_block_uniform_scalar;
+static void (*mj_blend_block_samples_kernel)(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, const mj_quantization_t *q) = mj_blend_block_samples_scalar;
+
+#ifdef MJ_CONVOLVE_X86
+static void mj_init_convolve(void) __attribute__((constructor));
+
+static void mj_init_convolve(void) {
+    mj_select_convolve_kernels(1);
+
+    return;
+}
+#endif
+
+// select the fastest kernels the CPU supports, or the scalar kernels if simd is 0, e.g. for comparing them in a test
+void mj_select_convolve_kernels(int simd) {
+    mj_blend_block_kernel = mj_blend_block_scalar;
+    mj_blend_block_uniform_kernel = mj_blend_block_uniform_scalar;
+    mj_blend_block_samples_kernel = mj_blend_block_samples_scalar;
+
+#ifdef MJ_CONVOLVE_X86
+    if(simd == 0) {
+        return;
+    }
+
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2")) {
+        mj_blend_block_samples_kernel = mj_blend_block_samples_avx2;
+        mj_blend_block_uniform_kernel = mj_blend_block_uniform_avx2;
+    }
+
+    if(__builtin_cpu_supports("avx512f")) {
+        mj_blend_block_kernel = mj_blend_block_avx512;
+    }
+    else if(__builtin_cpu_supports("avx2")) {
+        mj_blend_block_kernel = mj_blend_block_avx2;
+    }
+    else if(__builtin_cpu_supports("sse4.1")) {
+        mj_blend_block_kernel = mj_blend_block_sse41;
+    }
+#endif
+
+    return;
+}
+
+void mj_init_quantization(mj_quantization_t *q, const UINT16 *quantval) {
+    int i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        q->quantval[i] = (float)quantval[i];
+        q->reciprocal[i] = 1.0f / (float)quantval[i];
+    }
+
+    return;
+}
+
+void mj_scale_block(mj_block_t *y, const mj_block_t *x, float scale) {
+    int i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        y[i] = x[i] * scale;
+    }
+
+    return;
+}
+
+void mj_shift_block(mj_block_t *y, const mj_block_t *x, float dc) {
+    memcpy(y, x, DCTSIZE2 * sizeof(mj_block_t));
+
+    y[0] += dc;
+
+    return;
+}
+
+void mj_blend_block(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q) {
+    mj_blend_block_kernel(coefs, imageblock, alphablock, nonzero, q);
+
+    return;
+}
+
+// the frequencies l that are used by any of the non-zero weights. the row operator is only applied for these.
+static inline void mj_convolve_used(unsigned long long nonzero, int *used) {
+    int l;
+
+    for(l = 0; l < DCTSIZE; l++) {
+        used[l] = (((nonzero >> l) & 0x0101010101010101ULL) != 0);
+    }
+
+    return;
+}
+
+// t = x * M_l^T, i.e. the operator is applied to the rows
+static inline void mj_convolve_rows(const mj_block_t *x, float *t, int l) {
+    int j, r;
+
+    for(j = 0; j < DCTSIZE; j++) {
+        const int   i0 = mj_operator_index[0][l][j], i1 = mj_operator_index[1][l][j];
+        const float c0 = mj_operator_coef[0][l][j], c1 = mj_operator_coef[1][l][j];
+
+        for(r = 0; r < DCTSIZE2; r += DCTSIZE) {
+            t[r + j] = c0 * x[r + i0] + c1 * x[r + i1];
+        }
+    }
+
+    return;
+}
+
+// y = w * x, i.e. the difference x of the blocks is convolved with the non-zero weights of the mask
+static inline void mj_convolve_block(const float *x, float *y, const mj_block_t *alphablock, unsigned long long nonzero) {
+    float        t[DCTSIZE][DCTSIZE2], u[DCTSIZE2];
+    int          used[DCTSIZE];
+    int          i, j, k, l, r;
+    unsigned int row;
+
+    mj_convolve_used(nonzero, used);
+
+    for(l = 0; l < DCTSIZE; l++) {
+        if(used[l] != 0) {
+            mj_convolve_rows(x, t[l], l);
+        }
+    }
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        y[i] = 0.0;
+    }
+
+    for(k = 0; k < DCTSIZE; k++) {
+        row = (unsigned int)(nonzero >> (k * DCTSIZE)) & 0xff;
+        if(row == 0) {
+            continue;
+        }
+
+        // u = sum over l of w[k][l] * t[l]
+        for(i = 0; i < DCTSIZE2; i++) {
+            u[i] = 0.0;
+        }
+
+        for(l = 0; l < DCTSIZE; l++) {
+            if((row & (1U << l)) == 0) {
+                continue;
+            }
+
+            const float wkl = alphablock[(k * DCTSIZE) + l];
+
+            for(i = 0; i < DCTSIZE2; i++) {
+                u[i] += wkl * t[l][i];
+            }
+        }
+
+        // y += M_k * u, i.e. the operator is applied to the columns
+        for(j = 0; j < DCTSIZE; j++) {
+            const float *u0 = &u[mj_operator_index[0][k][j] * DCTSIZE], *u1 = &u[mj_operator_index[1][k][j] * DCTSIZE];
+            const float  c0 = mj_operator_coef[0][k][j], c1 = mj_operator_coef[1][k][j];
+
+            for(r = 0; r < DCTSIZE; r++) {
+                y[(j * DCTSIZE) + r] += c0 * u0[r] + c1 * u1[r];
+            }
+        }
+    }
+
+    return;
+}
+
+// the block of the image is de-quantized (x1), blended with the block of the dropon (x0) in the DCT domain,
+// i.e. y = x1 + w * (x0 - x1), and quantized again with rounding. all kernels do the same operations in the
+// same order, i.e. they give exactly the same results as long as the compiler doesn't contract the
+// multiplications and additions.
+void mj_blend_block_scalar(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q) {
+    float x1[DCTSIZE2], x[DCTSIZE2], y[DCTSIZE2];
+    int   i;
+
+    // x = x0 - x1
+    for(i = 0; i < DCTSIZE2; i++) {
+        x1[i] = (float)coefs[i] * q->quantval[i];
+        x[i] = imageblock[i] - x1[i];
+    }
+
+    mj_convolve_block(x, y, alphablock, nonzero);
+
+    // y = x1 + y', quantized
+    for(i = 0; i < DCTSIZE2; i++) {
+        coefs[i] = mj_quantize_coefficient(x1[i] + y[i], q->reciprocal[i]);
+    }
+
+    return;
+}
+
+// the same as mj_blend_block() without the quantization, i.e. the de-quantized block x1 of the image is
+// blended in place. blocks where several dropons overlap are quantized only once after all are blended.
+void mj_blend_block_dequantized(mj_block_t *x1, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero) {
+    float x[DCTSIZE2], y[DCTSIZE2];
+    int   i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        x[i] = imageblock[i] - x1[i];
+    }
+
+    mj_convolve_block(x, y, alphablock, nonzero);
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        x1[i] += y[i];
+    }
+
+    return;
+}
+
+#ifdef MJ_CONVOLVE_X86
+
+// round half away from zero and saturate to the range of a JCOEF, like mj_quantize_coefficient()
+static inline __attribute__((target("sse4.1"))) __m128i mj_quantize_sse41(__m128 v) {
+    v = _mm_add_ps(v, _mm_or_ps(_mm_set1_ps(0.5f), _mm_and_ps(v, _mm_set1_ps(-0.0f))));
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(MJ_COEF_MIN)), _mm_set1_ps(MJ_COEF_MAX));
+
+    return _mm_cvttps_epi32(v);
+}
+
+static inline __attribute__((target("avx2"))) __m256i mj_quantize_avx2(__m256 v) {
+    v = _mm256_add_ps(v, _mm256_or_ps(_mm256_set1_ps(0.5f), _mm256_and_ps(v, _mm256_set1_ps(-0.0f))));
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(MJ_COEF_MIN)), _mm256_set1_ps(MJ_COEF_MAX));
+
+    return _mm256_cvttps_epi32(v);
+}
+
+__attribute__((target("sse4.1"))) void mj_blend_block_sse41(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q) {
+    float        x[DCTSIZE2], t[DCTSIZE][DCTSIZE2];
+    __m128       x1[DCTSIZE2 / 4], u[DCTSIZE2 / 4], yv[DCTSIZE2 / 4];
+    int          used[DCTSIZE];
+    int          i, j, k, l;
+    unsigned int row;
+
+    for(i = 0; i < DCTSIZE2 / 4; i++) {
+        x1[i] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)&coefs[i * 4]))), _mm_loadu_ps(&q->quantval[i * 4]));
+        _mm_storeu_ps(&x[i * 4], _mm_sub_ps(_mm_loadu_ps(&imageblock[i * 4]), x1[i]));
+    }
+
+    mj_convolve_used(nonzero, used);
+
+    // the rows are permuted, which is not worth it with 4 lanes
+    for(l = 0; l < DCTSIZE; l++) {
+        if(used[l] != 0) {
+            mj_convolve_rows(x, t[l], l);
+        }
+    }
+
+    for(i = 0; i < DCTSIZE2 / 4; i++) {
+        yv[i] = _mm_setzero_ps();
+    }
+
+    for(k = 0; k < DCTSIZE; k++) {
+        row = (unsigned int)(nonzero >> (k * DCTSIZE)) & 0xff;
+        if(row == 0) {
+            continue;
+        }
+
+        for(i = 0; i < DCTSIZE2 / 4; i++) {
+            u[i] = _mm_setzero_ps();
+        }
+
+        for(l = 0; l < DCTSIZE; l++) {
+            if((row & (1U << l)) == 0) {
+                continue;
+            }
+
+            const __m128 wv = _mm_set1_ps(alphablock[(k * DCTSIZE) + l]);
+
+            for(i = 0; i < DCTSIZE2 / 4; i++) {
+                u[i] = _mm_add_ps(u[i], _mm_mul_ps(wv, _mm_loadu_ps(&t[l][i * 4])));
+            }
+        }
+
+        // one row of a block are two registers
+        for(j = 0; j < DCTSIZE; j++) {
+            const int    i0 = mj_operator_index[0][k][j] * 2, i1 = mj_operator_index[1][k][j] * 2;
+            const __m128 c0 = _mm_set1_ps(mj_operator_coef[0][k][j]), c1 = _mm_set1_ps(mj_operator_coef[1][k][j]);
+
+            yv[j * 2 + 0] = _mm_add_ps(yv[j * 2 + 0], _mm_add_ps(_mm_mul_ps(c0, u[i0 + 0]), _mm_mul_ps(c1, u[i1 + 0])));
+            yv[j * 2 + 1] = _mm_add_ps(yv[j * 2 + 1], _mm_add_ps(_mm_mul_ps(c0, u[i0 + 1]), _mm_mul_ps(c1, u[i1 + 1])));
+        }
+    }
+
+    // round half away from zero, like mj_quantize_coefficient()
+    for(i = 0; i < DCTSIZE2 / 8; i++) {
+        __m128 v0 = _mm_mul_ps(_mm_add_ps(x1[i * 2 + 0], yv[i * 2 + 0]), _mm_loadu_ps(&q->reciprocal[i * 8 + 0]));
+        __m128 v1 = _mm_mul_ps(_mm_add_ps(x1[i * 2 + 1], yv[i * 2 + 1]), _mm_loadu_ps(&q->reciprocal[i * 8 + 4]));
+
+        _mm_storeu_si128((__m128i *)&coefs[i * 8], _mm_packs_epi32(mj_quantize_sse41(v0), mj_quantize_sse41(v1)));
+    }
+
+    return;
+}
+
+__attribute__((target("avx2"))) void mj_blend_block_avx2(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q) {
+    __m256       t[DCTSIZE][DCTSIZE], x1[DCTSIZE], u[DCTSIZE], yv[DCTSIZE], xv[DCTSIZE];
+    int          used[DCTSIZE];
+    int          j, k, l, r;
+    unsigned int row;
+
+    // one row of a block fits into a register
+    for(r = 0; r < DCTSIZE; r++) {
+        x1[r] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&coefs[r * DCTSIZE]))), _mm256_loadu_ps(&q->quantval[r * DCTSIZE]));
+        xv[r] = _mm256_sub_ps(_mm256_loadu_ps(&imageblock[r * DCTSIZE]), x1[r]);
+    }
+
+    mj_convolve_used(nonzero, used);
+
+    // the row operator is a permutation of the row
+    for(l = 0; l < DCTSIZE; l++) {
+        if(used[l] == 0) {
+            continue;
+        }
+
+        const __m256i i0 = _mm256_loadu_si256((const __m256i *)mj_operator_index[0][l]), i1 = _mm256_loadu_si256((const __m256i *)mj_operator_index[1][l]);
+        const __m256  c0 = _mm256_loadu_ps(mj_operator_coef[0][l]), c1 = _mm256_loadu_ps(mj_operator_coef[1][l]);
+
+        for(r = 0; r < DCTSIZE; r++) {
+            t[l][r] = _mm256_add_ps(_mm256_mul_ps(c0, _mm256_permutevar8x32_ps(xv[r], i0)), _mm256_mul_ps(c1, _mm256_permutevar8x32_ps(xv[r], i1)));
+        }
+    }
+
+    for(r = 0; r < DCTSIZE; r++) {
+        yv[r] = _mm256_setzero_ps();
+    }
+
+    for(k = 0; k < DCTSIZE; k++) {
+        row = (unsigned int)(nonzero >> (k * DCTSIZE)) & 0xff;
+        if(row == 0) {
+            continue;
+        }
+
+        for(r = 0; r < DCTSIZE; r++) {
+            u[r] = _mm256_setzero_ps();
+        }
+
+        for(l = 0; l < DCTSIZE; l++) {
+            if((row & (1U << l)) == 0) {
+                continue;
+            }
+
+            const __m256 wv = _mm256_set1_ps(alphablock[(k * DCTSIZE) + l]);
+
+            for(r = 0; r < DCTSIZE; r++) {
+                u[r] = _mm256_add_ps(u[r], _mm256_mul_ps(wv, t[l][r]));
+            }
+        }
+
+        for(j = 0; j < DCTSIZE; j++) {
+            const __m256 c0 = _mm256_set1_ps(mj_operator_coef[0][k][j]), c1 = _mm256_set1_ps(mj_operator_coef[1][k][j]);
+
+            yv[j] = _mm256_add_ps(yv[j], _mm256_add_ps(_mm256_mul_ps(c0, u[mj_operator_index[0][k][j]]), _mm256_mul_ps(c1, u[mj_operator_index[1][k][j]])));
+        }
+    }
+
+    // round half away from zero, like mj_quantize_coefficient()
+    for(r = 0; r < DCTSIZE; r++) {
+        __m256  v = _mm256_mul_ps(_mm256_add_ps(x1[r], yv[r]), _mm256_loadu_ps(&q->reciprocal[r * DCTSIZE]));
+        __m256i n = mj_quantize_avx2(v);
+
+        _mm_storeu_si128((__m128i *)&coefs[r * DCTSIZE], _mm_packs_epi32(_mm256_castsi256_si128(n), _mm256_extracti128_si256(n, 1)));
+    }
+
+    return;
+}
+
+__attribute__((target("avx512f"))) void mj_blend_block_avx512(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q) {
+    __m512       t[DCTSIZE][DCTSIZE / 2], x1[DCTSIZE / 2], u[DCTSIZE / 2], xv[DCTSIZE / 2];
+    __m256       yv[DCTSIZE];
+    float        us[DCTSIZE2], x1s[DCTSIZE2];
+    int          used[DCTSIZE];
+    int          j, k, l, r;
+    unsigned int row;
+
+    // two rows of a block fit into a register
+    for(r = 0; r < DCTSIZE / 2; r++) {
+        x1[r] = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)&coefs[r * 2 * DCTSIZE]))), _mm512_loadu_ps(&q->quantval[r * 2 * DCTSIZE]));
+        xv[r] = _mm512_sub_ps(_mm512_loadu_ps(&imageblock[r * 2 * DCTSIZE]), x1[r]);
+
+        _mm512_storeu_ps(&x1s[r * 2 * DCTSIZE], x1[r]);
+    }
+
+    mj_convolve_used(nonzero, used);
+
+    // the row operator is a permutation of each half of the register
+    for(l = 0; l < DCTSIZE; l++) {
+        if(used[l] == 0) {
+            continue;
+        }
+
+        const __m256i i0 = _mm256_loadu_si256((const __m256i *)mj_operator_index[0][l]), i1 = _mm256_loadu_si256((const __m256i *)mj_operator_index[1][l]);
+        const __m256i eight = _mm256_set1_epi32(DCTSIZE);
+        const __m512i p0 = _mm512_inserti64x4(_mm512_castsi256_si512(i0), _mm256_add_epi32(i0, eight), 1);
+        const __m512i p1 = _mm512_inserti64x4(_mm512_castsi256_si512(i1), _mm256_add_epi32(i1, eight), 1);
+        const __m256d c0 = _mm256_castps_pd(_mm256_loadu_ps(mj_operator_coef[0][l])), c1 = _mm256_castps_pd(_mm256_loadu_ps(mj_operator_coef[1][l]));
+        const __m512  d0 = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(c0), c0, 1));
+        const __m512  d1 = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(c1), c1, 1));
+
+        for(r = 0; r < DCTSIZE / 2; r++) {
+            t[l][r] = _mm512_add_ps(_mm512_mul_ps(d0, _mm512_permutexvar_ps(p0, xv[r])), _mm512_mul_ps(d1, _mm512_permutexvar_ps(p1, xv[r])));
+        }
+    }
+
+    for(r = 0; r < DCTSIZE; r++) {
+        yv[r] = _mm256_setzero_ps();
+    }
+
+    for(k = 0; k < DCTSIZE; k++) {
+        row = (unsigned int)(nonzero >> (k * DCTSIZE)) & 0xff;
+        if(row == 0) {
+            continue;
+        }
+
+        for(r = 0; r < DCTSIZE / 2; r++) {
+            u[r] = _mm512_setzero_ps();
+        }
+
+        for(l = 0; l < DCTSIZE; l++) {
+            if((row & (1U << l)) == 0) {
+                continue;
+            }
+
+            const __m512 wv = _mm512_set1_ps(alphablock[(k * DCTSIZE) + l]);
+
+            for(r = 0; r < DCTSIZE / 2; r++) {
+                u[r] = _mm512_add_ps(u[r], _mm512_mul_ps(wv, t[l][r]));
+            }
+        }
+
+        // the column operator combines single rows, which is done with half of the register
+        for(r = 0; r < DCTSIZE / 2; r++) {
+            _mm512_storeu_ps(&us[r * 2 * DCTSIZE], u[r]);
+        }
+
+        for(j = 0; j < DCTSIZE; j++) {
+            const __m256 c0 = _mm256_set1_ps(mj_operator_coef[0][k][j]), c1 = _mm256_set1_ps(mj_operator_coef[1][k][j]);
+            const __m256 u0 = _mm256_loadu_ps(&us[mj_operator_index[0][k][j] * DCTSIZE]), u1 = _mm256_loadu_ps(&us[mj_operator_index[1][k][j] * DCTSIZE]);
+
+            yv[j] = _mm256_add_ps(yv[j], _mm256_add_ps(_mm256_mul_ps(c0, u0), _mm256_mul_ps(c1, u1)));
+        }
+    }
+
+    // round half away from zero, like mj_quantize_coefficient()
+    for(r = 0; r < DCTSIZE; r++) {
+        __m256  v = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(&x1s[r * DCTSIZE]), yv[r]), _mm256_loadu_ps(&q->reciprocal[r * DCTSIZE]));
+        __m256i n = mj_quantize_avx2(v);
+
+        _mm_storeu_si128((__m128i *)&coefs[r * DCTSIZE], _mm_packs_epi32(_mm256_castsi256_si128(n), _mm256_extracti128_si256(n, 1)));
+    }
+
+    return;
+}
+
+#endif
+
+void mj_blend_block_uniform(JCOEFPTR coefs, mj_block_t *imageblock, float alpha, const mj_quantization_t *q) {
+    mj_blend_block_uniform_kernel(coefs, imageblock, alpha, q);
+
+    return;
+}
+
+// with only a DC coefficient the mask is the same for all samples of the block and the convolution is
+// the same as y = x1 + alpha * (x0 - x1) on each coefficient
+void mj_blend_block_uniform_scalar(JCOEFPTR coefs, mj_block_t *imageblock, float alpha, const mj_quantization_t *q) {
+    float x1;
+    int   i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        x1 = (float)coefs[i] * q->quantval[i];
+        coefs[i] = mj_quantize_coefficient(x1 + alpha * (imageblock[i] - x1), q->reciprocal[i]);
+    }
+
+    return;
+}
+
+void mj_blend_block_uniform_dequantized(mj_block_t *x1, mj_block_t *imageblock, float alpha) {
+    int i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        x1[i] += alpha * (imageblock[i] - x1[i]);
+    }
+
+    return;
+}
+
+#ifdef MJ_CONVOLVE_X86
+
+__attribute__((target("avx2"))) void mj_blend_block_uniform_avx2(JCOEFPTR coefs, mj_block_t *imageblock, float alpha, const mj_quantization_t *q) {
+    __m256  x1, v;
+    __m256i n;
+    int     r;
+
+    const __m256 a = _mm256_set1_ps(alpha);
+
+    for(r = 0; r < DCTSIZE2; r += DCTSIZE) {
+        x1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&coefs[r]))), _mm256_loadu_ps(&q->quantval[r]));
+        v = _mm256_add_ps(x1, _mm256_mul_ps(a, _mm256_sub_ps(_mm256_loadu_ps(&imageblock[r]), x1)));
+
+        // round half away from zero, like mj_quantize_coefficient()
+        v = _mm256_mul_ps(v, _mm256_loadu_ps(&q->reciprocal[r]));
+        n = mj_quantize_avx2(v);
+
+        _mm_storeu_si128((__m128i *)&coefs[r], _mm_packs_epi32(_mm256_castsi256_si128(n), _mm256_extracti128_si256(n, 1)));
+    }
+
+    return;
+}
+
+#endif
+
+void mj_blend_block_samples(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, const mj_quantization_t *q) {
+    mj_blend_block_samples_kernel(coefs, imageblock, alphablock, q);
+
+    return;
+}
+
+// the block of the image is blended with the block of the dropon in the pixel domain, i.e. the difference is
+// transformed back, multiplied with the samples of the mask, and transformed again. this costs the same for
+// every block, while the costs in the DCT domain grow with the number of non-zero coefficients of the mask.
+void mj_blend_block_samples_scalar(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, const mj_quantization_t *q) {
+    float x1[DCTSIZE2], x[DCTSIZE2], samples[DCTSIZE2], y[DCTSIZE2];
+    int   i;
+
+    // x = x0 - x1
+    for(i = 0; i < DCTSIZE2; i++) {
+        x1[i] = (float)coefs[i] * q->quantval[i];
+        x[i] = imageblock[i] - x1[i];
+    }
+
+    // y' = w * x
+    mj_idct(x, samples);
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        samples[i] *= alphablock[i];
+    }
+
+    mj_fdct(samples, y);
+
+    // y = x1 + y', quantized
+    for(i = 0; i < DCTSIZE2; i++) {
+        coefs[i] = mj_quantize_coefficient(x1[i] + y[i], q->reciprocal[i]);
+    }
+
+    return;
+}
+
+void mj_blend_block_samples_dequantized(mj_block_t *x1, mj_block_t *imageblock, mj_block_t *alphablock) {
+    float x[DCTSIZE2], samples[DCTSIZE2], y[DCTSIZE2];
+    int   i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        x[i] = imageblock[i] - x1[i];
+    }
+
+    mj_idct(x, samples);
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        samples[i] *= alphablock[i];
+    }
+
+    mj_fdct(samples, y);
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        x1[i] += y[i];
+    }
+
+    return;
+}
+
+#ifdef MJ_CONVOLVE_X86
+
+// transpose the 8x8 block that is given as 8 rows
+static inline __attribute__((target("avx2"))) void mj_transpose_avx2(__m256 *d) {
+    __m256 t0, t1, t2, t3, t4, t5, t6, t7;
+    __m256 s0, s1, s2, s3, s4, s5, s6, s7;
+
+    t0 = _mm256_unpacklo_ps(d[0], d[1]);
+    t1 = _mm256_unpackhi_ps(d[0], d[1]);
+    t2 = _mm256_unpacklo_ps(d[2], d[3]);
+    t3 = _mm256_unpackhi_ps(d[2], d[3]);
+    t4 = _mm256_unpacklo_ps(d[4], d[5]);
+    t5 = _mm256_unpackhi_ps(d[4], d[5]);
+    t6 = _mm256_unpacklo_ps(d[6], d[7]);
+    t7 = _mm256_unpackhi_ps(d[6], d[7]);
+
+    s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    d[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    d[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    d[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    d[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    d[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    d[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    d[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    d[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+
+    return;
+}
+
+// mj_fdct_1d() on all columns of the block at once
+static inline __attribute__((target("avx2"))) void mj_fdct_1d_avx2(__m256 *d) {
+    __m256 tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    __m256 tmp10, tmp11, tmp12, tmp13;
+    __m256 z1, z2, z3, z4, z5, z11, z13;
+
+    tmp0 = _mm256_add_ps(d[0], d[7]);
+    tmp7 = _mm256_sub_ps(d[0], d[7]);
+    tmp1 = _mm256_add_ps(d[1], d[6]);
+    tmp6 = _mm256_sub_ps(d[1], d[6]);
+    tmp2 = _mm256_add_ps(d[2], d[5]);
+    tmp5 = _mm256_sub_ps(d[2], d[5]);
+    tmp3 = _mm256_add_ps(d[3], d[4]);
+    tmp4 = _mm256_sub_ps(d[3], d[4]);
+
+    // even part
+    tmp10 = _mm256_add_ps(tmp0, tmp3);
+    tmp13 = _mm256_sub_ps(tmp0, tmp3);
+    tmp11 = _mm256_add_ps(tmp1, tmp2);
+    tmp12 = _mm256_sub_ps(tmp1, tmp2);
+
+    d[0] = _mm256_add_ps(tmp10, tmp11);
+    d[4] = _mm256_sub_ps(tmp10, tmp11);
+
+    z1 = _mm256_mul_ps(_mm256_add_ps(tmp12, tmp13), _mm256_set1_ps(0.707106781f));
+    d[2] = _mm256_add_ps(tmp13, z1);
+    d[6] = _mm256_sub_ps(tmp13, z1);
+
+    // odd part
+    tmp10 = _mm256_add_ps(tmp4, tmp5);
+    tmp11 = _mm256_add_ps(tmp5, tmp6);
+    tmp12 = _mm256_add_ps(tmp6, tmp7);
+
+    z5 = _mm256_mul_ps(_mm256_sub_ps(tmp10, tmp12), _mm256_set1_ps(0.382683433f));
+    z2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.541196100f), tmp10), z5);
+    z4 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(1.306562965f), tmp12), z5);
+    z3 = _mm256_mul_ps(tmp11, _mm256_set1_ps(0.707106781f));
+
+    z11 = _mm256_add_ps(tmp7, z3);
+    z13 = _mm256_sub_ps(tmp7, z3);
+
+    d[5] = _mm256_add_ps(z13, z2);
+    d[3] = _mm256_sub_ps(z13, z2);
+    d[1] = _mm256_add_ps(z11, z4);
+    d[7] = _mm256_sub_ps(z11, z4);
+
+    return;
+}
+
+// mj_idct_1d() on all columns of the block at once
+static inline __attribute__((target("avx2"))) void mj_idct_1d_avx2(__m256 *d) {
+    __m256 tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    __m256 tmp10, tmp11, tmp12, tmp13;
+    __m256 z5, z10, z11, z12, z13;
+
+    // even part
+    tmp10 = _mm256_add_ps(d[0], d[4]);
+    tmp11 = _mm256_sub_ps(d[0], d[4]);
+
+    tmp13 = _mm256_add_ps(d[2], d[6]);
+    tmp12 = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(d[2], d[6]), _mm256_set1_ps(1.414213562f)), tmp13);
+
+    tmp0 = _mm256_add_ps(tmp10, tmp13);
+    tmp3 = _mm256_sub_ps(tmp10, tmp13);
+    tmp1 = _mm256_add_ps(tmp11, tmp12);
+    tmp2 = _mm256_sub_ps(tmp11, tmp12);
+
+    // odd part
+    z13 = _mm256_add_ps(d[5], d[3]);
+    z10 = _mm256_sub_ps(d[5], d[3]);
+    z11 = _mm256_add_ps(d[1], d[7]);
+    z12 = _mm256_sub_ps(d[1], d[7]);
+
+    tmp7 = _mm256_add_ps(z11, z13);
+    tmp11 = _mm256_mul_ps(_mm256_sub_ps(z11, z13), _mm256_set1_ps(1.414213562f));
+
+    z5 = _mm256_mul_ps(_mm256_add_ps(z10, z12), _mm256_set1_ps(1.847759065f));
+    tmp10 = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(1.082392200f), z12), z5);
+    tmp12 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(-2.613125930f), z10), z5);
+
+    tmp6 = _mm256_sub_ps(tmp12, tmp7);
+    tmp5 = _mm256_sub_ps(tmp11, tmp6);
+    tmp4 = _mm256_add_ps(tmp10, tmp5);
+
+    d[0] = _mm256_add_ps(tmp0, tmp7);
+    d[7] = _mm256_sub_ps(tmp0, tmp7);
+    d[1] = _mm256_add_ps(tmp1, tmp6);
+    d[6] = _mm256_sub_ps(tmp1, tmp6);
+    d[2] = _mm256_add_ps(tmp2, tmp5);
+    d[5] = _mm256_sub_ps(tmp2, tmp5);
+    d[4] = _mm256_add_ps(tmp3, tmp4);
+    d[3] = _mm256_sub_ps(tmp3, tmp4);
+
+    return;
+}
+
+// the same operations as mj_blend_block_samples_scalar() with one row of the block in a register. the rows
+// are transformed with the block transposed.
+static inline __attribute__((target("avx2"))) void mj_blend_samples_avx2(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, const mj_quantization_t *q) {
+    __m256  x1[DCTSIZE], d[DCTSIZE], w[DCTSIZE];
+    __m256i n;
+    int     r;
+
+    for(r = 0; r < DCTSIZE; r++) {
+        x1[r] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&coefs[r * DCTSIZE]))), _mm256_loadu_ps(&q->quantval[r * DCTSIZE]));
+        d[r] = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&imageblock[r * DCTSIZE]), x1[r]), _mm256_loadu_ps(&mj_idct_prescale[r * DCTSIZE]));
+        w[r] = _mm256_loadu_ps(&alphablock[r * DCTSIZE]);
+    }
+
+    mj_idct_1d_avx2(d);
+    mj_transpose_avx2(d);
+    mj_idct_1d_avx2(d);
+
+    mj_transpose_avx2(w);
+
+    for(r = 0; r < DCTSIZE; r++) {
+        d[r] = _mm256_mul_ps(d[r], w[r]);
+    }
+
+    mj_fdct_1d_avx2(d);
+    mj_transpose_avx2(d);
+    mj_fdct_1d_avx2(d);
+
+    // round half away from zero, like mj_quantize_coefficient()
+    for(r = 0; r < DCTSIZE; r++) {
+        __m256 v = _mm256_mul_ps(d[r], _mm256_loadu_ps(&mj_fdct_descale[r * DCTSIZE]));
+
+        v = _mm256_mul_ps(_mm256_add_ps(x1[r], v), _mm256_loadu_ps(&q->reciprocal[r * DCTSIZE]));
+        n = mj_quantize_avx2(v);
+
+        _mm_storeu_si128((__m128i *)&coefs[r * DCTSIZE], _mm_packs_epi32(_mm256_castsi256_si128(n), _mm256_extracti128_si256(n, 1)));
+    }
+
+    return;
+}
+
+__attribute__((target("avx2"))) void mj_blend_block_samples_avx2(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, const mj_quantization_t *q) {
+    mj_blend_samples_avx2(coefs, imageblock, alphablock, q);
+
+    return;
+}
+
+#endif
 
 void mj_convolve(mj_block_t *x, mj_block_t *y, float w, int k, int l) {
     float z[64] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
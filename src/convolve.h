@@ -25,6 +25,70 @@
 
 #include "libmodjpeg.h"
 
+// the SIMD kernels are only available on x86 with GCC or clang
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define MJ_CONVOLVE_X86
+#endif
+
+// a quantization table prepared for the blending
+typedef struct {
+    float quantval[DCTSIZE2];
+    float reciprocal[DCTSIZE2];
+} mj_quantization_t;
+
+// the range of a quantized coefficient
+#define MJ_COEF_MIN (-32768.0f)
+#define MJ_COEF_MAX 32767.0f
+
+// quantize a coefficient with the reciprocal of the quantization value, rounding half away from zero. the result
+// saturates like the SIMD kernels, which pack the coefficients with signed saturation.
+static inline JCOEF mj_quantize_coefficient(float v, float reciprocal) {
+    v *= reciprocal;
+    v += (v < 0.0f ? -0.5f : 0.5f);
+
+    if(v > MJ_COEF_MAX) {
+        v = MJ_COEF_MAX;
+    }
+    else if(v < MJ_COEF_MIN) {
+        v = MJ_COEF_MIN;
+    }
+
+    return (JCOEF)(int)v;
+}
+
+// the convolution with a single weight, y += w * x. only the reference for the sparse operators in the tests.
 void mj_convolve(mj_block_t *x, mj_block_t *y, float w, int k, int l);
 
+void mj_select_convolve_kernels(int simd);
+
+void mj_init_quantization(mj_quantization_t *q, const UINT16 *quantval);
+void mj_scale_block(mj_block_t *y, const mj_block_t *x, float scale);
+void mj_shift_block(mj_block_t *y, const mj_block_t *x, float dc);
+
+void mj_blend_block(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q);
+void mj_blend_block_scalar(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q);
+#ifdef MJ_CONVOLVE_X86
+void mj_blend_block_sse41(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q);
+void mj_blend_block_avx2(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q);
+void mj_blend_block_avx512(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero, const mj_quantization_t *q);
+#endif
+
+void mj_blend_block_dequantized(mj_block_t *x1, mj_block_t *imageblock, mj_block_t *alphablock, unsigned long long nonzero);
+
+void mj_blend_block_uniform(JCOEFPTR coefs, mj_block_t *imageblock, float alpha, const mj_quantization_t *q);
+void mj_blend_block_uniform_scalar(JCOEFPTR coefs, mj_block_t *imageblock, float alpha, const mj_quantization_t *q);
+#ifdef MJ_CONVOLVE_X86
+void mj_blend_block_uniform_avx2(JCOEFPTR coefs, mj_block_t *imageblock, float alpha, const mj_quantization_t *q);
+#endif
+
+void mj_blend_block_uniform_dequantized(mj_block_t *x1, mj_block_t *imageblock, float alpha);
+
+void mj_blend_block_samples(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, const mj_quantization_t *q);
+void mj_blend_block_samples_scalar(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, const mj_quantization_t *q);
+#ifdef MJ_CONVOLVE_X86
+void mj_blend_block_samples_avx2(JCOEFPTR coefs, mj_block_t *imageblock, mj_block_t *alphablock, const mj_quantization_t *q);
+#endif
+
+void mj_blend_block_samples_dequantized(mj_block_t *x1, mj_block_t *imageblock, mj_block_t *alphablock);
+
 #endif
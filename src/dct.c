@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "dct.h"
+
+#include "libmodjpeg.h"
+
+// the AAN DCT leaves the coefficient (v, u) scaled by s(v) * s(u) * 8, with s(0) = 1 and
+// s(k) = cos(k * pi / 16) * sqrt(2). multiplying by the inverse gives the same scaling of
+// the coefficients as the libjpeg (with all quantization values set to 1).
+const float mj_fdct_descale[DCTSIZE2] = {
+    0.125000000f, 0.090119978f, 0.095670858f, 0.106303762f, 0.125000000f, 0.159094823f, 0.230969883f, 0.453063723f,
+    0.090119978f, 0.064972883f, 0.068974845f, 0.076640741f, 0.090119978f, 0.114700975f, 0.166520006f, 0.326640741f,
+    0.095670858f, 0.068974845f, 0.073223305f, 0.081361377f, 0.095670858f, 0.121765906f, 0.176776695f, 0.346759961f,
+    0.106303762f, 0.076640741f, 0.081361377f, 0.090403918f, 0.106303762f, 0.135299025f, 0.196423740f, 0.385299025f,
+    0.125000000f, 0.090119978f, 0.095670858f, 0.106303762f, 0.125000000f, 0.159094823f, 0.230969883f, 0.453063723f,
+    0.159094823f, 0.114700975f, 0.121765906f, 0.135299025f, 0.159094823f, 0.202489301f, 0.293968901f, 0.576640741f,
+    0.230969883f, 0.166520006f, 0.176776695f, 0.196423740f, 0.230969883f, 0.293968901f, 0.426776695f, 0.837152602f,
+    0.453063723f, 0.326640741f, 0.346759961f, 0.385299025f, 0.453063723f, 0.576640741f, 0.837152602f, 1.642133898f,
+};
+
+// 1D forward DCT after Arai, Agui, and Nakajima on 8 values that are step elements apart
+void mj_fdct_1d(float *d, int step) {
+    float tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    float tmp10, tmp11, tmp12, tmp13;
+    float z1, z2, z3, z4, z5, z11, z13;
+
+    tmp0 = d[0 * step] + d[7 * step];
+    tmp7 = d[0 * step] - d[7 * step];
+    tmp1 = d[1 * step] + d[6 * step];
+    tmp6 = d[1 * step] - d[6 * step];
+    tmp2 = d[2 * step] + d[5 * step];
+    tmp5 = d[2 * step] - d[5 * step];
+    tmp3 = d[3 * step] + d[4 * step];
+    tmp4 = d[3 * step] - d[4 * step];
+
+    // even part
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    d[0 * step] = tmp10 + tmp11;
+    d[4 * step] = tmp10 - tmp11;
+
+    z1 = (tmp12 + tmp13) * 0.707106781f;
+    d[2 * step] = tmp13 + z1;
+    d[6 * step] = tmp13 - z1;
+
+    // odd part
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+
+    z5 = (tmp10 - tmp12) * 0.382683433f;
+    z2 = 0.541196100f * tmp10 + z5;
+    z4 = 1.306562965f * tmp12 + z5;
+    z3 = tmp11 * 0.707106781f;
+
+    z11 = tmp7 + z3;
+    z13 = tmp7 - z3;
+
+    d[5 * step] = z13 + z2;
+    d[3 * step] = z13 - z2;
+    d[1 * step] = z11 + z4;
+    d[7 * step] = z11 - z4;
+
+    return;
+}
+
+void mj_fdct(const float *samples, mj_block_t *coefs) {
+    int i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        coefs[i] = samples[i];
+    }
+
+    // rows
+    for(i = 0; i < DCTSIZE2; i += DCTSIZE) {
+        mj_fdct_1d(&coefs[i], 1);
+    }
+
+    // columns
+    for(i = 0; i < DCTSIZE; i++) {
+        mj_fdct_1d(&coefs[i], DCTSIZE);
+    }
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        coefs[i] *= mj_fdct_descale[i];
+    }
+
+    return;
+}
+
+// the inverse of mj_fdct_descale with the factor 1/8 of the AAN IDCT, i.e. s(v) * s(u) / 8
+const float mj_idct_prescale[DCTSIZE2] = {
+    0.125000000f, 0.173379981f, 0.163320371f, 0.146984450f, 0.125000000f, 0.098211870f, 0.067649513f, 0.034487422f,
+    0.173379981f, 0.240484942f, 0.226531862f, 0.203873289f, 0.173379981f, 0.136223777f, 0.093832569f, 0.047835429f,
+    0.163320371f, 0.226531862f, 0.213388348f, 0.192044439f, 0.163320371f, 0.128319992f, 0.088388348f, 0.045059989f,
+    0.146984450f, 0.203873289f, 0.192044439f, 0.172835429f, 0.146984450f, 0.115484942f, 0.079547411f, 0.040552919f,
+    0.125000000f, 0.173379981f, 0.163320371f, 0.146984450f, 0.125000000f, 0.098211870f, 0.067649513f, 0.034487422f,
+    0.098211870f, 0.136223777f, 0.128319992f, 0.115484942f, 0.098211870f, 0.077164571f, 0.053151881f, 0.027096594f,
+    0.067649513f, 0.093832569f, 0.088388348f, 0.079547411f, 0.067649513f, 0.053151881f, 0.036611652f, 0.018664459f,
+    0.034487422f, 0.047835429f, 0.045059989f, 0.040552919f, 0.034487422f, 0.027096594f, 0.018664459f, 0.009515058f,
+};
+
+// 1D inverse DCT after Arai, Agui, and Nakajima on 8 values that are step elements apart
+void mj_idct_1d(float *d, int step) {
+    float tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    float tmp10, tmp11, tmp12, tmp13;
+    float z5, z10, z11, z12, z13;
+
+    // even part
+    tmp0 = d[0 * step];
+    tmp1 = d[2 * step];
+    tmp2 = d[4 * step];
+    tmp3 = d[6 * step];
+
+    tmp10 = tmp0 + tmp2;
+    tmp11 = tmp0 - tmp2;
+
+    tmp13 = tmp1 + tmp3;
+    tmp12 = (tmp1 - tmp3) * 1.414213562f - tmp13;
+
+    tmp0 = tmp10 + tmp13;
+    tmp3 = tmp10 - tmp13;
+    tmp1 = tmp11 + tmp12;
+    tmp2 = tmp11 - tmp12;
+
+    // odd part
+    tmp4 = d[1 * step];
+    tmp5 = d[3 * step];
+    tmp6 = d[5 * step];
+    tmp7 = d[7 * step];
+
+    z13 = tmp6 + tmp5;
+    z10 = tmp6 - tmp5;
+    z11 = tmp4 + tmp7;
+    z12 = tmp4 - tmp7;
+
+    tmp7 = z11 + z13;
+    tmp11 = (z11 - z13) * 1.414213562f;
+
+    z5 = (z10 + z12) * 1.847759065f;
+    tmp10 = 1.082392200f * z12 - z5;
+    tmp12 = -2.613125930f * z10 + z5;
+
+    tmp6 = tmp12 - tmp7;
+    tmp5 = tmp11 - tmp6;
+    tmp4 = tmp10 + tmp5;
+
+    d[0 * step] = tmp0 + tmp7;
+    d[7 * step] = tmp0 - tmp7;
+    d[1 * step] = tmp1 + tmp6;
+    d[6 * step] = tmp1 - tmp6;
+    d[2 * step] = tmp2 + tmp5;
+    d[5 * step] = tmp2 - tmp5;
+    d[4 * step] = tmp3 + tmp4;
+    d[3 * step] = tmp3 - tmp4;
+
+    return;
+}
+
+void mj_idct(const mj_block_t *coefs, float *samples) {
+    int i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        samples[i] = coefs[i] * mj_idct_prescale[i];
+    }
+
+    // columns
+    for(i = 0; i < DCTSIZE; i++) {
+        mj_idct_1d(&samples[i], DCTSIZE);
+    }
+
+    // rows
+    for(i = 0; i < DCTSIZE2; i += DCTSIZE) {
+        mj_idct_1d(&samples[i], 1);
+    }
+
+    return;
+}
+
+// mj_fdct_1d() in fixed point. the values must fit into 16 bits.
+void mj_fdct_fixed_1d(int *d, int step) {
+    int tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    int tmp10, tmp11, tmp12, tmp13;
+    int z1, z2, z3, z4, z5, z11, z13;
+
+    tmp0 = d[0 * step] + d[7 * step];
+    tmp7 = d[0 * step] - d[7 * step];
+    tmp1 = d[1 * step] + d[6 * step];
+    tmp6 = d[1 * step] - d[6 * step];
+    tmp2 = d[2 * step] + d[5 * step];
+    tmp5 = d[2 * step] - d[5 * step];
+    tmp3 = d[3 * step] + d[4 * step];
+    tmp4 = d[3 * step] - d[4 * step];
+
+    // even part
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    d[0 * step] = tmp10 + tmp11;
+    d[4 * step] = tmp10 - tmp11;
+
+    z1 = mj_fixed_mul(tmp12 + tmp13, MJ_FIX_0_707106781);
+    d[2 * step] = tmp13 + z1;
+    d[6 * step] = tmp13 - z1;
+
+    // odd part
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+
+    z5 = mj_fixed_mul(tmp10 - tmp12, MJ_FIX_0_382683433);
+    z2 = mj_fixed_mul(tmp10, MJ_FIX_0_541196100) + z5;
+    z4 = tmp12 + mj_fixed_mul(tmp12, MJ_FIX_0_306562965) + z5;
+    z3 = mj_fixed_mul(tmp11, MJ_FIX_0_707106781);
+
+    z11 = tmp7 + z3;
+    z13 = tmp7 - z3;
+
+    d[5 * step] = z13 + z2;
+    d[3 * step] = z13 - z2;
+    d[1 * step] = z11 + z4;
+    d[7 * step] = z11 - z4;
+
+    return;
+}
+
+// mj_idct_1d() in fixed point. the values must fit into 16 bits.
+void mj_idct_fixed_1d(int *d, int step) {
+    int tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    int tmp10, tmp11, tmp12, tmp13;
+    int z5, z10, z11, z12, z13;
+
+    // even part
+    tmp0 = d[0 * step];
+    tmp1 = d[2 * step];
+    tmp2 = d[4 * step];
+    tmp3 = d[6 * step];
+
+    tmp10 = tmp0 + tmp2;
+    tmp11 = tmp0 - tmp2;
+
+    tmp13 = tmp1 + tmp3;
+    tmp12 = (tmp1 - tmp3) + mj_fixed_mul(tmp1 - tmp3, MJ_FIX_0_414213562) - tmp13;
+
+    tmp0 = tmp10 + tmp13;
+    tmp3 = tmp10 - tmp13;
+    tmp1 = tmp11 + tmp12;
+    tmp2 = tmp11 - tmp12;
+
+    // odd part
+    tmp4 = d[1 * step];
+    tmp5 = d[3 * step];
+    tmp6 = d[5 * step];
+    tmp7 = d[7 * step];
+
+    z13 = tmp6 + tmp5;
+    z10 = tmp6 - tmp5;
+    z11 = tmp4 + tmp7;
+    z12 = tmp4 - tmp7;
+
+    tmp7 = z11 + z13;
+    tmp11 = (z11 - z13) + mj_fixed_mul(z11 - z13, MJ_FIX_0_414213562);
+
+    z5 = (z10 + z12) + mj_fixed_mul(z10 + z12, MJ_FIX_0_847759065);
+    tmp10 = z12 + mj_fixed_mul(z12, MJ_FIX_0_082392200) - z5;
+    tmp12 = z5 - z10 - z10 - mj_fixed_mul(z10, MJ_FIX_0_613125930);
+
+    tmp6 = tmp12 - tmp7;
+    tmp5 = tmp11 - tmp6;
+    tmp4 = tmp10 + tmp5;
+
+    d[0 * step] = tmp0 + tmp7;
+    d[7 * step] = tmp0 - tmp7;
+    d[1 * step] = tmp1 + tmp6;
+    d[6 * step] = tmp1 - tmp6;
+    d[2 * step] = tmp2 + tmp5;
+    d[5 * step] = tmp2 - tmp5;
+    d[4 * step] = tmp3 + tmp4;
+    d[3 * step] = tmp3 - tmp4;
+
+    return;
+}
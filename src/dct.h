@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _LIBMODJPEG_DCT_H_
+#define _LIBMODJPEG_DCT_H_
+
+#include "libmodjpeg.h"
+
+extern const float mj_fdct_descale[DCTSIZE2];
+extern const float mj_idct_prescale[DCTSIZE2];
+
+void mj_fdct_1d(float *d, int step);
+void mj_fdct(const float *samples, mj_block_t *coefs);
+
+void mj_idct_1d(float *d, int step);
+void mj_idct(const mj_block_t *coefs, float *samples);
+
+// the constants of the transforms in fixed point (Q15). a factor above 1 is applied as x + x * (c - 1).
+#define MJ_FIX_0_082392200 2700
+#define MJ_FIX_0_306562965 10045
+#define MJ_FIX_0_382683433 12540
+#define MJ_FIX_0_414213562 13573
+#define MJ_FIX_0_541196100 17734
+#define MJ_FIX_0_613125930 20091
+#define MJ_FIX_0_707106781 23170
+#define MJ_FIX_0_847759065 27779
+
+// multiply by a constant in Q15 with rounding, the same as pmulhrsw
+static inline int mj_fixed_mul(int x, int c) {
+    return (x * c + (1 << 14)) >> 15;
+}
+
+void mj_fdct_fixed_1d(int *d, int step);
+void mj_idct_fixed_1d(int *d, int step);
+
+#endif
@@ -20,16 +20,25 @@
  * SOFTWARE.
  */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #ifdef WITH_LIBPNG
 #    include <png.h>
 #endif
 
+#include "cache.h"
+#include "convolve.h"
+#include "dct.h"
 #include "dropon.h"
+#include "fixed.h"
 #include "image.h"
 #include "libmodjpeg.h"
+#include "registry.h"
+#include "store.h"
 
 int mj_read_dropon_from_file(mj_dropon_t *d, const char *filename, const char *maskfilename, short blend) {
     if(d == NULL) {
@@ -40,6 +49,12 @@ int mj_read_dropon_from_file(mj_dropon_t *d, const char *filename, const char *m
     unsigned char *memory = NULL, *maskmemory = NULL;
     size_t         len = 0, masklen = 0;
 
+    // a compiled dropon will be mapped into the memory instead of reading it
+    rv = mj_read_stored_dropon_from_file(d, filename);
+    if(rv != MJ_ERR_UNSUPPORTED_FILETYPE) {
+        return rv;
+    }
+
     rv = mj_read_file(&memory, &len, filename);
     if(rv != MJ_OK) {
         return rv;
@@ -70,8 +85,12 @@ int mj_read_dropon_from_memory(mj_dropon_t *d, const unsigned char *memory, size
 
     int rv = MJ_OK;
 
+    // Test for a compiled dropon
+    if(mj_is_stored_dropon(memory, len) == 1) {
+        rv = mj_read_stored_dropon_from_memory(d, memory, len);
+    }
     // Test for JPEG
-    if(
+    else if(
         memory[0] == 0xff &&
         memory[1] == 0xd8 &&
         memory[2] == 0xff) {
@@ -205,7 +224,7 @@ int mj_read_dropon_from_raw(mj_dropon_t *d, const unsigned char *rawdata, unsign
         return MJ_ERR_NULL_DATA;
     }
 
-    mj_free_dropon(d);
+    mj_reset_dropon(d);
 
     if(rawdata == NULL) {
         return MJ_ERR_NULL_DATA;
@@ -234,21 +253,24 @@ int mj_read_dropon_from_raw(mj_dropon_t *d, const unsigned char *rawdata, unsign
     d->height = height;
     d->blend = blend;
 
-    // image and alpha are store with 3 components. this makes it
+    // the image is stored with 3 components. this makes it
     // easier to handle later for compiling the dropon.
     size_t nsamples = 3 * width * height;
 
     d->image = (unsigned char *)calloc(nsamples, sizeof(unsigned char));
     if(d->image == NULL) {
-        mj_free_dropon(d);
+        mj_reset_dropon(d);
         return MJ_ERR_MEMORY;
     }
 
-    // the alpha channel is also stored with 3 component
-    d->alpha = (unsigned char *)calloc(nsamples, sizeof(unsigned char));
-    if(d->alpha == NULL) {
-        mj_free_dropon(d);
-        return MJ_ERR_MEMORY;
+    // the alpha channel is stored with 1 component. without an alpha channel
+    // there is no need to store it because it is given by blend.
+    if(colorspace == MJ_COLORSPACE_RGBA || colorspace == MJ_COLORSPACE_YCCA || colorspace == MJ_COLORSPACE_GRAYSCALEA) {
+        d->alpha = (unsigned char *)calloc(nsamples / 3, sizeof(unsigned char));
+        if(d->alpha == NULL) {
+            mj_reset_dropon(d);
+            return MJ_ERR_MEMORY;
+        }
     }
 
     const unsigned char *p = rawdata;
@@ -263,8 +285,6 @@ int mj_read_dropon_from_raw(mj_dropon_t *d, const unsigned char *rawdata, unsign
             *pimage++ = *p++;
             *pimage++ = *p++;
 
-            *palpha++ = *p;
-            *palpha++ = *p;
             *palpha++ = *p++;
         }
 
@@ -282,10 +302,6 @@ int mj_read_dropon_from_raw(mj_dropon_t *d, const unsigned char *rawdata, unsign
             *pimage++ = *p++;
             *pimage++ = *p++;
             *pimage++ = *p++;
-
-            *palpha++ = (char)d->blend;
-            *palpha++ = (char)d->blend;
-            *palpha++ = (char)d->blend;
         }
 
         d->colorspace = colorspace;
@@ -296,8 +312,6 @@ int mj_read_dropon_from_raw(mj_dropon_t *d, const unsigned char *rawdata, unsign
             *pimage++ = *p;
             *pimage++ = *p++;
 
-            *palpha++ = *p;
-            *palpha++ = *p;
             *palpha++ = *p++;
         }
 
@@ -310,16 +324,12 @@ int mj_read_dropon_from_raw(mj_dropon_t *d, const unsigned char *rawdata, unsign
             *pimage++ = *p;
             *pimage++ = *p;
             *pimage++ = *p++;
-
-            *palpha++ = (char)d->blend;
-            *palpha++ = (char)d->blend;
-            *palpha++ = (char)d->blend;
         }
 
         d->colorspace = MJ_COLORSPACE_GRAYSCALE;
     }
 
-    return MJ_OK;
+    return mj_precompile_layouts(d);
 }
 
 int mj_compile_dropon(mj_compileddropon_t *cd, mj_dropon_t *d, J_COLOR_SPACE colorspace, mj_sampling_t *sampling, int blockoffset_x, int blockoffset_y, int crop_x, int crop_y, int crop_w, int crop_h) {
@@ -327,14 +337,32 @@ int mj_compile_dropon(mj_compileddropon_t *cd, mj_dropon_t *d, J_COLOR_SPACE col
         return MJ_ERR_NULL_DATA;
     }
 
+    memset(cd, 0, sizeof(mj_compileddropon_t));
+
     // crop and or extend the dropon. the dropon needs to cover whole blocks.
 
-    // after that, encode it to a jpeg with the same colorspace and sampling as the image.
-    // this gives us the the dropon in frequency space.
+    // after that, transform it into the frequency space with the same colorspace and sampling as the image.
+    // the color conversion, the downsampling and the DCT are done in the same way as a JPEG encoder
+    // would do it, but the coefficients are not quantized. this is done row of MCUs by row of MCUs
+    // such that the samples stay in the cache.
 
     // same for the mask. the mask is required if we extend the dropon such that
     // the extended area doesn't cover the image.
 
+    int ncomponents = 0;
+
+    switch(colorspace) {
+        case JCS_GRAYSCALE:
+            ncomponents = 1;
+            break;
+        case JCS_RGB:
+        case JCS_YCbCr:
+            ncomponents = 3;
+            break;
+        default:
+            return MJ_ERR_UNSUPPORTED_COLORSPACE;
+    }
+
     // crop/extend the dropon
 
     int width = crop_w + blockoffset_x;
@@ -349,238 +377,657 @@ int mj_compile_dropon(mj_compileddropon_t *cd, mj_dropon_t *d, J_COLOR_SPACE col
         height += sampling->v_factor - padding;
     }
 
-    unsigned char *data = (unsigned char *)calloc(3 * width * height, sizeof(unsigned char));
-    if(data == NULL) {
+    cd->image_ncomponents = ncomponents;
+    cd->image_colorspace = colorspace;
+    cd->image = (mj_component_t *)calloc(ncomponents, sizeof(mj_component_t));
+
+    cd->alpha_ncomponents = ncomponents;
+    cd->alpha = (mj_component_t *)calloc(ncomponents, sizeof(mj_component_t));
+
+    // one row of MCUs
+    float *band = (float *)malloc((size_t)width * (size_t)sampling->v_factor * sizeof(float));
+
+    if(cd->image == NULL || cd->alpha == NULL || band == NULL) {
+        free(band);
+        mj_free_compileddropon(cd);
+
         return MJ_ERR_MEMORY;
     }
 
-    int            i, j;
-    unsigned char *p, *q;
+    int rv = MJ_OK;
+    int c, i, j, y, x;
 
-    for(i = crop_y; i < (crop_y + crop_h); i++) {
-        p = &data[(i - crop_y + blockoffset_y) * width * 3 + (blockoffset_x * 3)];
-        q = &d->image[i * d->width * 3 + (crop_x * 3)];
+    // the mask is the same for all components of the target colorspace. if an earlier component
+    // has the same sampling, the compiled mask will be copied from that component.
+    int alpha_source[MAX_COMPONENTS];
 
-        for(j = crop_x; j < (crop_x + crop_w); j++) {
-            *p++ = *q++;
-            *p++ = *q++;
-            *p++ = *q++;
+    for(c = 0; c < ncomponents && rv == MJ_OK; c++) {
+        rv = mj_alloc_component(&cd->image[c], width, height, sampling, c);
+        if(rv != MJ_OK) {
+            break;
+        }
+
+        alpha_source[c] = c;
+
+        for(i = 0; i < c; i++) {
+            if(cd->image[i].h_samp_factor == cd->image[c].h_samp_factor && cd->image[i].v_samp_factor == cd->image[c].v_samp_factor) {
+                alpha_source[c] = i;
+                break;
+            }
+        }
+
+        if(alpha_source[c] == c) {
+            rv = mj_alloc_component(&cd->alpha[c], width, height, sampling, c);
         }
     }
 
-    int            rv;
-    unsigned char *buffer = NULL;
-    size_t         len = 0;
+    float                fill, *p;
+    const unsigned char  black[3] = {0, 0, 0};
+    const unsigned char *q;
 
-    // encode the dropon to JPEG
-    rv = mj_encode_raw_to_jpeg_memory(&buffer, &len, data, d->colorspace, colorspace, sampling, width, height);
-    if(rv != MJ_OK) {
-        free(data);
-        return rv;
+    for(y = 0; y < height && rv == MJ_OK; y += sampling->v_factor) {
+        for(c = 0; c < ncomponents; c++) {
+            // the area around the dropon is black
+            mj_convert_samples(&fill, black, d->colorspace, colorspace, c, 1);
+
+            for(j = 0; j < sampling->v_factor; j++) {
+                p = &band[j * width];
+                i = y + j - blockoffset_y + crop_y;
+
+                if(i < crop_y || i >= crop_y + crop_h) {
+                    for(x = 0; x < width; x++) {
+                        p[x] = fill;
+                    }
+
+                    continue;
+                }
+
+                for(x = 0; x < blockoffset_x; x++) {
+                    p[x] = fill;
+                }
+
+                q = &d->image[((size_t)i * d->width + crop_x) * 3];
+                mj_convert_samples(&p[blockoffset_x], q, d->colorspace, colorspace, c, crop_w);
+
+                for(x = blockoffset_x + crop_w; x < width; x++) {
+                    p[x] = fill;
+                }
+            }
+
+            // the samples of the dropon are centered around 0, same as the JPEG encoder does it
+            mj_compile_band(&cd->image[c], band, width, y / sampling->v_factor, sampling, -CENTERJSAMPLE);
+
+            if(alpha_source[c] != c) {
+                continue;
+            }
+
+            // the area around the dropon is transparent. the mask is not centered
+            // because the blending requires the weights from 0 to 255.
+            for(j = 0; j < sampling->v_factor; j++) {
+                p = &band[j * width];
+                i = y + j - blockoffset_y + crop_y;
+
+                for(x = 0; x < width; x++) {
+                    p[x] = 0.0f;
+                }
+
+                if(i < crop_y || i >= crop_y + crop_h) {
+                    continue;
+                }
+
+                // without an alpha channel the dropon is uniformly blended
+                if(d->alpha == NULL) {
+                    for(x = 0; x < crop_w; x++) {
+                        p[blockoffset_x + x] = (float)d->blend;
+                    }
+
+                    continue;
+                }
+
+                q = &d->alpha[(size_t)i * d->width + crop_x];
+
+                for(x = 0; x < crop_w; x++) {
+                    p[blockoffset_x + x] = (float)q[x];
+                }
+            }
+
+            mj_compile_band(&cd->alpha[c], band, width, y / sampling->v_factor, sampling, 0);
+        }
     }
 
-    // read the coefficients from the encoded dropon
-    rv = mj_read_droponimage_from_memory(cd, buffer, len);
-    free(buffer);
+    free(band);
+
+    for(c = 0; c < ncomponents && rv == MJ_OK; c++) {
+        if(alpha_source[c] == c) {
+            rv = mj_weight_alpha_component(&cd->alpha[c]);
+        }
+        else {
+            rv = mj_copy_component(&cd->alpha[c], &cd->alpha[alpha_source[c]]);
+        }
+    }
 
     if(rv != MJ_OK) {
-        free(data);
-        return rv;
+        mj_free_compileddropon(cd);
+    }
+
+    return rv;
+}
+
+void mj_convert_samples(float *plane, const unsigned char *data, int from_colorspace, J_COLOR_SPACE to_colorspace, int component, size_t nsamples) {
+    size_t               v;
+    float                x, c0, c1, c2, offset;
+    const unsigned char *p = data;
+
+    // the grayscale dropons are stored with three identical components, i.e. they can be treated as RGB
+    if(to_colorspace == JCS_RGB && from_colorspace == MJ_COLORSPACE_YCC) {
+        // YCC => RGB
+        switch(component) {
+            case 0:
+                c0 = 0.0f, c1 = 1.402f;
+                break;
+            case 1:
+                c0 = -0.344136f, c1 = -0.714136f;
+                break;
+            default:
+                c0 = 1.772f, c1 = 0.0f;
+                break;
+        }
+
+        for(v = 0; v < nsamples; v++, p += 3) {
+            x = (float)p[0] + c0 * ((float)p[1] - CENTERJSAMPLE) + c1 * ((float)p[2] - CENTERJSAMPLE);
+
+            if(x < 0.0f) {
+                x = 0.0f;
+            }
+            else if(x > MAXJSAMPLE) {
+                x = MAXJSAMPLE;
+            }
+
+            plane[v] = x;
+        }
     }
+    else if(to_colorspace != JCS_RGB && from_colorspace != MJ_COLORSPACE_YCC) {
+        // RGB => YCC, RGB => GRAYSCALE
+        switch(component) {
+            case 0:
+                c0 = 0.299f, c1 = 0.587f, c2 = 0.114f, offset = 0.0f;
+                break;
+            case 1:
+                c0 = -0.168736f, c1 = -0.331264f, c2 = 0.5f, offset = CENTERJSAMPLE;
+                break;
+            default:
+                c0 = 0.5f, c1 = -0.418688f, c2 = -0.081312f, offset = CENTERJSAMPLE;
+                break;
+        }
 
-    for(i = crop_y; i < (crop_y + crop_h); i++) {
-        p = &data[(i - crop_y + blockoffset_y) * width * 3 + (blockoffset_x * 3)];
-        q = &d->alpha[i * d->width * 3 + (crop_x * 3)];
+        for(v = 0; v < nsamples; v++, p += 3) {
+            plane[v] = c0 * (float)p[0] + c1 * (float)p[1] + c2 * (float)p[2] + offset;
+        }
+    }
+    else {
+        // RGB => RGB, YCC => YCC, YCC => GRAYSCALE
+        p += component;
 
-        for(j = crop_x; j < (crop_x + crop_w); j++) {
-            *p++ = *q++;
-            *p++ = *q++;
-            *p++ = *q++;
+        for(v = 0; v < nsamples; v++, p += 3) {
+            plane[v] = (float)*p;
         }
     }
 
-    // encode the mask to JPEG. all components of the mask are the same. depending on the targeted colorspace,
-    // the data of the mask needs to be interpreted differently
-    // for the target colorspaces, we support only GRAYSCALE, RGB, and YCC
-    // the JPEG library supports only these internal color transformations
-    //    RGB => RGB
-    //    RGB => YCC
-    //    RGB => GRAYSCALE
-    //    YCC => YCC
-    //    YCC => GRAYSCALE
-    int alpha_colorspace = MJ_COLORSPACE_YCC;
-    if(colorspace == JCS_RGB) {
-        alpha_colorspace = MJ_COLORSPACE_RGB;
+    return;
+}
+
+int mj_alloc_component(mj_component_t *comp, int width, int height, mj_sampling_t *sampling, int component) {
+    int h_samp_factor = sampling->samp_factor[component].h_samp_factor;
+    int v_samp_factor = sampling->samp_factor[component].v_samp_factor;
+
+    // the JPEG encoder only supports integral downsampling factors
+    if(h_samp_factor <= 0 || v_samp_factor <= 0) {
+        return MJ_ERR_ENCODE_JPEG;
     }
-    rv = mj_encode_raw_to_jpeg_memory(&buffer, &len, data, alpha_colorspace, colorspace, sampling, width, height);
-    if(rv != MJ_OK) {
-        free(data);
-        return rv;
+
+    if(sampling->max_h_samp_factor % h_samp_factor != 0 || sampling->max_v_samp_factor % v_samp_factor != 0) {
+        return MJ_ERR_ENCODE_JPEG;
     }
 
-    // read the coefficients from the encoded dropon mask
-    rv = mj_read_droponalpha_from_memory(cd, buffer, len);
+    comp->h_samp_factor = h_samp_factor;
+    comp->v_samp_factor = v_samp_factor;
 
-    free(buffer);
-    free(data);
+    // the width and height of the dropon are multiples of the MCU size
+    comp->width_in_blocks = (width / sampling->h_factor) * h_samp_factor;
+    comp->height_in_blocks = (height / sampling->v_factor) * v_samp_factor;
 
-    return rv;
+    comp->nblocks = comp->width_in_blocks * comp->height_in_blocks;
+    comp->blocks = mj_alloc_blocks(comp->nblocks);
+    if(comp->blocks == NULL) {
+        comp->nblocks = 0;
+        return MJ_ERR_MEMORY;
+    }
+
+    return MJ_OK;
 }
 
-int mj_read_droponimage_from_memory(mj_compileddropon_t *cd, const unsigned char *memory, size_t len) {
-    if(cd == NULL) {
-        return MJ_ERR_NULL_DATA;
+void mj_compile_band(mj_component_t *comp, float *band, int width, int mcu_row, mj_sampling_t *sampling, int level_shift) {
+    int h_expand = sampling->max_h_samp_factor / comp->h_samp_factor;
+    int v_expand = sampling->max_v_samp_factor / comp->v_samp_factor;
+
+    // downsample by averaging the samples. this can be done in place because the
+    // downsampled sample is never behind the first sample it is calculated from.
+    int   comp_width = width / h_expand;
+    int   comp_height = sampling->v_factor / v_expand;
+    int   x, y, i, j;
+    float sum, scale = 1.0f / (float)(h_expand * v_expand);
+
+    if(h_expand != 1 || v_expand != 1) {
+        for(y = 0; y < comp_height; y++) {
+            for(x = 0; x < comp_width; x++) {
+                sum = 0.0f;
+
+                for(j = 0; j < v_expand; j++) {
+                    for(i = 0; i < h_expand; i++) {
+                        sum += band[(y * v_expand + j) * width + (x * h_expand + i)];
+                    }
+                }
+
+                band[y * comp_width + x] = sum * scale;
+            }
+        }
     }
 
-    mj_jpeg_t m;
-    int       rv;
+    int         k, l;
+    float       samples[DCTSIZE2], *p;
+    mj_block_t *b;
 
-    mj_init_jpeg(&m);
+    for(l = 0; l < comp->v_samp_factor; l++) {
+        for(k = 0; k < comp->width_in_blocks; k++) {
+            b = MJ_BLOCK(comp, comp->width_in_blocks * (mcu_row * comp->v_samp_factor + l) + k);
 
-    rv = mj_read_jpeg_from_memory(&m, memory, len, 0);
-    if(rv != MJ_OK) {
-        return rv;
+            for(j = 0; j < DCTSIZE; j++) {
+                p = &band[(l * DCTSIZE + j) * comp_width + (k * DCTSIZE)];
+
+                for(i = 0; i < DCTSIZE; i++) {
+                    samples[j * DCTSIZE + i] = p[i] + (float)level_shift;
+                }
+            }
+
+            mj_fdct(samples, b);
+        }
     }
 
-    int                  c, k, l, i;
-    jpeg_component_info *component;
-    mj_component_t *     comp;
-    mj_block_t *         b;
-    JBLOCKARRAY          blocks;
-    JCOEFPTR             coefs;
+    return;
+}
+
+int mj_copy_component(mj_component_t *dst, mj_component_t *src) {
+    *dst = *src;
 
-    cd->image_ncomponents = m.cinfo.num_components;
-    cd->image_colorspace = m.cinfo.jpeg_color_space;
-    cd->image = (mj_component_t *)calloc(cd->image_ncomponents, sizeof(mj_component_t));
+    dst->nonzero = NULL;
+    dst->classes = NULL;
+    dst->quantized = NULL;
+    dst->fixed = NULL;
+    dst->blocks = mj_alloc_blocks(dst->nblocks);
+    if(dst->blocks == NULL) {
+        dst->nblocks = 0;
+        return MJ_ERR_MEMORY;
+    }
 
-    for(c = 0; c < m.cinfo.num_components; c++) {
-        component = &m.cinfo.comp_info[c];
-        comp = &cd->image[c];
+    memcpy(dst->blocks, src->blocks, mj_blocks_size(dst));
 
-        comp->h_samp_factor = component->h_samp_factor;
-        comp->v_samp_factor = component->v_samp_factor;
+    if(src->nonzero != NULL) {
+        dst->nonzero = (unsigned long long *)malloc((size_t)dst->nblocks * (sizeof(unsigned long long) + 1) + 1);
+        if(dst->nonzero == NULL) {
+            mj_free_component(dst);
+            return MJ_ERR_MEMORY;
+        }
 
-        comp->width_in_blocks = component->width_in_blocks;
-        comp->height_in_blocks = component->height_in_blocks;
+        dst->classes = (unsigned char *)(dst->nonzero + dst->nblocks);
 
-        comp->nblocks = comp->width_in_blocks * comp->height_in_blocks;
-        comp->blocks = (mj_block_t **)calloc(comp->nblocks, sizeof(mj_block_t *));
+        memcpy(dst->nonzero, src->nonzero, (size_t)dst->nblocks * sizeof(unsigned long long));
+        memcpy(dst->classes, src->classes, (size_t)dst->nblocks);
+    }
 
-        for(l = 0; l < comp->height_in_blocks; l++) {
-            blocks = (*m.cinfo.mem->access_virt_barray)((j_common_ptr)&m.cinfo, m.coef[c], l, 1, TRUE);
+    return MJ_OK;
+}
 
-            for(k = 0; k < comp->width_in_blocks; k++) {
-                b = (mj_block_t *)calloc(64, sizeof(mj_block_t));
-                coefs = blocks[0][k];
+int mj_weight_alpha_component(mj_component_t *comp) {
+    int         n, i, ac, nonzero;
+    float       samples[DCTSIZE2];
+    mj_block_t *b;
 
-                for(i = 0; i < DCTSIZE2; i += 8) {
-                    b[i + 0] = (float)coefs[i + 0];
-                    b[i + 1] = (float)coefs[i + 1];
-                    b[i + 2] = (float)coefs[i + 2];
-                    b[i + 3] = (float)coefs[i + 3];
-                    b[i + 4] = (float)coefs[i + 4];
-                    b[i + 5] = (float)coefs[i + 5];
-                    b[i + 6] = (float)coefs[i + 6];
-                    b[i + 7] = (float)coefs[i + 7];
-                }
+    comp->nonzero = (unsigned long long *)malloc((size_t)comp->nblocks * (sizeof(unsigned long long) + 1) + 1);
+    if(comp->nonzero == NULL) {
+        return MJ_ERR_MEMORY;
+    }
+
+    comp->classes = (unsigned char *)(comp->nonzero + comp->nblocks);
+
+    for(n = 0; n < comp->nblocks; n++) {
+        b = MJ_BLOCK(comp, n);
+
+        // flush the rounding noise of the DCT, such that e.g. a uniform mask has really only a DC coefficient.
+        // the blending only needs to visit the coefficients that are left.
+        ac = 0;
+        nonzero = 0;
+        comp->nonzero[n] = 0;
+
+        for(i = 0; i < DCTSIZE2; i++) {
+            if(b[i] > -MJ_ALPHA_EPSILON && b[i] < MJ_ALPHA_EPSILON) {
+                b[i] = 0.0;
+                continue;
+            }
+
+            comp->nonzero[n] |= (1ULL << i);
+            nonzero++;
 
-                comp->blocks[comp->width_in_blocks * l + k] = b;
+            if(i != 0) {
+                ac = 1;
             }
         }
-    }
 
-    mj_free_jpeg(&m);
+        // a uniform mask of 0 or 255 doesn't need to be blended
+        if(ac == 0 && b[0] == 0.0) {
+            comp->classes[n] = MJ_BLOCK_TRANSPARENT;
+        }
+        else if(ac == 0 && b[0] > MJ_ALPHA_OPAQUE_DC - 0.01) {
+            comp->classes[n] = MJ_BLOCK_OPAQUE;
+        }
+        else if(nonzero >= MJ_ALPHA_SAMPLES_NONZERO) {
+            comp->classes[n] = MJ_BLOCK_SAMPLES;
+        }
+        else {
+            comp->classes[n] = MJ_BLOCK_PARTIAL;
+        }
+
+        // a busy mask is cheaper to apply in the pixel domain
+        if(comp->classes[n] == MJ_BLOCK_SAMPLES) {
+            mj_idct(b, samples);
+
+            for(i = 0; i < DCTSIZE2; i++) {
+                b[i] = samples[i] / 255.0f;
+            }
+
+            continue;
+        }
+
+        // w'(j, i) = w(j, i) * 1/255 * c(i) * c(j) * 1/4
+        // the factor 1/4 comes from V(i) and V(j)
+        // => 1/255 * 1/4 = 1/1020
+
+        b[0] *= (0.3535534 * 0.3535534 / 1020.0);
+        b[1] *= (0.3535534 * 0.5 / 1020.0);
+        b[2] *= (0.3535534 * 0.5 / 1020.0);
+        b[3] *= (0.3535534 * 0.5 / 1020.0);
+        b[4] *= (0.3535534 * 0.5 / 1020.0);
+        b[5] *= (0.3535534 * 0.5 / 1020.0);
+        b[6] *= (0.3535534 * 0.5 / 1020.0);
+        b[7] *= (0.3535534 * 0.5 / 1020.0);
+
+        for(i = 8; i < DCTSIZE2; i += 8) {
+            b[i + 0] *= (0.5 * 0.3535534 / 1020.0);
+            b[i + 1] *= (0.5 * 0.5 / 1020.0);
+            b[i + 2] *= (0.5 * 0.5 / 1020.0);
+            b[i + 3] *= (0.5 * 0.5 / 1020.0);
+            b[i + 4] *= (0.5 * 0.5 / 1020.0);
+            b[i + 5] *= (0.5 * 0.5 / 1020.0);
+            b[i + 6] *= (0.5 * 0.5 / 1020.0);
+            b[i + 7] *= (0.5 * 0.5 / 1020.0);
+        }
+    }
 
     return MJ_OK;
 }
 
-int mj_read_droponalpha_from_memory(mj_compileddropon_t *cd, const unsigned char *memory, size_t len) {
-    if(cd == NULL) {
+void mj_init_dropon(mj_dropon_t *d) {
+    if(d == NULL) {
+        return;
+    }
+
+    memset(d, 0, sizeof(mj_dropon_t));
+
+    d->cache_max_size = MJ_CACHE_DEFAULT_SIZE;
+
+    return;
+}
+
+void mj_set_dropon_cache_size(mj_dropon_t *d, size_t max_size) {
+    if(d == NULL) {
+        return;
+    }
+
+    d->cache_max_size = max_size;
+
+    // drop the least recently used compiled dropons that don't fit anymore
+    if(d->cache != NULL) {
+        d->cache->max_size = max_size;
+
+        mj_cache_evict(d->cache, max_size);
+    }
+
+    return;
+}
+
+int mj_precompile_dropon(mj_dropon_t *d, mj_jpeg_t *m) {
+    if(d == NULL || m == NULL) {
         return MJ_ERR_NULL_DATA;
     }
 
-    mj_jpeg_t m;
-    int       rv;
+    return mj_precompile_layout(d, m->cinfo.jpeg_color_space, &m->sampling);
+}
 
-    mj_init_jpeg(&m);
+int mj_add_dropon_layout(mj_dropon_t *d, J_COLOR_SPACE colorspace, int h_samp_factor, int v_samp_factor) {
+    if(d == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
 
-    rv = mj_read_jpeg_from_memory(&m, memory, len, 0);
-    if(rv != MJ_OK) {
-        return rv;
+    int ncomponents = 0;
+
+    switch(colorspace) {
+        case JCS_GRAYSCALE:
+            ncomponents = 1;
+            break;
+        case JCS_RGB:
+        case JCS_YCbCr:
+            ncomponents = 3;
+            break;
+        default:
+            return MJ_ERR_UNSUPPORTED_COLORSPACE;
     }
 
-    int                  c, k, l, i;
-    jpeg_component_info *component;
-    mj_component_t *     comp;
-    mj_block_t *         b;
-    JBLOCKARRAY          blocks;
-    JCOEFPTR             coefs;
-
-    cd->alpha_ncomponents = m.cinfo.num_components;
-    cd->alpha = (mj_component_t *)calloc(cd->alpha_ncomponents, sizeof(mj_component_t));
-
-    for(c = 0; c < m.cinfo.num_components; c++) {
-        component = &m.cinfo.comp_info[c];
-        comp = &cd->alpha[c];
-
-        comp->h_samp_factor = component->h_samp_factor;
-        comp->v_samp_factor = component->v_samp_factor;
-
-        comp->width_in_blocks = component->width_in_blocks;
-        comp->height_in_blocks = component->height_in_blocks;
-
-        comp->nblocks = comp->width_in_blocks * comp->height_in_blocks;
-        comp->blocks = (mj_block_t **)calloc(comp->nblocks, sizeof(mj_block_t *));
-
-        for(l = 0; l < comp->height_in_blocks; l++) {
-            blocks = (*m.cinfo.mem->access_virt_barray)((j_common_ptr)&m.cinfo, m.coef[c], l, 1, TRUE);
-
-            for(k = 0; k < comp->width_in_blocks; k++) {
-                b = (mj_block_t *)calloc(64, sizeof(mj_block_t));
-                coefs = blocks[0][k];
-
-                coefs[0] += 1024;
-
-                // w'(j, i) = w(j, i) * 1/255 * c(i) * c(j) * 1/4
-                // the factor 1/4 comes from V(i) and V(j)
-                // => 1/255 * 1/4 = 1/1020
-
-                b[0] = (float)coefs[0] * (0.3535534 * 0.3535534 / 1020.0);
-                b[1] = (float)coefs[1] * (0.3535534 * 0.5 / 1020.0);
-                b[2] = (float)coefs[2] * (0.3535534 * 0.5 / 1020.0);
-                b[3] = (float)coefs[3] * (0.3535534 * 0.5 / 1020.0);
-                b[4] = (float)coefs[4] * (0.3535534 * 0.5 / 1020.0);
-                b[5] = (float)coefs[5] * (0.3535534 * 0.5 / 1020.0);
-                b[6] = (float)coefs[6] * (0.3535534 * 0.5 / 1020.0);
-                b[7] = (float)coefs[7] * (0.3535534 * 0.5 / 1020.0);
-
-                for(i = 8; i < DCTSIZE2; i += 8) {
-                    b[i + 0] = (float)coefs[i + 0] * (0.5 * 0.3535534 / 1020.0);
-                    b[i + 1] = (float)coefs[i + 1] * (0.5 * 0.5 / 1020.0);
-                    b[i + 2] = (float)coefs[i + 2] * (0.5 * 0.5 / 1020.0);
-                    b[i + 3] = (float)coefs[i + 3] * (0.5 * 0.5 / 1020.0);
-                    b[i + 4] = (float)coefs[i + 4] * (0.5 * 0.5 / 1020.0);
-                    b[i + 5] = (float)coefs[i + 5] * (0.5 * 0.5 / 1020.0);
-                    b[i + 6] = (float)coefs[i + 6] * (0.5 * 0.5 / 1020.0);
-                    b[i + 7] = (float)coefs[i + 7] * (0.5 * 0.5 / 1020.0);
-                }
+    if(h_samp_factor < 1 || h_samp_factor > MAX_SAMP_FACTOR || v_samp_factor < 1 || v_samp_factor > MAX_SAMP_FACTOR) {
+        return MJ_ERR_ENCODE_JPEG;
+    }
 
-                comp->blocks[comp->width_in_blocks * l + k] = b;
-            }
+    // the first component has the given sampling factors, all others are not subsampled. this
+    // is how a JPEG encoder usually does it, e.g. 2x2 for 4:2:0, 2x1 for 4:2:2, 1x1 for 4:4:4.
+    mj_sampling_t sampling;
+    int           c;
+
+    memset(&sampling, 0, sizeof(mj_sampling_t));
+
+    sampling.max_h_samp_factor = h_samp_factor;
+    sampling.max_v_samp_factor = v_samp_factor;
+    sampling.h_factor = h_samp_factor * DCTSIZE;
+    sampling.v_factor = v_samp_factor * DCTSIZE;
+
+    sampling.samp_factor[0].h_samp_factor = h_samp_factor;
+    sampling.samp_factor[0].v_samp_factor = v_samp_factor;
+
+    for(c = 1; c < ncomponents; c++) {
+        sampling.samp_factor[c].h_samp_factor = 1;
+        sampling.samp_factor[c].v_samp_factor = 1;
+    }
+
+    for(c = 0; c < d->nlayouts; c++) {
+        if(d->layouts[c].colorspace == colorspace && memcmp(&d->layouts[c].sampling, &sampling, sizeof(mj_sampling_t)) == 0) {
+            return MJ_OK;
         }
     }
 
-    mj_free_jpeg(&m);
+    if(d->nlayouts == MJ_MAX_LAYOUTS) {
+        return MJ_ERR_MEMORY;
+    }
+
+    d->layouts[d->nlayouts].colorspace = colorspace;
+    d->layouts[d->nlayouts].sampling = sampling;
+    d->nlayouts++;
+
+    // an already loaded dropon is compiled right away
+    if(d->image == NULL) {
+        return MJ_OK;
+    }
+
+    return mj_precompile_layout(d, colorspace, &sampling);
+}
+
+int mj_precompile_layouts(mj_dropon_t *d) {
+    int i, rv;
+
+    for(i = 0; i < d->nlayouts; i++) {
+        rv = mj_precompile_layout(d, d->layouts[i].colorspace, &d->layouts[i].sampling);
+        if(rv != MJ_OK) {
+            return rv;
+        }
+    }
 
     return MJ_OK;
 }
 
-void mj_init_dropon(mj_dropon_t *d) {
+int mj_precompile_layout(mj_dropon_t *d, J_COLOR_SPACE colorspace, mj_sampling_t *sampling) {
+    mj_compileddropon_t *cd;
+    mj_precompilejob_t   job;
+    int                  blockoffset_x, blockoffset_y, i, n, nthreads, rv = MJ_OK;
+
+    // compile the whole dropon for every possible block offset in the layout. these are all the compiled
+    // dropons that are required for placing the dropon anywhere on an image with this layout as long as
+    // it is fully visible. they are pinned in the cache.
+    memset(&job, 0, sizeof(mj_precompilejob_t));
+
+    n = sampling->h_factor * sampling->v_factor;
+
+    job.d = d;
+    job.keys = (mj_cachekey_t *)calloc(n, sizeof(mj_cachekey_t));
+    job.compiled = (mj_compileddropon_t *)calloc(n, sizeof(mj_compileddropon_t));
+    job.rv = (int *)calloc(n, sizeof(int));
+
+    if(job.keys == NULL || job.compiled == NULL || job.rv == NULL) {
+        free(job.keys);
+        free(job.compiled);
+        free(job.rv);
+
+        return MJ_ERR_MEMORY;
+    }
+
+    for(blockoffset_y = 0; blockoffset_y < sampling->v_factor; blockoffset_y++) {
+        for(blockoffset_x = 0; blockoffset_x < sampling->h_factor; blockoffset_x++) {
+            mj_make_cachekey(&job.keys[job.nkeys], colorspace, sampling, blockoffset_x, blockoffset_y, 0, 0, d->width, d->height);
+
+            cd = mj_cache_lookup(d->cache, &job.keys[job.nkeys]);
+            if(cd != NULL) {
+                mj_cache_pin(d->cache, cd);
+                continue;
+            }
+
+            job.nkeys++;
+        }
+    }
+
+    // the fingerprint for the registry is calculated only once
+    if(d->registry != NULL && d->registry_id == 0) {
+        d->registry_id = mj_registry_dropon_id(d);
+    }
+
+    // the compiled dropons are independent from each other, so they are compiled in parallel
+    nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads > MJ_MAX_THREADS) {
+        nthreads = MJ_MAX_THREADS;
+    }
+    if(nthreads > job.nkeys) {
+        nthreads = job.nkeys;
+    }
+    if(nthreads < 1) {
+        nthreads = 1;
+    }
+
+    pthread_t threads[MJ_MAX_THREADS];
+    int       nstarted = 0;
+
+    job.nthreads = nthreads;
+
+    for(i = 1; i < nthreads; i++) {
+        if(pthread_create(&threads[nstarted], NULL, mj_precompile_thread, &job) != 0) {
+            break;
+        }
+
+        nstarted++;
+    }
+
+    mj_precompile_thread(&job);
+
+    for(i = 0; i < nstarted; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for(i = 0; i < job.nkeys; i++) {
+        if(job.rv[i] != MJ_OK) {
+            rv = job.rv[i];
+            continue;
+        }
+
+        if(rv != MJ_OK || mj_cache_insert(mj_dropon_cache(d), &job.keys[i], &job.compiled[i], 1) == NULL) {
+            mj_free_compileddropon(&job.compiled[i]);
+
+            if(rv == MJ_OK) {
+                rv = MJ_ERR_MEMORY;
+            }
+        }
+    }
+
+    free(job.keys);
+    free(job.compiled);
+    free(job.rv);
+
+    return rv;
+}
+
+void *mj_precompile_thread(void *arg) {
+    mj_precompilejob_t *job = (mj_precompilejob_t *)arg;
+    int                 i;
+
+    // each thread takes the next compiled dropon that nobody is working on yet
+    while((i = atomic_fetch_add(&job->next, 1)) < job->nkeys) {
+        job->rv[i] = mj_compile_cachekey(&job->compiled[i], job->d, &job->keys[i]);
+    }
+
+    return NULL;
+}
+
+int mj_compile_cachekey(mj_compileddropon_t *cd, mj_dropon_t *d, mj_cachekey_t *key) {
+    // a compiled dropon from the registry is shared with other processes
+    if(d->registry != NULL) {
+        return mj_registry_compile(d->registry, cd, d, key);
+    }
+
+    return mj_compile_dropon(cd, d, (J_COLOR_SPACE)key->colorspace, &key->sampling, key->blockoffset_x, key->blockoffset_y, key->crop_x, key->crop_y, key->crop_w, key->crop_h);
+}
+
+void mj_set_dropon_registry(mj_dropon_t *d, mj_registry_t *r) {
     if(d == NULL) {
         return;
     }
 
-    memset(d, 0, sizeof(mj_dropon_t));
+    if(r != NULL && r->base == NULL) {
+        r = NULL;
+    }
+
+    d->registry = r;
+
+    return;
+}
+
+void mj_set_dropon_fixed_point(mj_dropon_t *d, int fixed_point) {
+    if(d == NULL) {
+        return;
+    }
+
+    d->fixed_point = (fixed_point != 0);
 
     return;
 }
@@ -590,12 +1037,29 @@ void mj_free_dropon(mj_dropon_t *d) {
         return;
     }
 
-    if(d->image != NULL) {
-        free(d->image);
+    // the compiled dropons may point into the mapping, so the cache has to go first
+    if(d->cache != NULL) {
+        mj_free_cache(d->cache);
+        free(d->cache);
+    }
+
+    if(d->mapping != NULL) {
+        // the image and the alpha are part of the mapping
+        if(d->mapped != 0) {
+            munmap(d->mapping, d->mapping_size);
+        }
+        else {
+            free(d->mapping);
+        }
     }
+    else {
+        if(d->image != NULL) {
+            free(d->image);
+        }
 
-    if(d->alpha != NULL) {
-        free(d->alpha);
+        if(d->alpha != NULL) {
+            free(d->alpha);
+        }
     }
 
     mj_init_dropon(d);
@@ -603,6 +1067,29 @@ void mj_free_dropon(mj_dropon_t *d) {
     return;
 }
 
+void mj_reset_dropon(mj_dropon_t *d) {
+    // keep the cache and registry settings, the layouts, and the fixed point setting across reading a new dropon
+    size_t         cache_max_size = d->cache_max_size;
+    mj_registry_t *registry = d->registry;
+    mj_layout_t    layouts[MJ_MAX_LAYOUTS];
+    int            nlayouts = d->nlayouts;
+    int            fixed_point = d->fixed_point;
+
+    memcpy(layouts, d->layouts, sizeof(layouts));
+
+    mj_free_dropon(d);
+
+    d->cache_max_size = cache_max_size;
+    d->registry = registry;
+
+    memcpy(d->layouts, layouts, sizeof(layouts));
+    d->nlayouts = nlayouts;
+
+    d->fixed_point = fixed_point;
+
+    return;
+}
+
 void mj_free_compileddropon(mj_compileddropon_t *cd) {
     if(cd == NULL) {
         return;
@@ -610,9 +1097,16 @@ void mj_free_compileddropon(mj_compileddropon_t *cd) {
 
     int i;
 
+    // the blocks of a shared compiled dropon are not ours, but the quantized and the fixed point blocks are
     if(cd->image != NULL) {
         for(i = 0; i < cd->image_ncomponents; i++) {
-            mj_free_component(&cd->image[i]);
+            if(cd->shared == 0) {
+                mj_free_component(&cd->image[i]);
+            }
+            else {
+                mj_free_quantized(&cd->image[i]);
+                mj_free_fixed(&cd->image[i]);
+            }
         }
         free(cd->image);
         cd->image = NULL;
@@ -620,7 +1114,13 @@ void mj_free_compileddropon(mj_compileddropon_t *cd) {
 
     if(cd->alpha != NULL) {
         for(i = 0; i < cd->alpha_ncomponents; i++) {
-            mj_free_component(&cd->alpha[i]);
+            if(cd->shared == 0) {
+                mj_free_component(&cd->alpha[i]);
+            }
+            else {
+                mj_free_quantized(&cd->alpha[i]);
+                mj_free_fixed(&cd->alpha[i]);
+            }
         }
         free(cd->alpha);
         cd->alpha = NULL;
@@ -629,18 +1129,243 @@ void mj_free_compileddropon(mj_compileddropon_t *cd) {
     return;
 }
 
+size_t mj_compileddropon_size(mj_compileddropon_t *cd) {
+    if(cd == NULL) {
+        return 0;
+    }
+
+    int    i;
+    size_t size = 0;
+
+    // the blocks of a shared compiled dropon are in a mapping, only the components are ours
+    for(i = 0; i < cd->image_ncomponents; i++) {
+        size += sizeof(mj_component_t) + (cd->shared == 0 ? mj_component_size(&cd->image[i]) : 0);
+    }
+
+    for(i = 0; i < cd->alpha_ncomponents; i++) {
+        size += sizeof(mj_component_t) + (cd->shared == 0 ? mj_component_size(&cd->alpha[i]) : 0);
+    }
+
+    return size + mj_compileddropon_derived_size(cd);
+}
+
+size_t mj_compileddropon_derived_size(mj_compileddropon_t *cd) {
+    if(cd == NULL) {
+        return 0;
+    }
+
+    int    i;
+    size_t size = 0;
+
+    // the blocks that the compose kernels create on demand are part of the compiled dropon as well
+    for(i = 0; i < cd->image_ncomponents; i++) {
+        size += mj_derived_size(&cd->image[i]);
+    }
+
+    for(i = 0; i < cd->alpha_ncomponents; i++) {
+        size += mj_derived_size(&cd->alpha[i]);
+    }
+
+    return size;
+}
+
+void mj_free_compileddropon_derived(mj_compileddropon_t *cd) {
+    if(cd == NULL) {
+        return;
+    }
+
+    int i;
+
+    // the compose kernels create these blocks again when they need them
+    for(i = 0; i < cd->image_ncomponents; i++) {
+        mj_free_quantized(&cd->image[i]);
+        mj_free_fixed(&cd->image[i]);
+    }
+
+    for(i = 0; i < cd->alpha_ncomponents; i++) {
+        mj_free_quantized(&cd->alpha[i]);
+        mj_free_fixed(&cd->alpha[i]);
+    }
+
+    return;
+}
+
+size_t mj_derived_size(mj_component_t *c) {
+    if(c == NULL) {
+        return 0;
+    }
+
+    mj_quantized_t *q;
+    size_t          size = 0;
+
+    for(q = c->quantized; q != NULL; q = q->next) {
+        size += sizeof(mj_quantized_t) + ((size_t)c->nblocks + 1) * DCTSIZE2 * sizeof(JCOEF);
+    }
+
+    if(c->fixed != NULL) {
+        size += mj_fixed_size(c->fixed->nblocks, c->fixed->nfixed);
+    }
+
+    return size;
+}
+
+size_t mj_component_size(mj_component_t *c) {
+    if(c == NULL) {
+        return 0;
+    }
+
+    return mj_blocks_size(c) + mj_maskinfo_size(c);
+}
+
+size_t mj_maskinfo_size(mj_component_t *c) {
+    if(c == NULL || c->nonzero == NULL) {
+        return 0;
+    }
+
+    return (size_t)c->nblocks * (sizeof(unsigned long long) + 1);
+}
+
+size_t mj_blocks_size(mj_component_t *c) {
+    if(c == NULL) {
+        return 0;
+    }
+
+    return (size_t)c->nblocks * DCTSIZE2 * sizeof(mj_block_t);
+}
+
 void mj_free_component(mj_component_t *c) {
     if(c == NULL) {
         return;
     }
 
-    int i;
+    if(c->blocks != NULL) {
+        free(c->blocks);
+        c->blocks = NULL;
+    }
 
-    for(i = 0; i < c->nblocks; i++) {
-        free(c->blocks[i]);
+    // the classes are in the same chunk of memory
+    if(c->nonzero != NULL) {
+        free(c->nonzero);
+        c->nonzero = NULL;
+        c->classes = NULL;
     }
 
-    free(c->blocks);
+    mj_free_quantized(c);
+    mj_free_fixed(c);
+
+    c->nblocks = 0;
 
     return;
 }
+
+void mj_free_quantized(mj_component_t *c) {
+    if(c == NULL) {
+        return;
+    }
+
+    mj_quantized_t *q;
+
+    while(c->quantized != NULL) {
+        q = c->quantized;
+        c->quantized = q->next;
+
+        free(q->blocks);
+        free(q);
+    }
+
+    return;
+}
+
+JCOEF *mj_find_quantized(const mj_component_t *comp, const UINT16 *quantval) {
+    uint64_t        hash = mj_hash(MJ_HASH_INIT, quantval, DCTSIZE2 * sizeof(UINT16));
+    mj_quantized_t *q;
+
+    // same as mj_quantize_component(), but the order of the quantization tables is not changed
+    for(q = comp->quantized; q != NULL; q = q->next) {
+        if(q->hash == hash && memcmp(q->quantval, quantval, DCTSIZE2 * sizeof(UINT16)) == 0) {
+            return q->blocks;
+        }
+    }
+
+    return NULL;
+}
+
+JCOEF *mj_quantize_component(mj_component_t *comp, UINT16 *quantval) {
+    uint64_t        hash = mj_hash(MJ_HASH_INIT, quantval, DCTSIZE2 * sizeof(UINT16));
+    mj_quantized_t *q, *prev = NULL;
+    int             n = 0, i;
+
+    // images share only a few quantization tables. the most recently used is at the front.
+    for(q = comp->quantized; q != NULL; prev = q, q = q->next, n++) {
+        if(q->hash != hash || memcmp(q->quantval, quantval, DCTSIZE2 * sizeof(UINT16)) != 0) {
+            continue;
+        }
+
+        if(prev != NULL) {
+            prev->next = q->next;
+            q->next = comp->quantized;
+            comp->quantized = q;
+        }
+
+        return q->blocks;
+    }
+
+    // drop the least recently used quantization table
+    if(n >= MJ_QUANTIZED_MAX) {
+        for(prev = NULL, q = comp->quantized; q->next != NULL; prev = q, q = q->next) {
+        }
+
+        prev->next = NULL;
+
+        free(q->blocks);
+        free(q);
+    }
+
+    q = (mj_quantized_t *)calloc(1, sizeof(mj_quantized_t));
+    if(q == NULL) {
+        return NULL;
+    }
+
+    q->blocks = (JCOEF *)malloc(((size_t)comp->nblocks + 1) * DCTSIZE2 * sizeof(JCOEF));
+    if(q->blocks == NULL) {
+        free(q);
+        return NULL;
+    }
+
+    q->hash = hash;
+    memcpy(q->quantval, quantval, DCTSIZE2 * sizeof(UINT16));
+
+    // same as replacing a block of the image with the block of the dropon
+    JCOEF *           coefs = q->blocks;
+    mj_block_t *      b = comp->blocks;
+    const size_t      ncoefs = (size_t)comp->nblocks * DCTSIZE2;
+    size_t            k;
+    mj_quantization_t quantization;
+
+    mj_init_quantization(&quantization, quantval);
+
+    for(k = 0; k < ncoefs; k += DCTSIZE2, b += DCTSIZE2, coefs += DCTSIZE2) {
+        for(i = 0; i < DCTSIZE2; i++) {
+            coefs[i] = mj_quantize_coefficient(b[i], quantization.reciprocal[i]);
+        }
+    }
+
+    q->next = comp->quantized;
+    comp->quantized = q;
+
+    return q->blocks;
+}
+
+mj_block_t *mj_alloc_blocks(int nblocks) {
+    void *blocks = NULL;
+
+    if(nblocks <= 0) {
+        nblocks = 1;
+    }
+
+    if(posix_memalign(&blocks, MJ_BLOCK_ALIGNMENT, (size_t)nblocks * DCTSIZE2 * sizeof(mj_block_t)) != 0) {
+        return NULL;
+    }
+
+    return (mj_block_t *)blocks;
+}
@@ -23,15 +23,90 @@
 #ifndef _LIBMODJPEG_DROPON_H_
 #define _LIBMODJPEG_DROPON_H_
 
+#include <stdatomic.h>
+
+#include "cache.h"
 #include "libmodjpeg.h"
 
-int mj_read_droponimage_from_memory(mj_compileddropon_t *cd, const unsigned char *memory, size_t len);
-int mj_read_droponalpha_from_memory(mj_compileddropon_t *cd, const unsigned char *memory, size_t len);
+// alpha coefficients with a smaller magnitude are considered to be 0
+#define MJ_ALPHA_EPSILON 0.001
+
+// the blocks of a component are aligned to the size of a cache line, which
+// is also the widest SIMD register
+#define MJ_BLOCK_ALIGNMENT 64
+
+#define MJ_BLOCK(comp, n) (&(comp)->blocks[(size_t)(n)*DCTSIZE2])
+
+// the classes of the blocks of a mask
+#define MJ_BLOCK_PARTIAL     0
+#define MJ_BLOCK_TRANSPARENT 1
+#define MJ_BLOCK_OPAQUE      2
+#define MJ_BLOCK_SAMPLES     3
+
+// a block of a mask with at least this many non-zero coefficients is blended in the pixel domain. it
+// holds the samples of the mask (0 to 1) instead of the weights of the coefficients.
+#define MJ_ALPHA_SAMPLES_NONZERO 4
+
+// the DC coefficient of a fully opaque block of a mask
+#define MJ_ALPHA_OPAQUE_DC (DCTSIZE * 255.0)
+
+// the number of quantization tables the blocks of a component are kept quantized for
+#define MJ_QUANTIZED_MAX 4
+
+struct mj_quantized_t {
+    // the quantization table the blocks are quantized with and its hash
+    unsigned long long hash;
+    UINT16             quantval[DCTSIZE2];
 
-int mj_compile_dropon(mj_compileddropon_t *cd, mj_dropon_t *d, J_COLOR_SPACE colorspace, mj_sampling_t *s, int blockoffset_x, int blockoffset_y, int crop_x, int crop_y, int crop_w, int crop_h);
+    // the DCTSIZE2 quantized coefficients of block n start at blocks[n * DCTSIZE2]
+    JCOEF *blocks;
+
+    struct mj_quantized_t *next;
+};
+
+// the maximum number of threads for compiling the layouts of a dropon
+#define MJ_MAX_THREADS 16
+
+// the compiled dropons for a layout that are compiled in parallel
+typedef struct {
+    mj_dropon_t *        d;
+    mj_cachekey_t *      keys;
+    mj_compileddropon_t *compiled;
+    int *                rv;
+    int                  nkeys;
+    int                  nthreads;
+    atomic_int           next;
+} mj_precompilejob_t;
+
+int  mj_compile_dropon(mj_compileddropon_t *cd, mj_dropon_t *d, J_COLOR_SPACE colorspace, mj_sampling_t *s, int blockoffset_x, int blockoffset_y, int crop_x, int crop_y, int crop_w, int crop_h);
+void mj_convert_samples(float *plane, const unsigned char *data, int from_colorspace, J_COLOR_SPACE to_colorspace, int component, size_t nsamples);
+int  mj_alloc_component(mj_component_t *comp, int width, int height, mj_sampling_t *sampling, int component);
+void mj_compile_band(mj_component_t *comp, float *band, int width, int mcu_row, mj_sampling_t *sampling, int level_shift);
+int  mj_copy_component(mj_component_t *dst, mj_component_t *src);
+int  mj_weight_alpha_component(mj_component_t *comp);
+int  mj_compile_cachekey(mj_compileddropon_t *cd, mj_dropon_t *d, mj_cachekey_t *key);
+
+int   mj_precompile_layout(mj_dropon_t *d, J_COLOR_SPACE colorspace, mj_sampling_t *sampling);
+int   mj_precompile_layouts(mj_dropon_t *d);
+void *mj_precompile_thread(void *arg);
+void  mj_reset_dropon(mj_dropon_t *d);
+
+JCOEF *mj_find_quantized(const mj_component_t *comp, const UINT16 *quantval);
+JCOEF *mj_quantize_component(mj_component_t *comp, UINT16 *quantval);
 
 void mj_free_compileddropon(mj_compileddropon_t *cd);
+void mj_free_compileddropon_derived(mj_compileddropon_t *cd);
 void mj_free_component(mj_component_t *c);
+void mj_free_quantized(mj_component_t *c);
+
+mj_block_t *mj_alloc_blocks(int nblocks);
+
+size_t mj_compileddropon_size(mj_compileddropon_t *cd);
+size_t mj_compileddropon_derived_size(mj_compileddropon_t *cd);
+size_t mj_component_size(mj_component_t *c);
+size_t mj_blocks_size(mj_component_t *c);
+size_t mj_maskinfo_size(mj_component_t *c);
+size_t mj_derived_size(mj_component_t *c);
 
 int mj_read_dropon_from_jpeg_memory(mj_dropon_t *d, const unsigned char *memory, size_t len, const unsigned char *maskmemory, size_t masklen, short blend);
 #ifdef WITH_LIBPNG
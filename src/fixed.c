@@ -0,0 +1,603 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "fixed.h"
+#include "dct.h"
+#include "dropon.h"
+
+#include "libmodjpeg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MJ_CONVOLVE_X86
+#    include <immintrin.h>
+#endif
+
+// the kernel for the CPU, selected when the library is loaded
+static void (*mj_blend_block_uniform_fixed_kernel)(JCOEFPTR coefs, int16_t *imageblock, int alpha, const mj_fixedquantization_t *q) = mj_blend_block_uniform_fixed_scalar;
+static void (*mj_blend_blocks_samples_fixed_kernel)(JCOEFPTR *coefs, int16_t **imageblocks, int16_t **alphablocks, int nblocks, const mj_fixedquantization_t *q) = mj_blend_blocks_samples_fixed_scalar;
+
+// mj_idct_prescale in Q15 with the factor 4 from Q1 to Q3
+static const int16_t mj_fixed_idct_prescale[DCTSIZE2] = {
+    16384, 22725, 21407, 19266, 16384, 12873, 8867,  4520,
+    22725, 31521, 29692, 26722, 22725, 17855, 12299, 6270,
+    21407, 29692, 27969, 25172, 21407, 16819, 11585, 5906,
+    19266, 26722, 25172, 22654, 19266, 15137, 10426, 5315,
+    16384, 22725, 21407, 19266, 16384, 12873, 8867,  4520,
+    12873, 17855, 16819, 15137, 12873, 10114, 6967,  3552,
+    8867,  12299, 11585, 10426, 8867,  6967,  4799,  2446,
+    4520,  6270,  5906,  5315,  4520,  3552,  2446,  1247,
+};
+
+// mj_fdct_descale for one pass, i.e. 1 / (s(k) * sqrt(8)), in Q15 with the factor 1/2 from Q3 to Q1
+static const int16_t mj_fixed_fdct_descale[DCTSIZE] = {5793, 4176, 4433, 4926, 5793, 7373, 10703, 20995};
+
+#ifdef MJ_CONVOLVE_X86
+static void mj_init_fixed(void) __attribute__((constructor));
+
+static void mj_init_fixed(void) {
+    mj_select_fixed_kernels(1);
+
+    return;
+}
+#endif
+
+// select the fastest kernels the CPU supports, or the scalar kernels if simd is 0, see mj_select_convolve_kernels()
+void mj_select_fixed_kernels(int simd) {
+    mj_blend_block_uniform_fixed_kernel = mj_blend_block_uniform_fixed_scalar;
+    mj_blend_blocks_samples_fixed_kernel = mj_blend_blocks_samples_fixed_scalar;
+
+#ifdef MJ_CONVOLVE_X86
+    if(simd == 0) {
+        return;
+    }
+
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2")) {
+        mj_blend_block_uniform_fixed_kernel = mj_blend_block_uniform_fixed_avx2;
+        mj_blend_blocks_samples_fixed_kernel = mj_blend_blocks_samples_fixed_avx2;
+    }
+#endif
+
+    return;
+}
+
+// convert a value to Qbits, rounding half away from zero and saturating to the range of an int16_t
+static int16_t mj_fix_value(float v, int bits) {
+    v *= (float)(1 << bits);
+    v += (v < 0.0f ? -0.5f : 0.5f);
+
+    if(v <= -32768.0f) {
+        return -32768;
+    }
+
+    if(v >= 32767.0f) {
+        return 32767;
+    }
+
+    return (int16_t)v;
+}
+
+int mj_init_fixed_quantization(mj_fixedquantization_t *q, const UINT16 *quantval) {
+    int i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        if(quantval[i] == 0 || quantval[i] > MJ_FIXED_MAX_QUANTVAL) {
+            return 0;
+        }
+
+        // round(2^15 / (2 * quantval))
+        q->quantval[i] = (int16_t)quantval[i];
+        q->reciprocal[i] = (int16_t)(((1 << MJ_FIXED_RECIPROCAL_BITS) + quantval[i]) / (2 * quantval[i]));
+    }
+
+    return 1;
+}
+
+// whether block n of a component is blended in fixed point, see mj_compose_with_mask_layout()
+static int mj_fixed_needed(const mj_component_t *comp, const mj_component_t *alphacomp, int n) {
+    int uniform = (alphacomp->classes[n] == MJ_BLOCK_PARTIAL && alphacomp->nonzero[n] == 1);
+
+    // the blocks of the image are also needed for the opaque blocks, which are blended uniformly with less opacity
+    if(comp->classes == NULL) {
+        return (alphacomp->classes[n] == MJ_BLOCK_OPAQUE || alphacomp->classes[n] == MJ_BLOCK_SAMPLES || uniform != 0);
+    }
+
+    return (comp->classes[n] == MJ_BLOCK_SAMPLES || uniform != 0);
+}
+
+mj_fixed_t *mj_fix_component(mj_component_t *comp, const mj_component_t *alphacomp) {
+    int         n, i, nfixed = 0;
+    int16_t *   f;
+    mj_block_t *b;
+
+    if(comp->fixed != NULL) {
+        return comp->fixed;
+    }
+
+    if(alphacomp->classes == NULL || alphacomp->nblocks != comp->nblocks) {
+        return NULL;
+    }
+
+    for(n = 0; n < comp->nblocks; n++) {
+        nfixed += mj_fixed_needed(comp, alphacomp, n);
+    }
+
+    // the index and the blocks are in the same chunk of memory
+    comp->fixed = (mj_fixed_t *)calloc(1, mj_fixed_size(comp->nblocks, nfixed));
+    if(comp->fixed == NULL) {
+        return NULL;
+    }
+
+    comp->fixed->nblocks = comp->nblocks;
+    comp->fixed->nfixed = nfixed;
+    comp->fixed->index = (int32_t *)(comp->fixed + 1);
+    comp->fixed->blocks = (int16_t *)&comp->fixed->index[comp->nblocks];
+
+    for(n = 0, nfixed = 0; n < comp->nblocks; n++) {
+        if(mj_fixed_needed(comp, alphacomp, n) == 0) {
+            comp->fixed->index[n] = -1;
+            continue;
+        }
+
+        comp->fixed->index[n] = nfixed;
+
+        b = MJ_BLOCK(comp, n);
+        f = &comp->fixed->blocks[(size_t)nfixed * DCTSIZE2];
+
+        nfixed++;
+
+        // the coefficients of the image
+        if(comp->classes == NULL) {
+            for(i = 0; i < DCTSIZE2; i++) {
+                f[i] = mj_fix_value(b[i], MJ_FIXED_IMAGE_BITS);
+            }
+
+            continue;
+        }
+
+        // the samples of a busy mask, see mj_weight_alpha_component()
+        if(comp->classes[n] == MJ_BLOCK_SAMPLES) {
+            for(i = 0; i < DCTSIZE2; i++) {
+                f[i] = mj_fix_value(b[i], MJ_FIXED_SAMPLES_BITS);
+
+                if(f[i] < 0) {
+                    f[i] = 0;
+                }
+            }
+
+            continue;
+        }
+
+        // the value of a uniform mask, the DC coefficient is alpha / 1020
+        f[0] = mj_fix_value(b[0] * 4.0f, MJ_FIXED_UNIFORM_BITS);
+
+        if(f[0] < 1) {
+            f[0] = 1;
+        }
+    }
+
+    return comp->fixed;
+}
+
+size_t mj_fixed_size(int nblocks, int nfixed) {
+    return sizeof(mj_fixed_t) + (size_t)nblocks * sizeof(int32_t) + ((size_t)nfixed * DCTSIZE2 + 1) * sizeof(int16_t);
+}
+
+void mj_scale_block_fixed(int16_t *y, const int16_t *x, int scale) {
+    int i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        y[i] = (int16_t)mj_scale_fixed(x[i], scale);
+    }
+
+    return;
+}
+
+void mj_shift_block_fixed(int16_t *y, const int16_t *x, int dc) {
+    int v;
+
+    memcpy(y, x, DCTSIZE2 * sizeof(int16_t));
+
+    v = x[0] + dc;
+
+    if(v > INT16_MAX) {
+        v = INT16_MAX;
+    }
+    else if(v < INT16_MIN) {
+        v = INT16_MIN;
+    }
+
+    y[0] = (int16_t)v;
+
+    return;
+}
+
+void mj_free_fixed(mj_component_t *c) {
+    if(c == NULL) {
+        return;
+    }
+
+    if(c->fixed != NULL) {
+        free(c->fixed);
+        c->fixed = NULL;
+    }
+
+    return;
+}
+
+void mj_blend_block_uniform_fixed(JCOEFPTR coefs, int16_t *imageblock, int alpha, const mj_fixedquantization_t *q) {
+    mj_blend_block_uniform_fixed_kernel(coefs, imageblock, alpha, q);
+
+    return;
+}
+
+// y = x1 + a * (x0 - x1) = x1 * (1 - a) + x0 * a with x0 and x1 in Q1 and a in Q15, from 0 to 32768
+void mj_blend_block_uniform_fixed_scalar(JCOEFPTR coefs, int16_t *imageblock, int alpha, const mj_fixedquantization_t *q) {
+    int x1, y, i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        x1 = (coefs[i] * q->quantval[i]) << MJ_FIXED_IMAGE_BITS;
+        y = (x1 * ((1 << MJ_FIXED_UNIFORM_BITS) - alpha) + imageblock[i] * alpha + (1 << (MJ_FIXED_UNIFORM_BITS - 1))) >> MJ_FIXED_UNIFORM_BITS;
+        coefs[i] = mj_quantize_fixed(y, q->reciprocal[i]);
+    }
+
+    return;
+}
+
+#ifdef MJ_CONVOLVE_X86
+
+// quantize 8 coefficients in Q1 with the reciprocals in the lower halves of the lanes, like mj_quantize_fixed()
+static inline __attribute__((target("avx2"))) __m256i mj_quantize_fixed_avx2(__m256i v, __m256i reciprocal) {
+    __m256i n;
+
+    // the magnitude of -32768 doesn't fit into a signed 16 bit multiplication
+    n = _mm256_mullo_epi32(_mm256_abs_epi32(v), reciprocal);
+    n = _mm256_srai_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(1 << (MJ_FIXED_RECIPROCAL_BITS - 1))), MJ_FIXED_RECIPROCAL_BITS);
+
+    return _mm256_sign_epi32(n, v);
+}
+
+// 16 coefficients at once. the interleaved pairs (x1, x0) are multiplied with the pair (1 - a, a) and summed
+// with one pmaddwd. the weights are signed 16 bit, i.e. 0 and 1 in Q15 don't fit. an even alpha is halved
+// and the sum is shifted by one bit less, which gives exactly the same result for all alpha from 0 to 1.
+__attribute__((target("avx2"))) void mj_blend_block_uniform_fixed_avx2(JCOEFPTR coefs, int16_t *imageblock, int alpha, const mj_fixedquantization_t *q) {
+    __m256i x1, x0, r, lo, hi;
+    int     i, bits = MJ_FIXED_UNIFORM_BITS;
+
+    if((alpha & 1) == 0) {
+        alpha >>= 1;
+        bits--;
+    }
+
+    const __m256i weights = _mm256_set1_epi32((alpha << 16) | ((1 << bits) - alpha));
+    const __m256i round = _mm256_set1_epi32(1 << (bits - 1));
+    const __m128i shift = _mm_cvtsi32_si128(bits);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for(i = 0; i < DCTSIZE2; i += 16) {
+        x1 = _mm256_mullo_epi16(_mm256_loadu_si256((const __m256i *)&coefs[i]), _mm256_loadu_si256((const __m256i *)&q->quantval[i]));
+        x1 = _mm256_slli_epi16(x1, MJ_FIXED_IMAGE_BITS);
+        x0 = _mm256_loadu_si256((const __m256i *)&imageblock[i]);
+        r = _mm256_loadu_si256((const __m256i *)&q->reciprocal[i]);
+
+        lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(x1, x0), weights);
+        hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(x1, x0), weights);
+
+        lo = _mm256_sra_epi32(_mm256_add_epi32(lo, round), shift);
+        hi = _mm256_sra_epi32(_mm256_add_epi32(hi, round), shift);
+
+        // the unpacking and packing within the lanes cancel each other out
+        lo = mj_quantize_fixed_avx2(lo, _mm256_unpacklo_epi16(r, zero));
+        hi = mj_quantize_fixed_avx2(hi, _mm256_unpackhi_epi16(r, zero));
+
+        _mm256_storeu_si256((__m256i *)&coefs[i], _mm256_packs_epi32(lo, hi));
+    }
+
+    return;
+}
+
+#endif
+
+void mj_blend_blocks_samples_fixed(JCOEFPTR *coefs, int16_t **imageblocks, int16_t **alphablocks, int nblocks, const mj_fixedquantization_t *q) {
+    mj_blend_blocks_samples_fixed_kernel(coefs, imageblocks, alphablocks, nblocks, q);
+
+    return;
+}
+
+void mj_blend_blocks_samples_fixed_scalar(JCOEFPTR *coefs, int16_t **imageblocks, int16_t **alphablocks, int nblocks, const mj_fixedquantization_t *q) {
+    int b;
+
+    for(b = 0; b < nblocks; b++) {
+        mj_blend_block_samples_fixed_scalar(coefs[b], imageblocks[b], alphablocks[b], q);
+    }
+
+    return;
+}
+
+// the same as mj_blend_block_samples_scalar() in 16 bit fixed point. the difference is transformed in Q3 and the
+// coefficients are descaled after each pass of the forward transform, such that all values fit into 16 bits.
+void mj_blend_block_samples_fixed_scalar(JCOEFPTR coefs, int16_t *imageblock, int16_t *alphablock, const mj_fixedquantization_t *q) {
+    int x1[DCTSIZE2], d[DCTSIZE2];
+    int i;
+
+    // x = x0 - x1
+    for(i = 0; i < DCTSIZE2; i++) {
+        x1[i] = (coefs[i] * q->quantval[i]) << MJ_FIXED_IMAGE_BITS;
+        d[i] = mj_fixed_mul(imageblock[i] - x1[i], mj_fixed_idct_prescale[i]);
+    }
+
+    // y' = w * x
+    for(i = 0; i < DCTSIZE; i++) {
+        mj_idct_fixed_1d(&d[i], DCTSIZE);
+    }
+
+    for(i = 0; i < DCTSIZE2; i += DCTSIZE) {
+        mj_idct_fixed_1d(&d[i], 1);
+    }
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        d[i] = mj_fixed_mul(d[i], alphablock[i]);
+
+        if(d[i] > MJ_FIXED_MAX_DIFFERENCE) {
+            d[i] = MJ_FIXED_MAX_DIFFERENCE;
+        }
+        else if(d[i] < -MJ_FIXED_MAX_DIFFERENCE) {
+            d[i] = -MJ_FIXED_MAX_DIFFERENCE;
+        }
+    }
+
+    for(i = 0; i < DCTSIZE2; i += DCTSIZE) {
+        mj_fdct_fixed_1d(&d[i], 1);
+    }
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        d[i] = mj_fixed_mul(d[i], mj_fixed_fdct_descale[i % DCTSIZE]);
+    }
+
+    for(i = 0; i < DCTSIZE; i++) {
+        mj_fdct_fixed_1d(&d[i], DCTSIZE);
+    }
+
+    // y = x1 + y', quantized
+    for(i = 0; i < DCTSIZE2; i++) {
+        d[i] = mj_fixed_mul(d[i], mj_fixed_fdct_descale[i / DCTSIZE]);
+        coefs[i] = mj_quantize_fixed(x1[i] + d[i], q->reciprocal[i]);
+    }
+
+    return;
+}
+
+#ifdef MJ_CONVOLVE_X86
+
+// mj_fdct_fixed_1d() on all columns of the block at once
+static inline __attribute__((target("avx2"))) void mj_fdct_fixed_1d_avx2(__m256i *d) {
+    __m256i tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    __m256i tmp10, tmp11, tmp12, tmp13;
+    __m256i z1, z2, z3, z4, z5, z11, z13;
+
+    tmp0 = _mm256_add_epi16(d[0], d[7]);
+    tmp7 = _mm256_sub_epi16(d[0], d[7]);
+    tmp1 = _mm256_add_epi16(d[1], d[6]);
+    tmp6 = _mm256_sub_epi16(d[1], d[6]);
+    tmp2 = _mm256_add_epi16(d[2], d[5]);
+    tmp5 = _mm256_sub_epi16(d[2], d[5]);
+    tmp3 = _mm256_add_epi16(d[3], d[4]);
+    tmp4 = _mm256_sub_epi16(d[3], d[4]);
+
+    // even part
+    tmp10 = _mm256_add_epi16(tmp0, tmp3);
+    tmp13 = _mm256_sub_epi16(tmp0, tmp3);
+    tmp11 = _mm256_add_epi16(tmp1, tmp2);
+    tmp12 = _mm256_sub_epi16(tmp1, tmp2);
+
+    d[0] = _mm256_add_epi16(tmp10, tmp11);
+    d[4] = _mm256_sub_epi16(tmp10, tmp11);
+
+    z1 = _mm256_mulhrs_epi16(_mm256_add_epi16(tmp12, tmp13), _mm256_set1_epi16(MJ_FIX_0_707106781));
+    d[2] = _mm256_add_epi16(tmp13, z1);
+    d[6] = _mm256_sub_epi16(tmp13, z1);
+
+    // odd part
+    tmp10 = _mm256_add_epi16(tmp4, tmp5);
+    tmp11 = _mm256_add_epi16(tmp5, tmp6);
+    tmp12 = _mm256_add_epi16(tmp6, tmp7);
+
+    z5 = _mm256_mulhrs_epi16(_mm256_sub_epi16(tmp10, tmp12), _mm256_set1_epi16(MJ_FIX_0_382683433));
+    z2 = _mm256_add_epi16(_mm256_mulhrs_epi16(tmp10, _mm256_set1_epi16(MJ_FIX_0_541196100)), z5);
+    z4 = _mm256_add_epi16(_mm256_add_epi16(tmp12, _mm256_mulhrs_epi16(tmp12, _mm256_set1_epi16(MJ_FIX_0_306562965))), z5);
+    z3 = _mm256_mulhrs_epi16(tmp11, _mm256_set1_epi16(MJ_FIX_0_707106781));
+
+    z11 = _mm256_add_epi16(tmp7, z3);
+    z13 = _mm256_sub_epi16(tmp7, z3);
+
+    d[5] = _mm256_add_epi16(z13, z2);
+    d[3] = _mm256_sub_epi16(z13, z2);
+    d[1] = _mm256_add_epi16(z11, z4);
+    d[7] = _mm256_sub_epi16(z11, z4);
+
+    return;
+}
+
+// mj_idct_fixed_1d() on all columns of the block at once
+static inline __attribute__((target("avx2"))) void mj_idct_fixed_1d_avx2(__m256i *d) {
+    __m256i tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    __m256i tmp10, tmp11, tmp12, tmp13;
+    __m256i z5, z10, z11, z12, z13;
+
+    // even part
+    tmp10 = _mm256_add_epi16(d[0], d[4]);
+    tmp11 = _mm256_sub_epi16(d[0], d[4]);
+
+    tmp13 = _mm256_add_epi16(d[2], d[6]);
+    tmp12 = _mm256_sub_epi16(d[2], d[6]);
+    tmp12 = _mm256_sub_epi16(_mm256_add_epi16(tmp12, _mm256_mulhrs_epi16(tmp12, _mm256_set1_epi16(MJ_FIX_0_414213562))), tmp13);
+
+    tmp0 = _mm256_add_epi16(tmp10, tmp13);
+    tmp3 = _mm256_sub_epi16(tmp10, tmp13);
+    tmp1 = _mm256_add_epi16(tmp11, tmp12);
+    tmp2 = _mm256_sub_epi16(tmp11, tmp12);
+
+    // odd part
+    z13 = _mm256_add_epi16(d[5], d[3]);
+    z10 = _mm256_sub_epi16(d[5], d[3]);
+    z11 = _mm256_add_epi16(d[1], d[7]);
+    z12 = _mm256_sub_epi16(d[1], d[7]);
+
+    tmp7 = _mm256_add_epi16(z11, z13);
+    tmp11 = _mm256_sub_epi16(z11, z13);
+    tmp11 = _mm256_add_epi16(tmp11, _mm256_mulhrs_epi16(tmp11, _mm256_set1_epi16(MJ_FIX_0_414213562)));
+
+    z5 = _mm256_add_epi16(z10, z12);
+    z5 = _mm256_add_epi16(z5, _mm256_mulhrs_epi16(z5, _mm256_set1_epi16(MJ_FIX_0_847759065)));
+    tmp10 = _mm256_sub_epi16(_mm256_add_epi16(z12, _mm256_mulhrs_epi16(z12, _mm256_set1_epi16(MJ_FIX_0_082392200))), z5);
+    tmp12 = _mm256_sub_epi16(_mm256_sub_epi16(_mm256_sub_epi16(z5, z10), z10), _mm256_mulhrs_epi16(z10, _mm256_set1_epi16(MJ_FIX_0_613125930)));
+
+    tmp6 = _mm256_sub_epi16(tmp12, tmp7);
+    tmp5 = _mm256_sub_epi16(tmp11, tmp6);
+    tmp4 = _mm256_add_epi16(tmp10, tmp5);
+
+    d[0] = _mm256_add_epi16(tmp0, tmp7);
+    d[7] = _mm256_sub_epi16(tmp0, tmp7);
+    d[1] = _mm256_add_epi16(tmp1, tmp6);
+    d[6] = _mm256_sub_epi16(tmp1, tmp6);
+    d[2] = _mm256_add_epi16(tmp2, tmp5);
+    d[5] = _mm256_sub_epi16(tmp2, tmp5);
+    d[4] = _mm256_add_epi16(tmp3, tmp4);
+    d[3] = _mm256_sub_epi16(tmp3, tmp4);
+
+    return;
+}
+
+// transpose the two 8x8 blocks that are given as 8 rows, one block in each 128 bit lane
+static inline __attribute__((target("avx2"))) void mj_transpose_fixed_avx2(__m256i *d) {
+    __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+    __m256i s0, s1, s2, s3, s4, s5, s6, s7;
+
+    t0 = _mm256_unpacklo_epi16(d[0], d[1]);
+    t1 = _mm256_unpackhi_epi16(d[0], d[1]);
+    t2 = _mm256_unpacklo_epi16(d[2], d[3]);
+    t3 = _mm256_unpackhi_epi16(d[2], d[3]);
+    t4 = _mm256_unpacklo_epi16(d[4], d[5]);
+    t5 = _mm256_unpackhi_epi16(d[4], d[5]);
+    t6 = _mm256_unpacklo_epi16(d[6], d[7]);
+    t7 = _mm256_unpackhi_epi16(d[6], d[7]);
+
+    s0 = _mm256_unpacklo_epi32(t0, t2);
+    s1 = _mm256_unpackhi_epi32(t0, t2);
+    s2 = _mm256_unpacklo_epi32(t1, t3);
+    s3 = _mm256_unpackhi_epi32(t1, t3);
+    s4 = _mm256_unpacklo_epi32(t4, t6);
+    s5 = _mm256_unpackhi_epi32(t4, t6);
+    s6 = _mm256_unpacklo_epi32(t5, t7);
+    s7 = _mm256_unpackhi_epi32(t5, t7);
+
+    d[0] = _mm256_unpacklo_epi64(s0, s4);
+    d[1] = _mm256_unpackhi_epi64(s0, s4);
+    d[2] = _mm256_unpacklo_epi64(s1, s5);
+    d[3] = _mm256_unpackhi_epi64(s1, s5);
+    d[4] = _mm256_unpacklo_epi64(s2, s6);
+    d[5] = _mm256_unpackhi_epi64(s2, s6);
+    d[6] = _mm256_unpacklo_epi64(s3, s7);
+    d[7] = _mm256_unpackhi_epi64(s3, s7);
+
+    return;
+}
+
+// one row of each of the two blocks in a register
+static inline __attribute__((target("avx2"))) __m256i mj_load_rows_avx2(const int16_t *a, const int16_t *b) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)a)), _mm_loadu_si128((const __m128i *)b), 1);
+}
+
+// the same row of a table for both blocks
+static inline __attribute__((target("avx2"))) __m256i mj_load_table_avx2(const int16_t *t) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)t));
+}
+
+// the same operations as mj_blend_block_samples_fixed_scalar() on two blocks at once, with one row of each block
+// in a register. the rows are transformed with the blocks transposed.
+static inline __attribute__((target("avx2"))) void mj_blend_samples_fixed_avx2(JCOEFPTR coefs0, JCOEFPTR coefs1, int16_t *image0, int16_t *image1, int16_t *alpha0, int16_t *alpha1, const mj_fixedquantization_t *q) {
+    __m256i x1[DCTSIZE], d[DCTSIZE], w[DCTSIZE];
+    __m256i v;
+    int     r;
+
+    for(r = 0; r < DCTSIZE; r++) {
+        x1[r] = _mm256_mullo_epi16(mj_load_rows_avx2(&coefs0[r * DCTSIZE], &coefs1[r * DCTSIZE]), mj_load_table_avx2(&q->quantval[r * DCTSIZE]));
+        x1[r] = _mm256_slli_epi16(x1[r], MJ_FIXED_IMAGE_BITS);
+        d[r] = _mm256_sub_epi16(mj_load_rows_avx2(&image0[r * DCTSIZE], &image1[r * DCTSIZE]), x1[r]);
+        d[r] = _mm256_mulhrs_epi16(d[r], mj_load_table_avx2(&mj_fixed_idct_prescale[r * DCTSIZE]));
+        w[r] = mj_load_rows_avx2(&alpha0[r * DCTSIZE], &alpha1[r * DCTSIZE]);
+    }
+
+    mj_idct_fixed_1d_avx2(d);
+    mj_transpose_fixed_avx2(d);
+    mj_idct_fixed_1d_avx2(d);
+
+    mj_transpose_fixed_avx2(w);
+
+    for(r = 0; r < DCTSIZE; r++) {
+        d[r] = _mm256_mulhrs_epi16(d[r], w[r]);
+        d[r] = _mm256_max_epi16(_mm256_min_epi16(d[r], _mm256_set1_epi16(MJ_FIXED_MAX_DIFFERENCE)), _mm256_set1_epi16(-MJ_FIXED_MAX_DIFFERENCE));
+    }
+
+    mj_fdct_fixed_1d_avx2(d);
+
+    for(r = 0; r < DCTSIZE; r++) {
+        d[r] = _mm256_mulhrs_epi16(d[r], _mm256_set1_epi16(mj_fixed_fdct_descale[r]));
+    }
+
+    mj_transpose_fixed_avx2(d);
+    mj_fdct_fixed_1d_avx2(d);
+
+    // round half away from zero, like mj_quantize_fixed()
+    for(r = 0; r < DCTSIZE; r++) {
+        d[r] = _mm256_mulhrs_epi16(d[r], _mm256_set1_epi16(mj_fixed_fdct_descale[r]));
+
+        v = _mm256_add_epi16(x1[r], d[r]);
+        v = _mm256_sign_epi16(_mm256_mulhrs_epi16(_mm256_abs_epi16(v), mj_load_table_avx2(&q->reciprocal[r * DCTSIZE])), v);
+
+        _mm_storeu_si128((__m128i *)&coefs0[r * DCTSIZE], _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i *)&coefs1[r * DCTSIZE], _mm256_extracti128_si256(v, 1));
+    }
+
+    return;
+}
+
+// two blocks in the 16 bit lanes of the registers. an odd block is blended together with itself.
+__attribute__((target("avx2"))) void mj_blend_blocks_samples_fixed_avx2(JCOEFPTR *coefs, int16_t **imageblocks, int16_t **alphablocks, int nblocks, const mj_fixedquantization_t *q) {
+    int b;
+
+    for(b = 0; b + 1 < nblocks; b += 2) {
+        mj_blend_samples_fixed_avx2(coefs[b], coefs[b + 1], imageblocks[b], imageblocks[b + 1], alphablocks[b], alphablocks[b + 1], q);
+    }
+
+    if(b < nblocks) {
+        mj_blend_samples_fixed_avx2(coefs[b], coefs[b], imageblocks[b], imageblocks[b], alphablocks[b], alphablocks[b], q);
+    }
+
+    return;
+}
+
+#endif
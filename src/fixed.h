@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _LIBMODJPEG_FIXED_H_
+#define _LIBMODJPEG_FIXED_H_
+
+#include <stdint.h>
+
+#include "convolve.h"
+#include "libmodjpeg.h"
+
+// the fixed-point formats of the blocks for composing in fixed point. a value in Qn is stored as
+// round(value * 2^n) in an int16_t.
+//
+// image component              Q1, the coefficients of a block
+// mask, MJ_BLOCK_SAMPLES       Q15, the samples of the mask (0 to 1, 1 is stored as 32767)
+// mask, only a DC coefficient  Q15, the value of the mask (0 to 1) as the first coefficient
+// reciprocals                  Q15, 1 / (2 * quantval), i.e. for coefficients in Q1
+//
+// all other blocks of a mask are blended in floating point. the difference of the image and the JPEG is
+// transformed with MJ_FIXED_PASS_BITS more fractional bits, i.e. in Q3. the forward transform grows the
+// values by up to 13.3 times, so the weighted difference is limited to MJ_FIXED_MAX_DIFFERENCE (308 per
+// sample) to stay within 16 bits.
+#define MJ_FIXED_IMAGE_BITS      1
+#define MJ_FIXED_SAMPLES_BITS    15
+#define MJ_FIXED_UNIFORM_BITS    15
+#define MJ_FIXED_RECIPROCAL_BITS 15
+#define MJ_FIXED_PASS_BITS       2
+#define MJ_FIXED_MAX_DIFFERENCE  2464
+
+// the largest quantization value that is supported in fixed point, i.e. 8 bit quantization tables
+#define MJ_FIXED_MAX_QUANTVAL 255
+
+// the number of blocks in the pixel domain that the AVX2 kernel blends at once, one in each half of the registers
+#define MJ_FIXED_PAIR 2
+
+// a quantization table prepared for the blending in fixed point
+typedef struct {
+    int16_t quantval[DCTSIZE2];
+    int16_t reciprocal[DCTSIZE2];
+} mj_fixedquantization_t;
+
+// the blocks of a component in fixed point. only the blocks that are blended in fixed point are converted, i.e. the
+// blocks of the image where the mask is not transparent and the blocks of the mask in the pixel domain or with only
+// a DC coefficient. the DCTSIZE2 values of block n start at blocks[index[n] * DCTSIZE2], index[n] is -1 for a block
+// that is not converted.
+struct mj_fixed_t {
+    int      nblocks;
+    int      nfixed;
+    int32_t *index;
+    int16_t *blocks;
+};
+
+// quantize a coefficient in Q1 with the reciprocal of the quantization value, rounding half away from zero
+static inline JCOEF mj_quantize_fixed(int v, int reciprocal) {
+    if(v < 0) {
+        return (JCOEF)(-(((-v) * reciprocal + (1 << (MJ_FIXED_RECIPROCAL_BITS - 1))) >> MJ_FIXED_RECIPROCAL_BITS));
+    }
+
+    return (JCOEF)((v * reciprocal + (1 << (MJ_FIXED_RECIPROCAL_BITS - 1))) >> MJ_FIXED_RECIPROCAL_BITS);
+}
+
+// scale a value of a mask in Q15 with a factor in Q15, e.g. the opacity of the dropon
+static inline int mj_scale_fixed(int v, int scale) {
+    return (v * scale + (1 << (MJ_FIXED_UNIFORM_BITS - 1))) >> MJ_FIXED_UNIFORM_BITS;
+}
+
+// a uniform value of a mask in Q15 that is neither fully transparent nor fully opaque
+static inline int mj_clamp_fixed_alpha(int alpha) {
+    if(alpha < 1) {
+        return 1;
+    }
+
+    if(alpha > (1 << MJ_FIXED_UNIFORM_BITS) - 1) {
+        return (1 << MJ_FIXED_UNIFORM_BITS) - 1;
+    }
+
+    return alpha;
+}
+
+// the blocks of a component in fixed point without creating them, NULL if there are none
+static inline mj_fixed_t *mj_fixed_blocks(const mj_component_t *comp) {
+    return comp->fixed;
+}
+
+// block n of a component in fixed point, which must be one of the converted blocks
+static inline int16_t *mj_fixed_block(const mj_fixed_t *f, size_t n) {
+    return &f->blocks[(size_t)f->index[n] * DCTSIZE2];
+}
+
+void     mj_select_fixed_kernels(int simd);
+int      mj_init_fixed_quantization(mj_fixedquantization_t *q, const UINT16 *quantval);
+mj_fixed_t *mj_fix_component(mj_component_t *comp, const mj_component_t *alphacomp);
+size_t      mj_fixed_size(int nblocks, int nfixed);
+void     mj_scale_block_fixed(int16_t *y, const int16_t *x, int scale);
+void     mj_shift_block_fixed(int16_t *y, const int16_t *x, int dc);
+void     mj_free_fixed(mj_component_t *c);
+
+void mj_blend_block_uniform_fixed(JCOEFPTR coefs, int16_t *imageblock, int alpha, const mj_fixedquantization_t *q);
+void mj_blend_block_uniform_fixed_scalar(JCOEFPTR coefs, int16_t *imageblock, int alpha, const mj_fixedquantization_t *q);
+#ifdef MJ_CONVOLVE_X86
+void mj_blend_block_uniform_fixed_avx2(JCOEFPTR coefs, int16_t *imageblock, int alpha, const mj_fixedquantization_t *q);
+#endif
+
+void mj_blend_block_samples_fixed_scalar(JCOEFPTR coefs, int16_t *imageblock, int16_t *alphablock, const mj_fixedquantization_t *q);
+
+void mj_blend_blocks_samples_fixed(JCOEFPTR *coefs, int16_t **imageblocks, int16_t **alphablocks, int nblocks, const mj_fixedquantization_t *q);
+void mj_blend_blocks_samples_fixed_scalar(JCOEFPTR *coefs, int16_t **imageblocks, int16_t **alphablocks, int nblocks, const mj_fixedquantization_t *q);
+#ifdef MJ_CONVOLVE_X86
+void mj_blend_blocks_samples_fixed_avx2(JCOEFPTR *coefs, int16_t **imageblocks, int16_t **alphablocks, int nblocks, const mj_fixedquantization_t *q);
+#endif
+
+#endif
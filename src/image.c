@@ -242,108 +242,31 @@ void mj_init_jpeg(mj_jpeg_t *m) {
     return;
 }
 
-void mj_free_jpeg(mj_jpeg_t *m) {
+void mj_set_jpeg_threads(mj_jpeg_t *m, int nthreads) {
     if(m == NULL) {
         return;
     }
 
-    jpeg_destroy_decompress(&m->cinfo);
-
-    mj_init_jpeg(m);
+    m->nthreads = (nthreads > 1 ? nthreads : 1);
 
     return;
 }
 
-int mj_encode_raw_to_jpeg_memory(unsigned char **memory, size_t *len, unsigned char *rawdata, int colorspace, J_COLOR_SPACE jpeg_colorspace, mj_sampling_t *s, int width, int height) {
-    struct jpeg_compress_struct cinfo;
-    struct mj_jpeg_error_mgr    jerr;
-    struct mj_jpeg_dest_mgr     dest;
-    char                        jpegerrorbuffer[JMSG_LENGTH_MAX];
-
-    cinfo.err = jpeg_std_error(&jerr.pub);
-    jerr.pub.error_exit = mj_jpeg_error_exit;
-    if(setjmp(jerr.setjmp_buffer)) {
-        (*cinfo.err->format_message)((j_common_ptr)&cinfo, jpegerrorbuffer);
-        jpeg_destroy_compress(&cinfo);
-        if(dest.buf != NULL) {
-            free(dest.buf);
-        }
-
-        return MJ_ERR_ENCODE_JPEG;
-    }
-
-    jpeg_create_compress(&cinfo);
-
-    cinfo.dest = &dest.pub;
-    dest.buf = NULL;
-    dest.size = 0;
-    dest.pub.init_destination = mj_jpeg_init_destination;
-    dest.pub.empty_output_buffer = mj_jpeg_empty_output_buffer;
-    dest.pub.term_destination = mj_jpeg_term_destination;
-
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-
-    if(colorspace == MJ_COLORSPACE_RGB) {
-        cinfo.input_components = 3;
-        cinfo.in_color_space = JCS_RGB;
-    }
-    else if(colorspace == MJ_COLORSPACE_YCC) {
-        cinfo.input_components = 3;
-        cinfo.in_color_space = JCS_YCbCr;
-    }
-    else if(colorspace == MJ_COLORSPACE_GRAYSCALE) {
-        cinfo.input_components = 1;
-        cinfo.in_color_space = JCS_GRAYSCALE;
-    }
-    else {
-        jpeg_destroy_compress(&cinfo);
-        return MJ_ERR_UNSUPPORTED_COLORSPACE;
-    }
-
-    jpeg_set_defaults(&cinfo);
-
-    jpeg_set_colorspace(&cinfo, jpeg_colorspace);
-
-    cinfo.optimize_coding = FALSE;    // don't optimize
-    cinfo.scan_info = NULL;           // don't create progressive output
-    cinfo.arith_code = FALSE;         // don't do arithmetric coding
-
-    if(colorspace == MJ_COLORSPACE_RGB || colorspace == MJ_COLORSPACE_YCC) {
-        cinfo.comp_info[0].h_samp_factor = s->samp_factor[0].h_samp_factor;
-        cinfo.comp_info[0].v_samp_factor = s->samp_factor[0].v_samp_factor;
-
-        cinfo.comp_info[1].h_samp_factor = s->samp_factor[1].h_samp_factor;
-        cinfo.comp_info[1].v_samp_factor = s->samp_factor[1].v_samp_factor;
-
-        cinfo.comp_info[2].h_samp_factor = s->samp_factor[2].h_samp_factor;
-        cinfo.comp_info[2].v_samp_factor = s->samp_factor[2].v_samp_factor;
-    }
-    else {
-        cinfo.comp_info[0].h_samp_factor = s->samp_factor[0].h_samp_factor;
-        cinfo.comp_info[0].v_samp_factor = s->samp_factor[0].v_samp_factor;
+void mj_free_jpeg(mj_jpeg_t *m) {
+    if(m == NULL) {
+        return;
     }
 
-    jpeg_set_quality(&cinfo, 100, TRUE);
-
-    jpeg_start_compress(&cinfo, TRUE);
-
-    int row_stride = cinfo.image_width * cinfo.input_components;
+    // the number of threads is kept for the next image
+    int nthreads = m->nthreads;
 
-    JSAMPROW row_pointer[1];
-
-    while(cinfo.next_scanline < cinfo.image_height) {
-        row_pointer[0] = &rawdata[cinfo.next_scanline * row_stride];
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
-    }
+    jpeg_destroy_decompress(&m->cinfo);
 
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
+    mj_init_jpeg(m);
 
-    *memory = (unsigned char *)dest.buf;
-    *len = dest.size;
+    m->nthreads = nthreads;
 
-    return MJ_OK;
+    return;
 }
 
 int mj_decode_jpeg_file_to_raw(unsigned char **rawdata, int *width, int *height, int want_colorspace, const char *filename) {
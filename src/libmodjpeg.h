@@ -26,14 +26,15 @@
 // clang-format off
 // The stdio.h header must be before jpeglib.h, otherwise the compiler
 // complains about a missing definition of size_t
+#include <stdint.h>
 #include <stdio.h>
 #include <jpeglib.h>
 // clang-format on
 
-#define MJ_LIB_VERSION_MAJOR   1
+#define MJ_LIB_VERSION_MAJOR   2
 #define MJ_LIB_VERSION_MINOR   0
 #define MJ_LIB_VERSION_RELEASE 0
-#define MJ_LIB_VERSION         10000
+#define MJ_LIB_VERSION         20000
 
 #define MJ_COLORSPACE_RGB        1
 #define MJ_COLORSPACE_RGBA       2
@@ -52,6 +53,12 @@
 #define MJ_BLEND_NONE       0
 #define MJ_BLEND_FULL       255
 
+#define MJ_CACHE_DEFAULT_SIZE (8 * 1024 * 1024)
+
+#define MJ_REGISTRY_DEFAULT_SIZE (64 * 1024 * 1024)
+
+#define MJ_MAX_LAYOUTS 8
+
 #define MJ_OPTION_NONE        0
 #define MJ_OPTION_OPTIMIZE    (1 << 0)
 #define MJ_OPTION_PROGRESSIVE (1 << 1)
@@ -85,6 +92,12 @@ typedef struct {
 
 typedef float mj_block_t;
 
+// the blocks of a component quantized for one quantization table, see dropon.h
+typedef struct mj_quantized_t mj_quantized_t;
+
+// the blocks of a component in fixed point, see fixed.h
+typedef struct mj_fixed_t mj_fixed_t;
+
 typedef struct {
     int width_in_blocks;
     int height_in_blocks;
@@ -92,8 +105,26 @@ typedef struct {
     int h_samp_factor;
     int v_samp_factor;
 
-    int          nblocks;
-    mj_block_t **blocks;
+    // the blocks are stored row by row in one chunk of memory, i.e. the
+    // DCTSIZE2 coefficients of block n start at blocks[n * DCTSIZE2]
+    int         nblocks;
+    mj_block_t *blocks;
+
+    // the non-zero coefficients of each block of a mask as a set of bits, i.e. bit i
+    // is set if coefficient i is not 0. NULL for the image components.
+    unsigned long long *nonzero;
+
+    // the class of each block of a mask, i.e. whether it is fully transparent,
+    // fully opaque or something in between. NULL for the image components. the
+    // classes follow the non-zero coefficients in the same chunk of memory.
+    unsigned char *classes;
+
+    // the blocks quantized for the most recently used quantization tables
+    mj_quantized_t *quantized;
+
+    // the blocks in fixed point for mj_set_dropon_fixed_point(), see fixed.h. NULL until
+    // they are needed.
+    mj_fixed_t *fixed;
 } mj_component_t;
 
 typedef struct {
@@ -104,8 +135,37 @@ typedef struct {
     int height;
 
     mj_sampling_t sampling;
+
+    // the number of threads a dropon is composed with
+    int nthreads;
 } mj_jpeg_t;
 
+typedef struct {
+    int             image_ncomponents;
+    int             image_colorspace;
+    mj_component_t *image;
+
+    int             alpha_ncomponents;
+    mj_component_t *alpha;
+
+    // the blocks are not owned by the compiled dropon, e.g. because they are in a mapped file
+    int shared;
+} mj_compileddropon_t;
+
+// the compiled dropons of a dropon, see cache.h
+typedef struct mj_cache_t mj_cache_t;
+
+typedef struct {
+    // the shared memory segment, mapped at a different address in each process
+    void * base;
+    size_t size;
+} mj_registry_t;
+
+typedef struct {
+    J_COLOR_SPACE colorspace;
+    mj_sampling_t sampling;
+} mj_layout_t;
+
 typedef struct {
     unsigned char *image;
     unsigned char *alpha;
@@ -115,27 +175,107 @@ typedef struct {
     int colorspace;
 
     int blend;
+
+    // the cache is created when the first compiled dropon is put into it
+    mj_cache_t *cache;
+    size_t      cache_max_size;
+
+    // a compiled dropon file the image, the alpha, and the blocks of
+    // the pinned compiled dropons are pointing into
+    void * mapping;
+    size_t mapping_size;
+    int    mapped;
+
+    // the registry the compiled dropons are shared with other processes and the
+    // fingerprint of the dropon in the registry. 0 if not yet calculated.
+    mj_registry_t *    registry;
+    unsigned long long registry_id;
+
+    // the layouts of the images the dropon is compiled for as soon as it is loaded
+    mj_layout_t layouts[MJ_MAX_LAYOUTS];
+    int         nlayouts;
+
+    // whether the blocks are blended in fixed point
+    int fixed_point;
 } mj_dropon_t;
 
+// a dropon compiled for its position on an image, see mj_compile_dropon_for()
 typedef struct {
-    int             image_ncomponents;
-    int             image_colorspace;
-    mj_component_t *image;
+    mj_compileddropon_t  compiled;
+    mj_compileddropon_t *cd;
 
-    int             alpha_ncomponents;
-    mj_component_t *alpha;
-} mj_compileddropon_t;
+    // the colorspace, the sampling, and the size of the image the dropon is compiled for
+    J_COLOR_SPACE colorspace;
+    mj_sampling_t sampling;
+    int           width;
+    int           height;
+
+    // the first block of the image and the part of the compiled dropon in MCUs that is composed
+    int block_x;
+    int block_y;
+    int mcu_x;
+    int mcu_y;
+    int mcu_w;
+    int mcu_h;
+
+    int fixed_point;
+} mj_placeddropon_t;
+
+typedef struct {
+    mj_dropon_t *dropon;
+    unsigned int align;
+    int          offset_x;
+    int          offset_y;
+} mj_placement_t;
+
+// the parameters of a composition that are applied while blending, i.e. without compiling the dropon again.
+// initialize them with mj_init_composeoptions(). zeroed options have an opacity of MJ_BLEND_NONE, i.e. the
+// dropon is not composed at all.
+typedef struct {
+    // the opacity of the dropon from MJ_BLEND_NONE to MJ_BLEND_FULL, multiplied with the mask of the dropon
+    int opacity;
+
+    // the values that are added to the DC coefficients of the dropon, i.e. 8 per step of a sample. the
+    // luminance is used for YCbCr and grayscale images, cb_value and cr_value only for YCbCr images.
+    int luminance;
+    int cb_value;
+    int cr_value;
+} mj_composeoptions_t;
 
 void mj_init_dropon(mj_dropon_t *d);
 int  mj_read_dropon_from_raw(mj_dropon_t *d, const unsigned char *rawdata, unsigned int colorspace, int width, int height, short blend);
 int  mj_read_dropon_from_memory(mj_dropon_t *d, const unsigned char *memory, size_t len, const unsigned char *maskmemory, size_t masklen, short blend);
 int  mj_read_dropon_from_file(mj_dropon_t *d, const char *filename, const char *maskfilename, short blend);
+void mj_set_dropon_cache_size(mj_dropon_t *d, size_t max_size);
+int  mj_precompile_dropon(mj_dropon_t *d, mj_jpeg_t *m);
+int  mj_write_dropon_to_memory(mj_dropon_t *d, unsigned char **memory, size_t *len);
+int  mj_write_dropon_to_file(mj_dropon_t *d, const char *filename);
+void mj_set_dropon_registry(mj_dropon_t *d, mj_registry_t *r);
+void mj_set_dropon_fixed_point(mj_dropon_t *d, int fixed_point);
+int  mj_add_dropon_layout(mj_dropon_t *d, J_COLOR_SPACE colorspace, int h_samp_factor, int v_samp_factor);
+
+int  mj_open_registry(mj_registry_t *r, const char *name, size_t size);
+void mj_close_registry(mj_registry_t *r);
+int  mj_unlink_registry(const char *name);
 
 void mj_init_jpeg(mj_jpeg_t *m);
 int  mj_read_jpeg_from_memory(mj_jpeg_t *m, const unsigned char *memory, size_t len, size_t max_pixel);
 int  mj_read_jpeg_from_file(mj_jpeg_t *m, const char *filename, size_t max_pixel);
+void mj_set_jpeg_threads(mj_jpeg_t *m, int nthreads);
 
 int mj_compose(mj_jpeg_t *m, mj_dropon_t *d, unsigned int align, int offset_x, int offset_y);
+int mj_compose_many(mj_jpeg_t *m, const mj_placement_t *placements, int nplacements);
+int mj_compose_tiled(mj_jpeg_t *m, mj_dropon_t *d, int offset_x, int offset_y, int stride_x, int stride_y);
+
+void mj_init_composeoptions(mj_composeoptions_t *o);
+int  mj_compose_with_options(mj_jpeg_t *m, mj_dropon_t *d, unsigned int align, int offset_x, int offset_y, const mj_composeoptions_t *o);
+int  mj_compose_many_with_options(mj_jpeg_t *m, const mj_placement_t *placements, int nplacements, const mj_composeoptions_t *o);
+int  mj_compose_tiled_with_options(mj_jpeg_t *m, mj_dropon_t *d, int offset_x, int offset_y, int stride_x, int stride_y, const mj_composeoptions_t *o);
+
+int  mj_compile_dropon_for(mj_placeddropon_t *p, mj_dropon_t *d, mj_jpeg_t *m, unsigned int align, int offset_x, int offset_y);
+int  mj_compose_compiled(mj_jpeg_t *m, const mj_placeddropon_t *p);
+int  mj_compose_compiled_with_options(mj_jpeg_t *m, const mj_placeddropon_t *p, const mj_composeoptions_t *o);
+void mj_free_placeddropon(mj_placeddropon_t *p);
 
 int mj_write_jpeg_to_memory(mj_jpeg_t *m, unsigned char **memory, size_t *len, int options);
 int mj_write_jpeg_to_file(mj_jpeg_t *m, char *filename, int options);
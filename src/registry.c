@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "dropon.h"
+#include "libmodjpeg.h"
+#include "registry.h"
+#include "store.h"
+
+static void mj_registry_sleep(void) {
+    struct timespec ts = {0, 1000000};
+
+    nanosleep(&ts, NULL);
+
+    return;
+}
+
+// a clock that is the same for all processes on the machine, in ms
+static uint64_t mj_registry_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+int mj_open_registry(mj_registry_t *r, const char *name, size_t size) {
+    if(r == NULL || name == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    memset(r, 0, sizeof(mj_registry_t));
+
+    if(size == 0) {
+        size = MJ_REGISTRY_DEFAULT_SIZE;
+    }
+
+    if(size < sizeof(mj_registryheader_t) + MJ_BLOCK_ALIGNMENT) {
+        return MJ_ERR_MEMORY;
+    }
+
+    int         fd, created = 1, i;
+    struct stat s;
+
+    // the first process creates the segment, all others open it
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd == -1) {
+        if(errno != EEXIST) {
+            return MJ_ERR_FILEIO;
+        }
+
+        created = 0;
+
+        fd = shm_open(name, O_RDWR, 0);
+        if(fd == -1) {
+            return MJ_ERR_FILEIO;
+        }
+    }
+
+    if(created == 1) {
+        if(ftruncate(fd, (off_t)size) != 0) {
+            close(fd);
+            shm_unlink(name);
+
+            return MJ_ERR_MEMORY;
+        }
+    }
+    else {
+        // the creating process may not have resized the segment yet
+        for(i = 0; i < MJ_REGISTRY_WAIT; i++) {
+            if(fstat(fd, &s) != 0) {
+                close(fd);
+                return MJ_ERR_FILEIO;
+            }
+
+            if(s.st_size != 0) {
+                break;
+            }
+
+            mj_registry_sleep();
+        }
+
+        if((size_t)s.st_size < sizeof(mj_registryheader_t)) {
+            close(fd);
+            return MJ_ERR_FILEIO;
+        }
+
+        size = (size_t)s.st_size;
+    }
+
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if(base == MAP_FAILED) {
+        if(created == 1) {
+            shm_unlink(name);
+        }
+
+        return MJ_ERR_MEMORY;
+    }
+
+    mj_registryheader_t *header = (mj_registryheader_t *)base;
+
+    if(created == 1) {
+        // the segment is filled with zeros, i.e. all slots are empty
+        memcpy(header->magic, MJ_REGISTRY_MAGIC, sizeof(header->magic));
+        header->version = MJ_REGISTRY_VERSION;
+        header->byteorder = MJ_STORE_BYTEORDER;
+        header->nslots = MJ_REGISTRY_NSLOTS;
+        header->size = size;
+        header->data_offset = mj_store_align(sizeof(mj_registryheader_t));
+
+        atomic_store_explicit(&header->used, header->data_offset, memory_order_relaxed);
+        atomic_store_explicit(&header->ready, 1, memory_order_release);
+    }
+    else {
+        for(i = 0; i < MJ_REGISTRY_WAIT; i++) {
+            if(atomic_load_explicit(&header->ready, memory_order_acquire) != 0) {
+                break;
+            }
+
+            mj_registry_sleep();
+        }
+
+        if(i == MJ_REGISTRY_WAIT || memcmp(header->magic, MJ_REGISTRY_MAGIC, sizeof(header->magic)) != 0 || header->version != MJ_REGISTRY_VERSION || header->byteorder != MJ_STORE_BYTEORDER || header->nslots != MJ_REGISTRY_NSLOTS || header->size != size) {
+            munmap(base, size);
+            return MJ_ERR_UNSUPPORTED_FILETYPE;
+        }
+    }
+
+    r->base = base;
+    r->size = size;
+
+    return MJ_OK;
+}
+
+void mj_close_registry(mj_registry_t *r) {
+    if(r == NULL) {
+        return;
+    }
+
+    if(r->base != NULL) {
+        munmap(r->base, r->size);
+    }
+
+    memset(r, 0, sizeof(mj_registry_t));
+
+    return;
+}
+
+int mj_unlink_registry(const char *name) {
+    if(name == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    if(shm_unlink(name) != 0) {
+        return MJ_ERR_FILEIO;
+    }
+
+    return MJ_OK;
+}
+
+int mj_registry_compile(mj_registry_t *r, mj_compileddropon_t *cd, mj_dropon_t *d, mj_cachekey_t *key) {
+    mj_registryheader_t *header = (mj_registryheader_t *)r->base;
+    mj_registryslot_t *  slot;
+    uint64_t             hash, tag, state, expected, since;
+    unsigned int         n;
+
+    if(d->registry_id == 0) {
+        d->registry_id = mj_registry_dropon_id(d);
+    }
+
+    hash = mj_hash(d->registry_id, key, sizeof(mj_cachekey_t));
+
+    tag = hash & ~MJ_REGISTRY_STATE_MASK;
+    if(tag == 0) {
+        tag = MJ_REGISTRY_STATE_MASK + 1;
+    }
+
+    // open addressing with linear probing. slots are never removed.
+    for(n = 0; n < MJ_REGISTRY_NSLOTS; n++) {
+        slot = &header->slots[(hash + n) % MJ_REGISTRY_NSLOTS];
+
+        state = atomic_load_explicit(&slot->state, memory_order_acquire);
+
+        if(state == MJ_REGISTRY_EMPTY) {
+            // a full segment has no room for the blocks of another slot
+            if(atomic_load_explicit(&header->full, memory_order_relaxed) != 0) {
+                break;
+            }
+
+            expected = MJ_REGISTRY_EMPTY;
+
+            if(atomic_compare_exchange_strong_explicit(&slot->state, &expected, tag | MJ_REGISTRY_BUSY, memory_order_acq_rel, memory_order_acquire) != 0) {
+                atomic_store_explicit(&slot->claimed, mj_registry_now(), memory_order_relaxed);
+                atomic_store_explicit(&slot->owner, (int32_t)getpid(), memory_order_release);
+
+                return mj_registry_publish(r, slot, tag, cd, d, key);
+            }
+
+            // another process was faster
+            state = expected;
+        }
+
+        if((state & ~MJ_REGISTRY_STATE_MASK) != tag) {
+            continue;
+        }
+
+        // another process is compiling a dropon with the same hash. if it died or takes too long, the slot
+        // is given up and the dropon is compiled into the next free slot.
+        for(since = mj_registry_now(); (state & MJ_REGISTRY_STATE_MASK) == MJ_REGISTRY_BUSY;) {
+            if(mj_registry_stale(slot, since) != 0) {
+                expected = state;
+                atomic_compare_exchange_strong_explicit(&slot->state, &expected, tag | MJ_REGISTRY_FAILED, memory_order_acq_rel, memory_order_acquire);
+                break;
+            }
+
+            mj_registry_sleep();
+            state = atomic_load_explicit(&slot->state, memory_order_acquire);
+        }
+
+        if((state & MJ_REGISTRY_STATE_MASK) != MJ_REGISTRY_READY) {
+            continue;
+        }
+
+        if(slot->dropon_id != d->registry_id || memcmp(&slot->key, key, sizeof(mj_cachekey_t)) != 0) {
+            continue;
+        }
+
+        mj_cachekey_t loaded;
+
+        return mj_load_variant(cd, &loaded, &slot->variant, (unsigned char *)r->base);
+    }
+
+    // the registry is full or the dropon isn't in it, the dropon is only compiled for this process
+    return mj_compile_dropon(cd, d, (J_COLOR_SPACE)key->colorspace, &key->sampling, key->blockoffset_x, key->blockoffset_y, key->crop_x, key->crop_y, key->crop_w, key->crop_h);
+}
+
+int mj_registry_publish(mj_registry_t *r, mj_registryslot_t *slot, uint64_t tag, mj_compileddropon_t *cd, mj_dropon_t *d, mj_cachekey_t *key) {
+    mj_registryheader_t *header = (mj_registryheader_t *)r->base;
+    mj_compileddropon_t  compiled;
+    mj_storevariant_t    variant;
+    uint64_t             size, offset, expected;
+    int                  rv;
+
+    rv = mj_compile_dropon(&compiled, d, (J_COLOR_SPACE)key->colorspace, &key->sampling, key->blockoffset_x, key->blockoffset_y, key->crop_x, key->crop_y, key->crop_w, key->crop_h);
+    if(rv != MJ_OK) {
+        atomic_store_explicit(&slot->state, tag | MJ_REGISTRY_FAILED, memory_order_release);
+        return rv;
+    }
+
+    // allocate the blocks in the segment
+    mj_store_variant(&variant, key, &compiled);
+    size = mj_store_align(mj_store_layout(&variant, &compiled, 0));
+
+    offset = atomic_load_explicit(&header->used, memory_order_relaxed);
+
+    do {
+        if(offset > header->size || size > header->size - offset) {
+            // the segment is full, keep the compiled dropon for this process
+            atomic_store_explicit(&header->full, 1, memory_order_relaxed);
+            atomic_store_explicit(&slot->state, tag | MJ_REGISTRY_FAILED, memory_order_release);
+
+            *cd = compiled;
+
+            return MJ_OK;
+        }
+    } while(atomic_compare_exchange_weak_explicit(&header->used, &offset, offset + size, memory_order_relaxed, memory_order_relaxed) == 0);
+
+    mj_store_variant(&slot->variant, key, &compiled);
+    mj_store_layout(&slot->variant, &compiled, offset);
+    mj_store_blocks((unsigned char *)r->base, &slot->variant, &compiled);
+
+    slot->dropon_id = d->registry_id;
+    slot->key = *key;
+
+    mj_free_compileddropon(&compiled);
+
+    // publish the slot. from now on it will not change anymore. if another process gave up on the slot in
+    // the meantime, the blocks are still valid for this process.
+    expected = tag | MJ_REGISTRY_BUSY;
+    atomic_compare_exchange_strong_explicit(&slot->state, &expected, tag | MJ_REGISTRY_READY, memory_order_release, memory_order_relaxed);
+
+    mj_cachekey_t loaded;
+
+    return mj_load_variant(cd, &loaded, &slot->variant, (unsigned char *)r->base);
+}
+
+int mj_registry_stale(mj_registryslot_t *slot, uint64_t since) {
+    int32_t  owner = atomic_load_explicit(&slot->owner, memory_order_acquire);
+    uint64_t claimed = since;
+
+    // the owner may not have recorded itself yet, then the deadline starts with the wait
+    if(owner != 0) {
+        if(kill((pid_t)owner, 0) != 0 && errno == ESRCH) {
+            return 1;
+        }
+
+        claimed = atomic_load_explicit(&slot->claimed, memory_order_relaxed);
+    }
+
+    return (mj_registry_now() - claimed > MJ_REGISTRY_DEADLINE);
+}
+
+uint64_t mj_registry_dropon_id(mj_dropon_t *d) {
+    uint64_t hash = MJ_HASH_INIT;
+    int32_t  header[4];
+    size_t   nsamples = (size_t)d->width * (size_t)d->height;
+
+    header[0] = d->width;
+    header[1] = d->height;
+    header[2] = d->colorspace;
+    header[3] = d->blend;
+
+    hash = mj_hash(hash, header, sizeof(header));
+    hash = mj_hash(hash, d->image, 3 * nsamples);
+
+    if(d->alpha != NULL) {
+        hash = mj_hash(hash, d->alpha, nsamples);
+    }
+
+    // 0 means that the id is not yet calculated
+    if(hash == 0) {
+        hash = 1;
+    }
+
+    return hash;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _LIBMODJPEG_REGISTRY_H_
+#define _LIBMODJPEG_REGISTRY_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "libmodjpeg.h"
+#include "store.h"
+
+// the registry is a shared memory segment where processes publish their compiled dropons
+// for other processes. it consists of a fixed hash table of slots, followed by the blocks.
+// the blocks are allocated by bumping an offset, they are never freed. the offset never moves past
+// the end of the segment.
+//
+// a slot is claimed by setting its state from empty to busy together with the hash of the
+// dropon and the cache key. the claiming process compiles the dropon, copies the blocks into
+// the segment and sets the state to ready. a ready slot never changes anymore, such that
+// readers don't need any locks.
+//
+// the claiming process records its pid and the time of the claim in the slot. if it died or
+// didn't finish within MJ_REGISTRY_DEADLINE, a waiting process sets the state to failed and
+// claims the next slot for the same dropon.
+
+#define MJ_REGISTRY_MAGIC   "MJRG"
+#define MJ_REGISTRY_VERSION 6
+#define MJ_REGISTRY_NSLOTS  1024
+
+#define MJ_REGISTRY_EMPTY  0
+#define MJ_REGISTRY_BUSY   1
+#define MJ_REGISTRY_READY  2
+#define MJ_REGISTRY_FAILED 3
+
+// the lower bits of the state of a slot are the state, the upper bits the hash
+#define MJ_REGISTRY_STATE_MASK ((uint64_t)3)
+
+// how long to wait for the process that creates the registry, in ms
+#define MJ_REGISTRY_WAIT 1000
+
+// how long another process may take for compiling a dropon into a slot, in ms
+#define MJ_REGISTRY_DEADLINE 10000
+
+typedef struct {
+    _Atomic uint64_t state;
+
+    // the process that claimed the slot and the time of the claim in ms, 0 until they are recorded
+    _Atomic int32_t  owner;
+    _Atomic uint64_t claimed;
+
+    uint64_t          dropon_id;
+    mj_cachekey_t     key;
+    mj_storevariant_t variant;
+} mj_registryslot_t;
+
+typedef struct {
+    char     magic[4];
+    uint32_t version;
+    uint32_t byteorder;
+    uint32_t nslots;
+    uint64_t size;
+    uint64_t data_offset;
+
+    _Atomic uint32_t ready;
+    _Atomic uint64_t used;
+
+    // set when a compiled dropon didn't fit into the segment anymore. no new slots are claimed after that.
+    _Atomic uint32_t full;
+
+    mj_registryslot_t slots[MJ_REGISTRY_NSLOTS];
+} mj_registryheader_t;
+
+int      mj_registry_compile(mj_registry_t *r, mj_compileddropon_t *cd, mj_dropon_t *d, mj_cachekey_t *key);
+int      mj_registry_publish(mj_registry_t *r, mj_registryslot_t *slot, uint64_t tag, mj_compileddropon_t *cd, mj_dropon_t *d, mj_cachekey_t *key);
+uint64_t mj_registry_dropon_id(mj_dropon_t *d);
+int      mj_registry_stale(mj_registryslot_t *slot, uint64_t since);
+
+#endif
@@ -0,0 +1,621 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "dropon.h"
+#include "libmodjpeg.h"
+#include "store.h"
+
+uint64_t mj_store_align(uint64_t offset) {
+    return (offset + MJ_BLOCK_ALIGNMENT - 1) & ~(uint64_t)(MJ_BLOCK_ALIGNMENT - 1);
+}
+
+int mj_write_dropon_to_memory(mj_dropon_t *d, unsigned char **memory, size_t *len) {
+    if(d == NULL || memory == NULL || len == NULL || d->image == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    mj_storeheader_t   header;
+    mj_storevariant_t *variants, *v;
+    mj_cacheentry_t *  e;
+    uint64_t           offset;
+    uint32_t           nvariants = 0;
+
+    for(e = (d->cache != NULL ? d->cache->head : NULL); e != NULL; e = e->next) {
+        if(e->cd.image_ncomponents > MJ_STORE_MAX_COMPONENTS || e->cd.alpha_ncomponents > MJ_STORE_MAX_COMPONENTS) {
+            return MJ_ERR_UNSUPPORTED_COLORSPACE;
+        }
+
+        nvariants++;
+    }
+
+    variants = (mj_storevariant_t *)calloc(nvariants + 1, sizeof(mj_storevariant_t));
+    if(variants == NULL) {
+        return MJ_ERR_MEMORY;
+    }
+
+    memset(&header, 0, sizeof(mj_storeheader_t));
+
+    memcpy(header.magic, MJ_STORE_MAGIC, sizeof(header.magic));
+    header.version = MJ_STORE_VERSION;
+    header.byteorder = MJ_STORE_BYTEORDER;
+    header.header_size = sizeof(mj_storeheader_t);
+    header.variant_size = sizeof(mj_storevariant_t);
+
+    header.width = d->width;
+    header.height = d->height;
+    header.colorspace = d->colorspace;
+    header.blend = d->blend;
+
+    header.nvariants = nvariants;
+
+    header.image_size = 3 * (uint64_t)d->width * (uint64_t)d->height;
+    if(d->alpha != NULL) {
+        header.alpha_size = (uint64_t)d->width * (uint64_t)d->height;
+    }
+
+    header.variants_offset = sizeof(mj_storeheader_t);
+    header.image_offset = header.variants_offset + (uint64_t)nvariants * sizeof(mj_storevariant_t);
+    header.alpha_offset = header.image_offset + header.image_size;
+
+    offset = header.alpha_offset + header.alpha_size;
+
+    // the variants are stored from the least recently used to the most recently used
+    // compiled dropon, such that the cache has the same order after reading the file.
+    for(e = (d->cache != NULL ? d->cache->tail : NULL), v = variants; e != NULL; e = e->prev, v++) {
+        mj_store_variant(v, &e->key, &e->cd);
+        offset = mj_store_layout(v, &e->cd, offset);
+    }
+
+    header.file_size = mj_store_align(offset);
+
+    if(header.file_size != (size_t)header.file_size) {
+        free(variants);
+        return MJ_ERR_MEMORY;
+    }
+
+    unsigned char *buffer = (unsigned char *)calloc((size_t)header.file_size, sizeof(unsigned char));
+    if(buffer == NULL) {
+        free(variants);
+        return MJ_ERR_MEMORY;
+    }
+
+    memcpy(buffer, &header, sizeof(mj_storeheader_t));
+    memcpy(buffer + header.variants_offset, variants, (size_t)nvariants * sizeof(mj_storevariant_t));
+    memcpy(buffer + header.image_offset, d->image, (size_t)header.image_size);
+    if(d->alpha != NULL) {
+        memcpy(buffer + header.alpha_offset, d->alpha, (size_t)header.alpha_size);
+    }
+
+    for(e = (d->cache != NULL ? d->cache->tail : NULL), v = variants; e != NULL; e = e->prev, v++) {
+        mj_store_blocks(buffer, v, &e->cd);
+    }
+
+    free(variants);
+
+    *memory = buffer;
+    *len = (size_t)header.file_size;
+
+    return MJ_OK;
+}
+
+int mj_write_dropon_to_file(mj_dropon_t *d, const char *filename) {
+    if(d == NULL || filename == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    FILE *         fp;
+    unsigned char *buffer = NULL;
+    size_t         len = 0;
+    int            rv;
+
+    rv = mj_write_dropon_to_memory(d, &buffer, &len);
+    if(rv != MJ_OK) {
+        return rv;
+    }
+
+    fp = fopen(filename, "wb");
+    if(fp == NULL) {
+        free(buffer);
+        return MJ_ERR_FILEIO;
+    }
+
+    if(fwrite(buffer, 1, len, fp) != len) {
+        rv = MJ_ERR_FILEIO;
+    }
+
+    if(fclose(fp) != 0) {
+        rv = MJ_ERR_FILEIO;
+    }
+
+    free(buffer);
+
+    return rv;
+}
+
+void mj_store_variant(mj_storevariant_t *v, mj_cachekey_t *key, mj_compileddropon_t *cd) {
+    int c;
+
+    memset(v, 0, sizeof(mj_storevariant_t));
+
+    v->colorspace = key->colorspace;
+    v->max_h_samp_factor = key->sampling.max_h_samp_factor;
+    v->max_v_samp_factor = key->sampling.max_v_samp_factor;
+    v->h_factor = key->sampling.h_factor;
+    v->v_factor = key->sampling.v_factor;
+
+    for(c = 0; c < MJ_STORE_MAX_COMPONENTS; c++) {
+        v->h_samp_factor[c] = key->sampling.samp_factor[c].h_samp_factor;
+        v->v_samp_factor[c] = key->sampling.samp_factor[c].v_samp_factor;
+    }
+
+    v->blockoffset_x = key->blockoffset_x;
+    v->blockoffset_y = key->blockoffset_y;
+    v->crop_x = key->crop_x;
+    v->crop_y = key->crop_y;
+    v->crop_w = key->crop_w;
+    v->crop_h = key->crop_h;
+
+    v->image_ncomponents = cd->image_ncomponents;
+    v->image_colorspace = cd->image_colorspace;
+    v->alpha_ncomponents = cd->alpha_ncomponents;
+
+    return;
+}
+
+uint64_t mj_store_layout(mj_storevariant_t *v, mj_compileddropon_t *cd, uint64_t offset) {
+    mj_component_t *comp;
+    int             c, i;
+
+    for(c = 0; c < cd->image_ncomponents; c++) {
+        offset = mj_store_align(offset);
+        mj_store_component(&v->image[c], &cd->image[c], offset);
+        offset += mj_component_size(&cd->image[c]);
+    }
+
+    for(c = 0; c < cd->alpha_ncomponents; c++) {
+        comp = &cd->alpha[c];
+
+        // components with the same sampling have the same mask. it is stored only once.
+        for(i = 0; i < c; i++) {
+            if(comp->nblocks == cd->alpha[i].nblocks && comp->width_in_blocks == cd->alpha[i].width_in_blocks) {
+                if(comp->blocks == cd->alpha[i].blocks || memcmp(comp->blocks, cd->alpha[i].blocks, mj_blocks_size(comp)) == 0) {
+                    break;
+                }
+            }
+        }
+
+        if(i != c) {
+            mj_store_component(&v->alpha[c], comp, v->alpha[i].blocks_offset);
+            continue;
+        }
+
+        offset = mj_store_align(offset);
+        mj_store_component(&v->alpha[c], comp, offset);
+        offset += mj_component_size(comp);
+    }
+
+    return offset;
+}
+
+void mj_store_blocks(unsigned char *base, mj_storevariant_t *v, mj_compileddropon_t *cd) {
+    int c;
+
+    for(c = 0; c < cd->image_ncomponents; c++) {
+        mj_store_component_blocks(base, &v->image[c], &cd->image[c]);
+    }
+
+    for(c = 0; c < cd->alpha_ncomponents; c++) {
+        mj_store_component_blocks(base, &v->alpha[c], &cd->alpha[c]);
+    }
+
+    return;
+}
+
+int mj_load_variant(mj_compileddropon_t *cd, mj_cachekey_t *key, const mj_storevariant_t *v, unsigned char *base) {
+    mj_sampling_t   sampling;
+    mj_component_t *comp;
+    int             c;
+
+    memset(&sampling, 0, sizeof(mj_sampling_t));
+
+    sampling.max_h_samp_factor = v->max_h_samp_factor;
+    sampling.max_v_samp_factor = v->max_v_samp_factor;
+    sampling.h_factor = v->h_factor;
+    sampling.v_factor = v->v_factor;
+
+    for(c = 0; c < MJ_STORE_MAX_COMPONENTS; c++) {
+        sampling.samp_factor[c].h_samp_factor = v->h_samp_factor[c];
+        sampling.samp_factor[c].v_samp_factor = v->v_samp_factor[c];
+    }
+
+    mj_make_cachekey(key, (J_COLOR_SPACE)v->colorspace, &sampling, v->blockoffset_x, v->blockoffset_y, v->crop_x, v->crop_y, v->crop_w, v->crop_h);
+
+    // the compiled dropon is only a view on the blocks at base
+    memset(cd, 0, sizeof(mj_compileddropon_t));
+
+    cd->shared = 1;
+    cd->image_ncomponents = v->image_ncomponents;
+    cd->image_colorspace = v->image_colorspace;
+    cd->alpha_ncomponents = v->alpha_ncomponents;
+
+    cd->image = (mj_component_t *)calloc(cd->image_ncomponents, sizeof(mj_component_t));
+    cd->alpha = (mj_component_t *)calloc(cd->alpha_ncomponents, sizeof(mj_component_t));
+
+    if(cd->image == NULL || cd->alpha == NULL) {
+        mj_free_compileddropon(cd);
+        return MJ_ERR_MEMORY;
+    }
+
+    for(c = 0; c < cd->image_ncomponents; c++) {
+        comp = &cd->image[c];
+
+        comp->width_in_blocks = v->image[c].width_in_blocks;
+        comp->height_in_blocks = v->image[c].height_in_blocks;
+        comp->h_samp_factor = v->image[c].h_samp_factor;
+        comp->v_samp_factor = v->image[c].v_samp_factor;
+        comp->nblocks = v->image[c].nblocks;
+        comp->blocks = (mj_block_t *)(base + v->image[c].blocks_offset);
+
+        if(v->image[c].maskinfo != 0) {
+            comp->nonzero = (unsigned long long *)((unsigned char *)comp->blocks + mj_blocks_size(comp));
+            comp->classes = (unsigned char *)(comp->nonzero + comp->nblocks);
+        }
+    }
+
+    for(c = 0; c < cd->alpha_ncomponents; c++) {
+        comp = &cd->alpha[c];
+
+        comp->width_in_blocks = v->alpha[c].width_in_blocks;
+        comp->height_in_blocks = v->alpha[c].height_in_blocks;
+        comp->h_samp_factor = v->alpha[c].h_samp_factor;
+        comp->v_samp_factor = v->alpha[c].v_samp_factor;
+        comp->nblocks = v->alpha[c].nblocks;
+        comp->blocks = (mj_block_t *)(base + v->alpha[c].blocks_offset);
+
+        if(v->alpha[c].maskinfo != 0) {
+            comp->nonzero = (unsigned long long *)((unsigned char *)comp->blocks + mj_blocks_size(comp));
+            comp->classes = (unsigned char *)(comp->nonzero + comp->nblocks);
+        }
+    }
+
+    return MJ_OK;
+}
+
+void mj_store_component(mj_storecomponent_t *sc, mj_component_t *comp, uint64_t blocks_offset) {
+    sc->width_in_blocks = comp->width_in_blocks;
+    sc->height_in_blocks = comp->height_in_blocks;
+    sc->h_samp_factor = comp->h_samp_factor;
+    sc->v_samp_factor = comp->v_samp_factor;
+    sc->nblocks = comp->nblocks;
+    sc->maskinfo = (comp->nonzero != NULL);
+    sc->blocks_offset = blocks_offset;
+
+    return;
+}
+
+void mj_store_component_blocks(unsigned char *base, mj_storecomponent_t *sc, mj_component_t *comp) {
+    memcpy(base + sc->blocks_offset, comp->blocks, mj_blocks_size(comp));
+
+    if(comp->nonzero != NULL) {
+        memcpy(base + sc->blocks_offset + mj_blocks_size(comp), comp->nonzero, (size_t)comp->nblocks * sizeof(unsigned long long));
+        memcpy(base + sc->blocks_offset + mj_blocks_size(comp) + (size_t)comp->nblocks * sizeof(unsigned long long), comp->classes, (size_t)comp->nblocks);
+    }
+
+    return;
+}
+
+int mj_is_stored_dropon(const unsigned char *memory, size_t len) {
+    if(memory == NULL || len < sizeof(mj_storeheader_t)) {
+        return 0;
+    }
+
+    if(memcmp(memory, MJ_STORE_MAGIC, 4) != 0) {
+        return 0;
+    }
+
+    return 1;
+}
+
+int mj_read_stored_dropon_from_file(mj_dropon_t *d, const char *filename) {
+    if(d == NULL || filename == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    int           fd, rv;
+    struct stat   s;
+    unsigned char magic[sizeof(mj_storeheader_t)];
+    void *        mapping;
+
+    fd = open(filename, O_RDONLY);
+    if(fd == -1) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if(fstat(fd, &s) != 0) {
+        close(fd);
+        return MJ_ERR_FILEIO;
+    }
+
+    // files that are not a compiled dropon are left to the other readers
+    if(pread(fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic) || mj_is_stored_dropon(magic, (size_t)s.st_size) == 0) {
+        close(fd);
+        return MJ_ERR_UNSUPPORTED_FILETYPE;
+    }
+
+    // the mapping is read-only and shared, such that all processes mapping the same
+    // file share the same pages from the page cache.
+    mapping = mmap(NULL, (size_t)s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if(mapping == MAP_FAILED) {
+        return MJ_ERR_FILEIO;
+    }
+
+    rv = mj_load_stored_dropon(d, (unsigned char *)mapping, (size_t)s.st_size, 1);
+    if(rv != MJ_OK) {
+        munmap(mapping, (size_t)s.st_size);
+    }
+
+    return rv;
+}
+
+int mj_read_stored_dropon_from_memory(mj_dropon_t *d, const unsigned char *memory, size_t len) {
+    if(d == NULL || memory == NULL) {
+        return MJ_ERR_NULL_DATA;
+    }
+
+    void *buffer = NULL;
+    int   rv;
+
+    // the blocks have to be aligned, so the memory is copied into an aligned buffer
+    if(posix_memalign(&buffer, MJ_BLOCK_ALIGNMENT, len) != 0) {
+        return MJ_ERR_MEMORY;
+    }
+
+    memcpy(buffer, memory, len);
+
+    rv = mj_load_stored_dropon(d, (unsigned char *)buffer, len, 0);
+    if(rv != MJ_OK) {
+        free(buffer);
+    }
+
+    return rv;
+}
+
+int mj_load_stored_dropon(mj_dropon_t *d, unsigned char *mapping, size_t len, int mapped) {
+    if(mj_is_stored_dropon(mapping, len) == 0) {
+        return MJ_ERR_UNSUPPORTED_FILETYPE;
+    }
+
+    mj_storeheader_t *header = (mj_storeheader_t *)mapping;
+
+    if(header->version != MJ_STORE_VERSION || header->byteorder != MJ_STORE_BYTEORDER) {
+        return MJ_ERR_UNSUPPORTED_FILETYPE;
+    }
+
+    if(header->header_size != sizeof(mj_storeheader_t) || header->variant_size != sizeof(mj_storevariant_t) || header->file_size != len) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if(header->width <= 0 || header->height <= 0 || header->image_size != 3 * (uint64_t)header->width * (uint64_t)header->height) {
+        return MJ_ERR_DROPON_DIMENSIONS;
+    }
+
+    if(header->alpha_size != 0 && header->alpha_size != (uint64_t)header->width * (uint64_t)header->height) {
+        return MJ_ERR_DROPON_DIMENSIONS;
+    }
+
+    if(header->variants_offset > len || (uint64_t)header->nvariants * sizeof(mj_storevariant_t) > len - header->variants_offset) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if(header->image_offset > len || header->image_size > len - header->image_offset) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if(header->alpha_offset > len || header->alpha_size > len - header->alpha_offset) {
+        return MJ_ERR_FILEIO;
+    }
+
+    mj_storevariant_t *variants = (mj_storevariant_t *)(mapping + header->variants_offset);
+    uint32_t           n;
+    int                rv;
+
+    for(n = 0; n < header->nvariants; n++) {
+        if(mj_check_stored_variant(&variants[n], header, mapping, len) != MJ_OK) {
+            return MJ_ERR_FILEIO;
+        }
+    }
+
+    mj_reset_dropon(d);
+
+    d->width = header->width;
+    d->height = header->height;
+    d->colorspace = header->colorspace;
+    d->blend = header->blend;
+
+    d->image = mapping + header->image_offset;
+    if(header->alpha_size != 0) {
+        d->alpha = mapping + header->alpha_offset;
+    }
+
+    d->mapping = mapping;
+    d->mapping_size = len;
+    d->mapped = mapped;
+
+    mj_cachekey_t       key;
+    mj_compileddropon_t cd;
+
+    // the compiled dropons are pointing into the mapping and are pinned in the cache,
+    // i.e. they are never evicted and they don't count towards the cache size.
+    for(n = 0; n < header->nvariants; n++) {
+        if(mj_load_variant(&cd, &key, &variants[n], mapping) != MJ_OK || mj_cache_insert(mj_dropon_cache(d), &key, &cd, 1) == NULL) {
+            mj_free_compileddropon(&cd);
+            mj_unload_stored_dropon(d);
+
+            return MJ_ERR_MEMORY;
+        }
+    }
+
+    // layouts that are not in the file are compiled now
+    rv = mj_precompile_layouts(d);
+    if(rv != MJ_OK) {
+        mj_unload_stored_dropon(d);
+
+        return rv;
+    }
+
+    return MJ_OK;
+}
+
+int mj_check_stored_variant(const mj_storevariant_t *v, const mj_storeheader_t *header, const unsigned char *mapping, size_t len) {
+    int64_t width, height;
+    int     ncomponents, c;
+
+    // the compiled dropon has as many components as the colorspace of its key, see mj_compile_dropon()
+    switch(v->colorspace) {
+        case JCS_GRAYSCALE:
+            ncomponents = 1;
+            break;
+        case JCS_RGB:
+        case JCS_YCbCr:
+            ncomponents = 3;
+            break;
+        default:
+            return MJ_ERR_FILEIO;
+    }
+
+    if(v->image_colorspace != v->colorspace || v->image_ncomponents != ncomponents || v->alpha_ncomponents != ncomponents) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if(v->max_h_samp_factor <= 0 || v->max_v_samp_factor <= 0 || v->max_h_samp_factor > MAX_SAMP_FACTOR || v->max_v_samp_factor > MAX_SAMP_FACTOR) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if(v->h_factor != v->max_h_samp_factor * DCTSIZE || v->v_factor != v->max_v_samp_factor * DCTSIZE) {
+        return MJ_ERR_FILEIO;
+    }
+
+    // the crop area is within the dropon and the block offset within an MCU
+    if(v->crop_x < 0 || v->crop_y < 0 || v->crop_w <= 0 || v->crop_h <= 0 || v->crop_w > header->width - v->crop_x || v->crop_h > header->height - v->crop_y) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if(v->blockoffset_x < 0 || v->blockoffset_x >= v->h_factor || v->blockoffset_y < 0 || v->blockoffset_y >= v->v_factor) {
+        return MJ_ERR_FILEIO;
+    }
+
+    // the size of the compiled dropon in pixels, rounded up to whole MCUs
+    width = ((int64_t)v->crop_w + v->blockoffset_x + v->h_factor - 1) / v->h_factor;
+    height = ((int64_t)v->crop_h + v->blockoffset_y + v->v_factor - 1) / v->v_factor;
+
+    for(c = 0; c < ncomponents; c++) {
+        if(v->h_samp_factor[c] <= 0 || v->v_samp_factor[c] <= 0 || v->max_h_samp_factor % v->h_samp_factor[c] != 0 || v->max_v_samp_factor % v->v_samp_factor[c] != 0) {
+            return MJ_ERR_FILEIO;
+        }
+
+        if(mj_check_stored_component(&v->image[c], v, c, width, height, mapping, len) != MJ_OK || v->image[c].maskinfo != 0) {
+            return MJ_ERR_FILEIO;
+        }
+
+        if(mj_check_stored_component(&v->alpha[c], v, c, width, height, mapping, len) != MJ_OK || v->alpha[c].maskinfo == 0) {
+            return MJ_ERR_FILEIO;
+        }
+    }
+
+    return MJ_OK;
+}
+
+int mj_check_stored_component(const mj_storecomponent_t *sc, const mj_storevariant_t *v, int c, int64_t width, int64_t height, const unsigned char *mapping, size_t len) {
+    const unsigned long long *nonzero;
+    const unsigned char *     classes;
+    int32_t                   n;
+
+    // the blocks of the component are exactly the ones of the sampling in the key, see mj_alloc_component()
+    if(sc->h_samp_factor != v->h_samp_factor[c] || sc->v_samp_factor != v->v_samp_factor[c]) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if((int64_t)sc->width_in_blocks != width * sc->h_samp_factor || (int64_t)sc->height_in_blocks != height * sc->v_samp_factor) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if((int64_t)sc->nblocks != (int64_t)sc->width_in_blocks * (int64_t)sc->height_in_blocks) {
+        return MJ_ERR_FILEIO;
+    }
+
+    uint64_t size = (uint64_t)sc->nblocks * DCTSIZE2 * sizeof(mj_block_t);
+
+    if(sc->maskinfo != 0) {
+        size += (uint64_t)sc->nblocks * (sizeof(unsigned long long) + 1);
+    }
+
+    if(sc->blocks_offset % MJ_BLOCK_ALIGNMENT != 0 || sc->blocks_offset > len || size > len - sc->blocks_offset) {
+        return MJ_ERR_FILEIO;
+    }
+
+    if(sc->maskinfo == 0) {
+        return MJ_OK;
+    }
+
+    // the compose kernels switch on the class of each block. a fully transparent or opaque block has at most a DC coefficient.
+    nonzero = (const unsigned long long *)(mapping + sc->blocks_offset + (size_t)sc->nblocks * DCTSIZE2 * sizeof(mj_block_t));
+    classes = (const unsigned char *)(nonzero + sc->nblocks);
+
+    for(n = 0; n < sc->nblocks; n++) {
+        if(classes[n] > MJ_BLOCK_SAMPLES) {
+            return MJ_ERR_FILEIO;
+        }
+
+        if((classes[n] == MJ_BLOCK_TRANSPARENT || classes[n] == MJ_BLOCK_OPAQUE) && (nonzero[n] & ~1ULL) != 0) {
+            return MJ_ERR_FILEIO;
+        }
+    }
+
+    return MJ_OK;
+}
+
+void mj_unload_stored_dropon(mj_dropon_t *d) {
+    // the caller is still the owner of the mapping
+    d->image = NULL;
+    d->alpha = NULL;
+
+    d->mapping = NULL;
+    d->mapping_size = 0;
+    d->mapped = 0;
+
+    mj_reset_dropon(d);
+
+    return;
+}
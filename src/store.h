@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _LIBMODJPEG_STORE_H_
+#define _LIBMODJPEG_STORE_H_
+
+#include <stdint.h>
+
+#include "cache.h"
+#include "libmodjpeg.h"
+
+// a compiled dropon file contains the dropon itself and all compiled dropons from its cache.
+// all numbers are stored in the native byte order. the file is meant to be mapped into the
+// memory as it is, such that the blocks can be used without any parsing or copying.
+//
+// +-----------------------+
+// | header                |
+// +-----------------------+
+// | variant 0             |
+// | ...                   |
+// | variant n-1           |
+// +-----------------------+
+// | image samples         | 3 components
+// | alpha samples         | 1 component, if available
+// +-----------------------+
+// | blocks                | each component is aligned to MJ_BLOCK_ALIGNMENT. a mask is
+// |                       | followed by the non-zero coefficients and the classes of
+// |                       | its blocks. blocks of dense masks hold the samples
+// +-----------------------+
+
+#define MJ_STORE_MAGIC     "MJDO"
+#define MJ_STORE_VERSION   5
+#define MJ_STORE_BYTEORDER 0x01020304
+
+// the maximum number of components of a compiled dropon
+#define MJ_STORE_MAX_COMPONENTS 4
+
+typedef struct {
+    char     magic[4];
+    uint32_t version;
+    uint32_t byteorder;
+    uint32_t header_size;
+    uint32_t variant_size;
+
+    int32_t width;
+    int32_t height;
+    int32_t colorspace;
+    int32_t blend;
+
+    uint32_t nvariants;
+
+    uint64_t image_size;
+    uint64_t alpha_size;
+    uint64_t image_offset;
+    uint64_t alpha_offset;
+    uint64_t variants_offset;
+    uint64_t file_size;
+} mj_storeheader_t;
+
+typedef struct {
+    int32_t width_in_blocks;
+    int32_t height_in_blocks;
+
+    int32_t h_samp_factor;
+    int32_t v_samp_factor;
+
+    // the non-zero coefficients and the classes of the blocks follow the blocks, if available
+    int32_t  nblocks;
+    int32_t  maskinfo;
+    uint64_t blocks_offset;
+} mj_storecomponent_t;
+
+typedef struct {
+    // the cache key
+    int32_t colorspace;
+
+    int32_t max_h_samp_factor;
+    int32_t max_v_samp_factor;
+    int32_t h_factor;
+    int32_t v_factor;
+    int32_t h_samp_factor[MJ_STORE_MAX_COMPONENTS];
+    int32_t v_samp_factor[MJ_STORE_MAX_COMPONENTS];
+
+    int32_t blockoffset_x;
+    int32_t blockoffset_y;
+    int32_t crop_x;
+    int32_t crop_y;
+    int32_t crop_w;
+    int32_t crop_h;
+
+    // the compiled dropon
+    int32_t image_ncomponents;
+    int32_t image_colorspace;
+    int32_t alpha_ncomponents;
+    int32_t reserved;
+
+    mj_storecomponent_t image[MJ_STORE_MAX_COMPONENTS];
+    mj_storecomponent_t alpha[MJ_STORE_MAX_COMPONENTS];
+} mj_storevariant_t;
+
+int  mj_is_stored_dropon(const unsigned char *memory, size_t len);
+int  mj_read_stored_dropon_from_file(mj_dropon_t *d, const char *filename);
+int  mj_read_stored_dropon_from_memory(mj_dropon_t *d, const unsigned char *memory, size_t len);
+int  mj_load_stored_dropon(mj_dropon_t *d, unsigned char *mapping, size_t len, int mapped);
+void mj_unload_stored_dropon(mj_dropon_t *d);
+int  mj_check_stored_variant(const mj_storevariant_t *v, const mj_storeheader_t *header, const unsigned char *mapping, size_t len);
+int  mj_check_stored_component(const mj_storecomponent_t *sc, const mj_storevariant_t *v, int c, int64_t width, int64_t height, const unsigned char *mapping, size_t len);
+
+uint64_t mj_store_align(uint64_t offset);
+void     mj_store_variant(mj_storevariant_t *v, mj_cachekey_t *key, mj_compileddropon_t *cd);
+uint64_t mj_store_layout(mj_storevariant_t *v, mj_compileddropon_t *cd, uint64_t offset);
+void     mj_store_blocks(unsigned char *base, mj_storevariant_t *v, mj_compileddropon_t *cd);
+void     mj_store_component(mj_storecomponent_t *sc, mj_component_t *comp, uint64_t blocks_offset);
+void     mj_store_component_blocks(unsigned char *base, mj_storecomponent_t *sc, mj_component_t *comp);
+int      mj_load_variant(mj_compileddropon_t *cd, mj_cachekey_t *key, const mj_storevariant_t *v, unsigned char *base);
+
+#endif
@@ -0,0 +1,1018 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../cache.h"
+#include "../compose.h"
+#include "../dropon.h"
+#include "../libmodjpeg.h"
+
+typedef struct {
+    const char *dropon;
+    const char *mask;
+    short       blend;
+} test_dropon_t;
+
+typedef struct {
+    unsigned int align;
+    int          offset_x;
+    int          offset_y;
+} test_position_t;
+
+static const test_dropon_t test_dropons[] = {
+    {"dropon.png", NULL, 0},
+    {"dropon.jpg", "mask.jpg", 0},
+};
+
+static int test_read_dropon(mj_dropon_t *d, const char *images, const test_dropon_t *t) {
+    char dropon[1024], mask[1024];
+
+    snprintf(dropon, sizeof(dropon), "%s/%s", images, t->dropon);
+    if(t->mask != NULL) {
+        snprintf(mask, sizeof(mask), "%s/%s", images, t->mask);
+    }
+
+    mj_init_dropon(d);
+
+    return mj_read_dropon_from_file(d, dropon, (t->mask != NULL) ? mask : NULL, t->blend);
+}
+
+static int test_read_image(mj_jpeg_t *m, const char *images) {
+    char image[1024];
+
+    snprintf(image, sizeof(image), "%s/image.jpg", images);
+
+    mj_init_jpeg(m);
+
+    return mj_read_jpeg_from_file(m, image, 0);
+}
+
+// the number of different quantized coefficients of two images with the same dimensions
+static int test_differences(mj_jpeg_t *a, mj_jpeg_t *b) {
+    jpeg_component_info *component;
+    JBLOCKARRAY          rows_a, rows_b;
+    int                  c, l, k, i, differences = 0;
+
+    for(c = 0; c < a->cinfo.num_components; c++) {
+        component = &a->cinfo.comp_info[c];
+
+        for(l = 0; l < (int)component->height_in_blocks; l++) {
+            rows_a = (*a->cinfo.mem->access_virt_barray)((j_common_ptr)&a->cinfo, a->coef[c], l, 1, FALSE);
+            rows_b = (*b->cinfo.mem->access_virt_barray)((j_common_ptr)&b->cinfo, b->coef[c], l, 1, FALSE);
+
+            for(k = 0; k < (int)component->width_in_blocks; k++) {
+                for(i = 0; i < DCTSIZE2; i++) {
+                    if(rows_a[0][k][i] != rows_b[0][k][i]) {
+                        differences++;
+                    }
+                }
+            }
+        }
+    }
+
+    return differences;
+}
+
+// the visible part of a dropon at the top-left position (x, y) of the image, the same as in mj_place_dropon()
+typedef struct {
+    int crop_x;
+    int crop_y;
+    int crop_w;
+    int crop_h;
+    int blockoffset_x;
+    int blockoffset_y;
+} test_crop_t;
+
+static void test_crop(test_crop_t *c, mj_jpeg_t *m, mj_dropon_t *d, int x, int y) {
+    c->crop_x = (x < 0) ? -x : 0;
+    c->crop_y = (y < 0) ? -y : 0;
+    c->crop_w = d->width - c->crop_x;
+    c->crop_h = d->height - c->crop_y;
+
+    if(x + c->crop_x + c->crop_w > m->width) {
+        c->crop_w = m->width - x - c->crop_x;
+    }
+
+    if(y + c->crop_y + c->crop_h > m->height) {
+        c->crop_h = m->height - y - c->crop_y;
+    }
+
+    c->blockoffset_x = (x > 0) ? x % m->sampling.h_factor : 0;
+    c->blockoffset_y = (y > 0) ? y % m->sampling.v_factor : 0;
+
+    return;
+}
+
+// compose the dropon at the top-left position (x, y) of the image from a compiled copy of only the visible part
+static int test_compose_cropped(mj_jpeg_t *m, mj_dropon_t *d, int x, int y) {
+    mj_compileddropon_t cd;
+    test_crop_t         c;
+    int                 mcu_w, mcu_h, rv;
+
+    test_crop(&c, m, d, x, y);
+
+    mcu_w = (c.blockoffset_x + c.crop_w + m->sampling.h_factor - 1) / m->sampling.h_factor;
+    mcu_h = (c.blockoffset_y + c.crop_h + m->sampling.v_factor - 1) / m->sampling.v_factor;
+
+    rv = mj_compile_dropon(&cd, d, m->cinfo.jpeg_color_space, &m->sampling, c.blockoffset_x, c.blockoffset_y, c.crop_x, c.crop_y, c.crop_w, c.crop_h);
+    if(rv != MJ_OK) {
+        return rv;
+    }
+
+    rv = mj_compose_with_mask(m, &cd, (x > 0) ? x / m->sampling.h_factor : 0, (y > 0) ? y / m->sampling.v_factor : 0, 0, 0, mcu_w, mcu_h, 0, 0, NULL);
+
+    mj_free_compileddropon(&cd);
+
+    return rv;
+}
+
+// a dropon that is cut off by a border of the image on an MCU border is composed from the MCUs of the whole compiled
+// dropon. this has to give the same coefficients as compiling only the visible part.
+static int test_view(const char *images, const test_dropon_t *t) {
+    mj_dropon_t   d;
+    mj_jpeg_t     m_view, m_cropped;
+    mj_cachekey_t key;
+    test_crop_t   c;
+    int           positions[4][2], ok = 1, ncrops = 0, nviews = 0;
+    int           width, height, cut, n, i, x, y, differences;
+
+    if(test_read_dropon(&d, images, t) != MJ_OK || test_read_image(&m_view, images) != MJ_OK) {
+        printf("%s: reading the dropon or the image failed\n", t->dropon);
+        mj_free_dropon(&d);
+        return 0;
+    }
+
+    width = m_view.width;
+    height = m_view.height;
+
+    mj_free_jpeg(&m_view);
+
+    // less than half of the dropon is cut off, such that the whole dropon is compiled for the view
+    for(cut = 1; cut < d.height / 2 && ok != 0; cut++) {
+        n = cut * d.width / d.height;
+
+        // the left, the right, the top, and the bottom border, with a block offset on the other axis
+        positions[0][0] = -n;
+        positions[0][1] = 21;
+        positions[1][0] = width - d.width + n;
+        positions[1][1] = 37;
+        positions[2][0] = 13;
+        positions[2][1] = -cut;
+        positions[3][0] = 42;
+        positions[3][1] = height - d.height + cut;
+
+        for(i = 0; i < 4; i++) {
+            x = positions[i][0];
+            y = positions[i][1];
+
+            if(test_read_image(&m_view, images) != MJ_OK || test_read_image(&m_cropped, images) != MJ_OK) {
+                printf("%s: reading the image failed\n", t->dropon);
+                mj_free_jpeg(&m_view);
+                ok = 0;
+                break;
+            }
+
+            if(mj_compose(&m_view, &d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, x, y) != MJ_OK || test_compose_cropped(&m_cropped, &d, x, y) != MJ_OK) {
+                printf("%s at %d,%d: composing failed\n", t->dropon, x, y);
+                ok = 0;
+            }
+            else {
+                differences = test_differences(&m_view, &m_cropped);
+
+                if(differences != 0) {
+                    printf("%s at %d,%d: %d different coefficients\n", t->dropon, x, y, differences);
+                    ok = 0;
+                }
+            }
+
+            // the cropped dropon is only in the cache if it was compiled instead of using the view
+            test_crop(&c, &m_view, &d, x, y);
+            mj_make_cachekey(&key, m_view.cinfo.jpeg_color_space, &m_view.sampling, c.blockoffset_x, c.blockoffset_y, c.crop_x, c.crop_y, c.crop_w, c.crop_h);
+
+            ncrops++;
+            if(mj_cache_lookup(d.cache, &key) == NULL) {
+                nviews++;
+            }
+
+            mj_free_jpeg(&m_view);
+            mj_free_jpeg(&m_cropped);
+        }
+    }
+
+    printf("%s: %d crops at the borders, %d composed from the whole dropon\n", t->dropon, ncrops, nviews);
+
+    if(nviews != ncrops) {
+        ok = 0;
+    }
+
+    mj_free_dropon(&d);
+
+    return ok;
+}
+
+// compose the placements one after the other, i.e. each of them is quantized on its own
+static int test_compose_sequential(mj_jpeg_t *m, const mj_placement_t *placements, int nplacements, const mj_composeoptions_t *o) {
+    int rv, i;
+
+    for(i = 0; i < nplacements; i++) {
+        rv = mj_compose_with_options(m, placements[i].dropon, placements[i].align, placements[i].offset_x, placements[i].offset_y, o);
+        if(rv != MJ_OK) {
+            return rv;
+        }
+    }
+
+    return MJ_OK;
+}
+
+// dropons that don't share an MCU are composed by mj_compose_many() the same as by composing them one after the other
+static int test_many(const char *images, const test_dropon_t *t) {
+    mj_dropon_t         d;
+    mj_jpeg_t           m_many, m_sequential;
+    mj_composeoptions_t o;
+    mj_placement_t      placements[3];
+    int                 ok = 1, differences;
+
+    if(test_read_dropon(&d, images, t) != MJ_OK) {
+        printf("%s: reading the dropon failed\n", t->dropon);
+        mj_free_dropon(&d);
+        return 0;
+    }
+
+    placements[0] = (mj_placement_t){&d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, -7, 0};
+    placements[1] = (mj_placement_t){&d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 40, 100};
+    placements[2] = (mj_placement_t){&d, MJ_ALIGN_BOTTOM | MJ_ALIGN_RIGHT, 0, -46};
+
+    mj_init_composeoptions(&o);
+    o.opacity = 200;
+    o.luminance = 16;
+
+    if(test_read_image(&m_many, images) != MJ_OK || test_read_image(&m_sequential, images) != MJ_OK) {
+        printf("%s: reading the image failed\n", t->dropon);
+        ok = 0;
+    }
+    else if(mj_compose_many_with_options(&m_many, placements, 3, &o) != MJ_OK || test_compose_sequential(&m_sequential, placements, 3, &o) != MJ_OK) {
+        printf("%s: composing failed\n", t->dropon);
+        ok = 0;
+    }
+    else {
+        differences = test_differences(&m_many, &m_sequential);
+
+        printf("%s: %d different coefficients of separate dropons\n", t->dropon, differences);
+
+        if(differences != 0) {
+            ok = 0;
+        }
+    }
+
+    mj_free_jpeg(&m_many);
+    mj_free_jpeg(&m_sequential);
+    mj_free_dropon(&d);
+
+    return ok;
+}
+
+// the first block that is covered by a dropon at position x with the given size, and the first block after it that
+// is not covered anymore. with full only the blocks that are covered completely are counted.
+static void test_covered(int *first, int *last, int x, int size, int blocksize, int full) {
+    if(full != 0) {
+        *first = (x + blocksize - 1) / blocksize;
+        *last = (x + size) / blocksize;
+    }
+    else {
+        *first = x / blocksize;
+        *last = (x + size + blocksize - 1) / blocksize;
+    }
+
+    return;
+}
+
+// two dropons with a uniform opacity that overlap. the blocks where they overlap completely must be quantized only
+// once after both dropons are blended, all other blocks must be the same as composing the dropons one after the other.
+static int test_many_overlap(const char *images) {
+    static const int positions[2][2] = {{0, 0}, {32, 16}};
+
+    mj_dropon_t          d;
+    mj_jpeg_t            m_original, m_many, m_sequential;
+    mj_composeoptions_t  o;
+    mj_placement_t       placements[2];
+    mj_compileddropon_t  cd;
+    mj_quantization_t    q;
+    jpeg_component_info *component;
+    JBLOCKARRAY          rows_original, rows_many, rows_sequential;
+    mj_block_t *         dropon;
+    float                alpha, x1[DCTSIZE2];
+    int                  blockwidth, blockheight, first[2][2], last[2][2], full[2], overlap;
+    int                  ok = 1, c, k, l, i, j, nblocks = 0, requantized = 0, mismatches = 0;
+    char                 filename[1024];
+
+    snprintf(filename, sizeof(filename), "%s/dropon.jpg", images);
+
+    mj_init_dropon(&d);
+
+    if(mj_read_dropon_from_file(&d, filename, NULL, MJ_BLEND_FULL) != MJ_OK || test_read_image(&m_original, images) != MJ_OK) {
+        printf("overlap: reading the dropon or the image failed\n");
+        mj_free_dropon(&d);
+        return 0;
+    }
+
+    // the opaque dropon with an opacity is blended with the same weight everywhere
+    mj_init_composeoptions(&o);
+    o.opacity = 128;
+    alpha = (float)o.opacity / (float)MJ_BLEND_FULL;
+
+    for(i = 0; i < 2; i++) {
+        placements[i] = (mj_placement_t){&d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, positions[i][0], positions[i][1]};
+    }
+
+    if(test_read_image(&m_many, images) != MJ_OK || test_read_image(&m_sequential, images) != MJ_OK) {
+        printf("overlap: reading the image failed\n");
+        ok = 0;
+    }
+    else if(mj_compose_many_with_options(&m_many, placements, 2, &o) != MJ_OK || test_compose_sequential(&m_sequential, placements, 2, &o) != MJ_OK) {
+        printf("overlap: composing failed\n");
+        ok = 0;
+    }
+    else if(mj_compile_dropon(&cd, &d, m_original.cinfo.jpeg_color_space, &m_original.sampling, 0, 0, 0, 0, d.width, d.height) != MJ_OK) {
+        printf("overlap: compiling the dropon failed\n");
+        ok = 0;
+    }
+    else {
+        for(c = 0; c < m_original.cinfo.num_components; c++) {
+            component = &m_original.cinfo.comp_info[c];
+            blockwidth = m_original.sampling.h_factor / component->h_samp_factor;
+            blockheight = m_original.sampling.v_factor / component->v_samp_factor;
+
+            mj_init_quantization(&q, component->quant_table->quantval);
+
+            for(i = 0; i < 2; i++) {
+                test_covered(&first[i][0], &last[i][0], positions[i][0], d.width, blockwidth, 0);
+                test_covered(&first[i][1], &last[i][1], positions[i][1], d.height, blockheight, 0);
+            }
+
+            for(l = 0; l < (int)component->height_in_blocks; l++) {
+                rows_original = (*m_original.cinfo.mem->access_virt_barray)((j_common_ptr)&m_original.cinfo, m_original.coef[c], l, 1, FALSE);
+                rows_many = (*m_many.cinfo.mem->access_virt_barray)((j_common_ptr)&m_many.cinfo, m_many.coef[c], l, 1, FALSE);
+                rows_sequential = (*m_sequential.cinfo.mem->access_virt_barray)((j_common_ptr)&m_sequential.cinfo, m_sequential.coef[c], l, 1, FALSE);
+
+                for(k = 0; k < (int)component->width_in_blocks; k++) {
+                    overlap = 1;
+                    for(i = 0; i < 2; i++) {
+                        if(k < first[i][0] || k >= last[i][0] || l < first[i][1] || l >= last[i][1]) {
+                            overlap = 0;
+                        }
+                    }
+
+                    // outside of the overlap there's only one dropon
+                    if(overlap == 0) {
+                        if(memcmp(rows_many[0][k], rows_sequential[0][k], sizeof(JBLOCK)) != 0) {
+                            mismatches++;
+                        }
+                        continue;
+                    }
+
+                    // the blocks where both dropons cover the whole block, blended in the DCT domain and quantized once
+                    for(i = 0; i < 2; i++) {
+                        test_covered(&full[0], &full[1], positions[i][0], d.width, blockwidth, 1);
+                        if(k < full[0] || k >= full[1]) {
+                            overlap = 0;
+                        }
+
+                        test_covered(&full[0], &full[1], positions[i][1], d.height, blockheight, 1);
+                        if(l < full[0] || l >= full[1]) {
+                            overlap = 0;
+                        }
+                    }
+
+                    if(overlap == 0) {
+                        continue;
+                    }
+
+                    for(j = 0; j < DCTSIZE2; j++) {
+                        x1[j] = (float)rows_original[0][k][j] * q.quantval[j];
+                    }
+
+                    for(i = 0; i < 2; i++) {
+                        dropon = MJ_BLOCK(&cd.image[c], (size_t)cd.image[c].width_in_blocks * (l - first[i][1]) + (k - first[i][0]));
+
+                        for(j = 0; j < DCTSIZE2; j++) {
+                            x1[j] += alpha * (dropon[j] - x1[j]);
+                        }
+                    }
+
+                    for(j = 0; j < DCTSIZE2; j++) {
+                        if(rows_many[0][k][j] != mj_quantize_coefficient(x1[j], q.reciprocal[j])) {
+                            mismatches++;
+                        }
+
+                        if(rows_many[0][k][j] != rows_sequential[0][k][j]) {
+                            requantized++;
+                        }
+                    }
+
+                    nblocks++;
+                }
+            }
+        }
+
+        mj_free_compileddropon(&cd);
+
+        printf("overlap: %d blocks quantized once, %d coefficients different from quantizing twice, %d mismatches\n", nblocks, requantized, mismatches);
+
+        if(nblocks == 0 || mismatches != 0) {
+            ok = 0;
+        }
+    }
+
+    mj_free_jpeg(&m_original);
+    mj_free_jpeg(&m_many);
+    mj_free_jpeg(&m_sequential);
+    mj_free_dropon(&d);
+
+    return ok;
+}
+
+// compose the tiles one by one. the strides are rounded up to a multiple of the size of an MCU, and the first tile
+// is at the top-left corner of the image or partially off the image.
+static int test_compose_tiles(mj_jpeg_t *m, mj_dropon_t *d, int offset_x, int offset_y, int stride_x, int stride_y, int *ntiles) {
+    int x, y, rv;
+
+    stride_x = ((stride_x + m->sampling.h_factor - 1) / m->sampling.h_factor) * m->sampling.h_factor;
+    stride_y = ((stride_y + m->sampling.v_factor - 1) / m->sampling.v_factor) * m->sampling.v_factor;
+
+    while(offset_x > 0) {
+        offset_x -= stride_x;
+    }
+
+    while(offset_x <= -stride_x) {
+        offset_x += stride_x;
+    }
+
+    while(offset_y > 0) {
+        offset_y -= stride_y;
+    }
+
+    while(offset_y <= -stride_y) {
+        offset_y += stride_y;
+    }
+
+    *ntiles = 0;
+
+    for(y = offset_y; y < m->height; y += stride_y) {
+        for(x = offset_x; x < m->width; x += stride_x) {
+            rv = mj_compose(m, d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, x, y);
+            if(rv != MJ_OK) {
+                return rv;
+            }
+
+            (*ntiles)++;
+        }
+    }
+
+    return MJ_OK;
+}
+
+// mj_compose_tiled() gives the same coefficients as composing each tile with mj_compose()
+static int test_tiled(const char *images, const test_dropon_t *t) {
+    // the offset and the stride of the tiles, 0 is the size of the dropon
+    static const int tilings[][4] = {
+        {0, 0, 0, 0},
+        {-20, -7, 170, 55},
+        {37, 100, 200, 80},
+        {-300, -170, 96, 48},
+    };
+
+    mj_dropon_t d;
+    mj_jpeg_t   m_tiled, m_tiles;
+    int         ok = 1, n, ntiles, differences;
+
+    if(test_read_dropon(&d, images, t) != MJ_OK) {
+        printf("%s: reading the dropon failed\n", t->dropon);
+        mj_free_dropon(&d);
+        return 0;
+    }
+
+    for(n = 0; n < (int)(sizeof(tilings) / sizeof(tilings[0])); n++) {
+        if(test_read_image(&m_tiled, images) != MJ_OK || test_read_image(&m_tiles, images) != MJ_OK) {
+            printf("%s: reading the image failed\n", t->dropon);
+            ok = 0;
+        }
+        else if(mj_compose_tiled(&m_tiled, &d, tilings[n][0], tilings[n][1], tilings[n][2], tilings[n][3]) != MJ_OK ||
+                test_compose_tiles(&m_tiles, &d, tilings[n][0], tilings[n][1], (tilings[n][2] > 0) ? tilings[n][2] : d.width, (tilings[n][3] > 0) ? tilings[n][3] : d.height,
+                                   &ntiles) != MJ_OK) {
+            printf("%s: composing failed\n", t->dropon);
+            ok = 0;
+        }
+        else {
+            differences = test_differences(&m_tiled, &m_tiles);
+
+            printf("%s: tiles at %d,%d every %d,%d: %d tiles, %d different coefficients\n", t->dropon, tilings[n][0], tilings[n][1], tilings[n][2], tilings[n][3], ntiles,
+                   differences);
+
+            if(differences != 0) {
+                ok = 0;
+            }
+        }
+
+        mj_free_jpeg(&m_tiled);
+        mj_free_jpeg(&m_tiles);
+    }
+
+    mj_free_dropon(&d);
+
+    return ok;
+}
+
+// a JPEG with a pattern, e.g. large enough to be composed with several threads
+static int test_make_image(unsigned char **memory, unsigned long *len, int width, int height, int quality) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr       jerr;
+    unsigned char *             row;
+    JSAMPROW                    rows[1];
+    int                         x;
+
+    row = (unsigned char *)malloc((size_t)width * 3);
+    if(row == NULL) {
+        return MJ_ERR_MEMORY;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    *memory = NULL;
+    *len = 0;
+    jpeg_mem_dest(&cinfo, memory, len);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    rows[0] = row;
+
+    while(cinfo.next_scanline < cinfo.image_height) {
+        for(x = 0; x < width; x++) {
+            row[x * 3] = (unsigned char)(x + cinfo.next_scanline);
+            row[x * 3 + 1] = (unsigned char)((x / 7) * (cinfo.next_scanline / 5));
+            row[x * 3 + 2] = (unsigned char)(x ^ cinfo.next_scanline);
+        }
+
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    free(row);
+
+    return MJ_OK;
+}
+
+// a dropon that covers the whole image. the mask is transparent, opaque, smooth, and noisy in vertical stripes,
+// such that all kinds of blocks are in each band of MCU rows.
+static int test_make_dropon(mj_dropon_t *d, int width, int height, int fixed_point) {
+    unsigned char *raw, *p;
+    int            x, y, rv;
+
+    raw = (unsigned char *)malloc((size_t)width * (size_t)height * 4);
+    if(raw == NULL) {
+        return MJ_ERR_MEMORY;
+    }
+
+    srand(1);
+
+    for(y = 0, p = raw; y < height; y++) {
+        for(x = 0; x < width; x++, p += 4) {
+            p[0] = (unsigned char)(255 - x);
+            p[1] = (unsigned char)(y * 3);
+            p[2] = (unsigned char)(x * y);
+
+            switch((x / 64) % 4) {
+                case 0:
+                    p[3] = 0;
+                    break;
+                case 1:
+                    p[3] = 255;
+                    break;
+                case 2:
+                    p[3] = (unsigned char)(x * 4);
+                    break;
+                default:
+                    p[3] = (unsigned char)(rand() % 256);
+                    break;
+            }
+        }
+    }
+
+    mj_init_dropon(d);
+    mj_set_dropon_fixed_point(d, fixed_point);
+
+    rv = mj_read_dropon_from_raw(d, raw, MJ_COLORSPACE_RGBA, width, height, MJ_BLEND_NONUNIFORM);
+
+    free(raw);
+
+    return rv;
+}
+
+// composing a dropon that covers the whole image with several threads gives the same coefficients as with one thread
+static int test_threads(int fixed_point) {
+    static const int nthreads[] = {2, 3, 4, 16};
+
+    mj_dropon_t         d;
+    mj_jpeg_t           m_single, m_threads;
+    mj_composeoptions_t o;
+    unsigned char *     memory = NULL;
+    unsigned long       len = 0;
+    int                 ok = 1, n, differences;
+
+    if(test_make_image(&memory, &len, 1024, 768, 90) != MJ_OK || test_make_dropon(&d, 1024, 768, fixed_point) != MJ_OK) {
+        printf("threads: creating the image or the dropon failed\n");
+        free(memory);
+        return 0;
+    }
+
+    mj_init_composeoptions(&o);
+    o.opacity = 180;
+    o.cb_value = -16;
+
+    mj_init_jpeg(&m_single);
+
+    if(mj_read_jpeg_from_memory(&m_single, memory, len, 0) != MJ_OK || mj_compose_with_options(&m_single, &d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 0, 0, &o) != MJ_OK) {
+        printf("threads: composing with one thread failed\n");
+        ok = 0;
+    }
+
+    for(n = 0; n < (int)(sizeof(nthreads) / sizeof(nthreads[0])) && ok != 0; n++) {
+        mj_init_jpeg(&m_threads);
+        mj_set_jpeg_threads(&m_threads, nthreads[n]);
+
+        if(mj_read_jpeg_from_memory(&m_threads, memory, len, 0) != MJ_OK || mj_compose_with_options(&m_threads, &d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 0, 0, &o) != MJ_OK) {
+            printf("threads: composing with %d threads failed\n", nthreads[n]);
+            ok = 0;
+        }
+        else {
+            differences = test_differences(&m_single, &m_threads);
+
+            printf("threads: %d threads%s: %d different coefficients\n", nthreads[n], (fixed_point != 0) ? " in fixed point" : "", differences);
+
+            if(differences != 0) {
+                ok = 0;
+            }
+        }
+
+        mj_free_jpeg(&m_threads);
+    }
+
+    mj_free_jpeg(&m_single);
+    mj_free_dropon(&d);
+    free(memory);
+
+    return ok;
+}
+
+// the number of blocks of a compiled dropon that were derived for quantization tables or for fixed point
+static int test_derived(const mj_compileddropon_t *cd) {
+    const mj_quantized_t *qz;
+    int                   c, nderived = 0;
+
+    for(c = 0; c < cd->image_ncomponents; c++) {
+        for(qz = cd->image[c].quantized; qz != NULL; qz = qz->next) {
+            nderived++;
+        }
+
+        nderived += (cd->image[c].fixed != NULL) + (cd->alpha[c].fixed != NULL);
+    }
+
+    return nderived;
+}
+
+// a dropon compiled with mj_compile_dropon_for() is composed by mj_compose_compiled() the same as by mj_compose(). the
+// compiled dropon and the cache of the dropon are not changed, also on an image with other quantization tables.
+static int test_compiled(const char *images, const test_dropon_t *t, int fixed_point) {
+    static const test_position_t positions[] = {
+        {MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 0, 0},
+        {MJ_ALIGN_CENTER, 0, 0},
+        {MJ_ALIGN_TOP | MJ_ALIGN_LEFT, -20, -20},
+        {MJ_ALIGN_BOTTOM | MJ_ALIGN_RIGHT, 7, 3},
+    };
+
+    mj_dropon_t          d;
+    mj_jpeg_t            m, m_compiled, m_composed;
+    mj_placeddropon_t    p;
+    mj_composeoptions_t  o[2];
+    mj_component_t       components[2 * MAX_COMPONENTS];
+    mj_compileddropon_t *cd;
+    unsigned char *      memory = NULL;
+    unsigned long        len = 0;
+    size_t               cachesize;
+    int                  ok = 1, n, i, nderived, differences;
+
+    if(test_read_dropon(&d, images, t) != MJ_OK || test_read_image(&m, images) != MJ_OK || test_make_image(&memory, &len, m.width, m.height, 50) != MJ_OK) {
+        printf("%s: reading the dropon or the image failed\n", t->dropon);
+        mj_free_dropon(&d);
+        mj_free_jpeg(&m);
+        free(memory);
+        return 0;
+    }
+
+    mj_set_dropon_fixed_point(&d, fixed_point);
+
+    // the opaque blocks are only quantized without an opacity, the other options are applied while blending
+    mj_init_composeoptions(&o[0]);
+    mj_init_composeoptions(&o[1]);
+    o[1].opacity = 220;
+    o[1].luminance = -24;
+
+    for(n = 0; n < (int)(sizeof(positions) / sizeof(positions[0])) && ok != 0; n++) {
+        if(mj_compile_dropon_for(&p, &d, &m, positions[n].align, positions[n].offset_x, positions[n].offset_y) != MJ_OK || p.cd == NULL) {
+            printf("%s: compiling the dropon failed\n", t->dropon);
+            ok = 0;
+            break;
+        }
+
+        cd = p.cd;
+        memcpy(components, cd->image, cd->image_ncomponents * sizeof(mj_component_t));
+        memcpy(&components[MAX_COMPONENTS], cd->alpha, cd->alpha_ncomponents * sizeof(mj_component_t));
+        nderived = test_derived(cd);
+        cachesize = (d.cache != NULL) ? d.cache->size : 0;
+
+        // the image the dropon is compiled for and an image with other quantization tables
+        for(i = 0; i < 2 && ok != 0; i++) {
+            mj_init_jpeg(&m_compiled);
+            mj_init_jpeg(&m_composed);
+
+            if(i == 0 && (test_read_image(&m_compiled, images) != MJ_OK || test_read_image(&m_composed, images) != MJ_OK)) {
+                printf("%s: reading the image failed\n", t->dropon);
+                ok = 0;
+            }
+            else if(i == 1 && (mj_read_jpeg_from_memory(&m_compiled, memory, len, 0) != MJ_OK || mj_read_jpeg_from_memory(&m_composed, memory, len, 0) != MJ_OK)) {
+                printf("%s: reading the image failed\n", t->dropon);
+                ok = 0;
+            }
+            else if(mj_compose_compiled_with_options(&m_compiled, &p, &o[n % 2]) != MJ_OK) {
+                printf("%s: composing the compiled dropon failed\n", t->dropon);
+                ok = 0;
+            }
+            else if(p.cd != cd || memcmp(components, cd->image, cd->image_ncomponents * sizeof(mj_component_t)) != 0 ||
+                    memcmp(&components[MAX_COMPONENTS], cd->alpha, cd->alpha_ncomponents * sizeof(mj_component_t)) != 0 || test_derived(cd) != nderived ||
+                    ((d.cache != NULL) ? d.cache->size : 0) != cachesize) {
+                printf("%s: composing the compiled dropon has changed it or the cache\n", t->dropon);
+                ok = 0;
+            }
+            else if(mj_compose_with_options(&m_composed, &d, positions[n].align, positions[n].offset_x, positions[n].offset_y, &o[n % 2]) != MJ_OK) {
+                printf("%s: composing failed\n", t->dropon);
+                ok = 0;
+            }
+            else {
+                differences = test_differences(&m_compiled, &m_composed);
+
+                printf("%s%s at %d,%d%s: %d different coefficients\n", t->dropon, (fixed_point != 0) ? " in fixed point" : "", positions[n].offset_x, positions[n].offset_y,
+                       (i != 0) ? " with other quantization tables" : "", differences);
+
+                if(differences != 0) {
+                    ok = 0;
+                }
+            }
+
+            mj_free_jpeg(&m_compiled);
+            mj_free_jpeg(&m_composed);
+
+            cachesize = (d.cache != NULL) ? d.cache->size : 0;
+        }
+
+        mj_free_placeddropon(&p);
+    }
+
+    mj_free_jpeg(&m);
+    mj_free_dropon(&d);
+    free(memory);
+
+    return ok;
+}
+
+// options with the full opacity and without a recolor offset give the same coefficients as mj_compose(), and options
+// with no opacity don't change the image
+static int test_options(const char *images, const test_dropon_t *t, int fixed_point) {
+    static const test_position_t positions[] = {
+        {MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 3, 5},
+        {MJ_ALIGN_BOTTOM | MJ_ALIGN_RIGHT, -9, -11},
+    };
+
+    mj_dropon_t         d;
+    mj_jpeg_t           m_options, m_composed, m_original;
+    mj_composeoptions_t o;
+    int                 ok = 1, n, differences, unchanged;
+
+    if(test_read_dropon(&d, images, t) != MJ_OK) {
+        printf("%s: reading the dropon failed\n", t->dropon);
+        mj_free_dropon(&d);
+        return 0;
+    }
+
+    mj_set_dropon_fixed_point(&d, fixed_point);
+
+    for(n = 0; n < (int)(sizeof(positions) / sizeof(positions[0])); n++) {
+        if(test_read_image(&m_options, images) != MJ_OK || test_read_image(&m_composed, images) != MJ_OK || test_read_image(&m_original, images) != MJ_OK) {
+            printf("%s: reading the image failed\n", t->dropon);
+            ok = 0;
+        }
+        else {
+            mj_init_composeoptions(&o);
+            o.opacity = MJ_BLEND_FULL;
+
+            if(mj_compose_with_options(&m_options, &d, positions[n].align, positions[n].offset_x, positions[n].offset_y, &o) != MJ_OK ||
+               mj_compose(&m_composed, &d, positions[n].align, positions[n].offset_x, positions[n].offset_y) != MJ_OK) {
+                printf("%s: composing failed\n", t->dropon);
+                ok = 0;
+            }
+
+            o.opacity = MJ_BLEND_NONE;
+
+            if(mj_compose_with_options(&m_original, &d, positions[n].align, positions[n].offset_x, positions[n].offset_y, &o) != MJ_OK) {
+                printf("%s: composing failed\n", t->dropon);
+                ok = 0;
+            }
+
+            if(ok != 0) {
+                differences = test_differences(&m_options, &m_composed);
+
+                // the image composed with no opacity is compared with a fresh copy of the image
+                mj_free_jpeg(&m_composed);
+                unchanged = (test_read_image(&m_composed, images) == MJ_OK && test_differences(&m_original, &m_composed) == 0);
+
+                printf("%s%s at %d,%d: %d different coefficients with the full opacity, %s with no opacity\n", t->dropon, (fixed_point != 0) ? " in fixed point" : "",
+                       positions[n].offset_x, positions[n].offset_y, differences, (unchanged != 0) ? "unchanged" : "changed");
+
+                if(differences != 0 || unchanged == 0) {
+                    ok = 0;
+                }
+            }
+        }
+
+        mj_free_jpeg(&m_options);
+        mj_free_jpeg(&m_composed);
+        mj_free_jpeg(&m_original);
+    }
+
+    mj_free_dropon(&d);
+
+    return ok;
+}
+
+// the recolor offsets are added to the DC coefficients of the dropon. for an opaque dropon the blocks that it covers
+// completely only differ in the DC coefficient from composing it without an offset, all other blocks are the same.
+static int test_recolor(const char *images, int fixed_point) {
+    static const int position[2] = {16, 32};
+
+    mj_dropon_t          d;
+    mj_jpeg_t            m_recolored, m_composed;
+    mj_composeoptions_t  o;
+    mj_compileddropon_t  cd;
+    mj_quantization_t    q;
+    jpeg_component_info *component;
+    JBLOCKARRAY          rows_recolored, rows_composed;
+    mj_block_t *         dropon;
+    char                 filename[1024];
+    int                  offsets[MAX_COMPONENTS], first[2], last[2], full[4];
+    int                  ok = 1, c, k, l, blockwidth, blockheight, nblocks = 0, mismatches = 0;
+
+    snprintf(filename, sizeof(filename), "%s/dropon.jpg", images);
+
+    mj_init_dropon(&d);
+    mj_set_dropon_fixed_point(&d, fixed_point);
+
+    if(mj_read_dropon_from_file(&d, filename, NULL, MJ_BLEND_FULL) != MJ_OK || test_read_image(&m_recolored, images) != MJ_OK || test_read_image(&m_composed, images) != MJ_OK) {
+        printf("recolor: reading the dropon or the image failed\n");
+        mj_free_dropon(&d);
+        return 0;
+    }
+
+    mj_init_composeoptions(&o);
+    o.luminance = 80;
+    o.cb_value = -40;
+    o.cr_value = 56;
+
+    offsets[0] = o.luminance;
+    offsets[1] = o.cb_value;
+    offsets[2] = o.cr_value;
+
+    if(mj_compose_with_options(&m_recolored, &d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, position[0], position[1], &o) != MJ_OK ||
+       mj_compose(&m_composed, &d, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, position[0], position[1]) != MJ_OK) {
+        printf("recolor: composing failed\n");
+        ok = 0;
+    }
+    else if(mj_compile_dropon(&cd, &d, m_composed.cinfo.jpeg_color_space, &m_composed.sampling, 0, 0, 0, 0, d.width, d.height) != MJ_OK) {
+        printf("recolor: compiling the dropon failed\n");
+        ok = 0;
+    }
+    else {
+        for(c = 0; c < m_composed.cinfo.num_components && c < MAX_COMPONENTS; c++) {
+            component = &m_composed.cinfo.comp_info[c];
+            blockwidth = m_composed.sampling.h_factor / component->h_samp_factor;
+            blockheight = m_composed.sampling.v_factor / component->v_samp_factor;
+
+            mj_init_quantization(&q, component->quant_table->quantval);
+
+            // the blocks that the dropon covers at all and the blocks that it covers completely
+            test_covered(&first[0], &last[0], position[0], d.width, blockwidth, 0);
+            test_covered(&first[1], &last[1], position[1], d.height, blockheight, 0);
+            test_covered(&full[0], &full[1], position[0], d.width, blockwidth, 1);
+            test_covered(&full[2], &full[3], position[1], d.height, blockheight, 1);
+
+            for(l = 0; l < (int)component->height_in_blocks; l++) {
+                rows_recolored = (*m_recolored.cinfo.mem->access_virt_barray)((j_common_ptr)&m_recolored.cinfo, m_recolored.coef[c], l, 1, FALSE);
+                rows_composed = (*m_composed.cinfo.mem->access_virt_barray)((j_common_ptr)&m_composed.cinfo, m_composed.coef[c], l, 1, FALSE);
+
+                for(k = 0; k < (int)component->width_in_blocks; k++) {
+                    // the blocks that the dropon doesn't cover are not changed
+                    if(k < first[0] || k >= last[0] || l < first[1] || l >= last[1]) {
+                        if(memcmp(rows_recolored[0][k], rows_composed[0][k], sizeof(JBLOCK)) != 0) {
+                            mismatches++;
+                        }
+                        continue;
+                    }
+
+                    // the blocks that are partially covered are blended, i.e. the offset is spread over the coefficients
+                    if(k < full[0] || k >= full[1] || l < full[2] || l >= full[3]) {
+                        continue;
+                    }
+
+                    dropon = MJ_BLOCK(&cd.image[c], (size_t)cd.image[c].width_in_blocks * (l - first[1]) + (k - first[0]));
+
+                    if(memcmp(&rows_recolored[0][k][1], &rows_composed[0][k][1], (DCTSIZE2 - 1) * sizeof(JCOEF)) != 0 ||
+                       rows_recolored[0][k][0] != mj_quantize_coefficient(dropon[0] + (float)offsets[c], q.reciprocal[0])) {
+                        mismatches++;
+                    }
+
+                    nblocks++;
+                }
+            }
+        }
+
+        mj_free_compileddropon(&cd);
+
+        printf("recolor%s: %d opaque blocks, %d mismatches\n", (fixed_point != 0) ? " in fixed point" : "", nblocks, mismatches);
+
+        if(nblocks == 0 || mismatches != 0) {
+            ok = 0;
+        }
+    }
+
+    mj_free_jpeg(&m_recolored);
+    mj_free_jpeg(&m_composed);
+    mj_free_dropon(&d);
+
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int ok = 1, n;
+
+    if(argc != 2) {
+        fprintf(stderr, "usage: %s <directory with the images>\n", argv[0]);
+        return 1;
+    }
+
+    for(n = 0; n < (int)(sizeof(test_dropons) / sizeof(test_dropons[0])); n++) {
+        ok &= test_view(argv[1], &test_dropons[n]);
+        ok &= test_many(argv[1], &test_dropons[n]);
+        ok &= test_tiled(argv[1], &test_dropons[n]);
+        ok &= test_compiled(argv[1], &test_dropons[n], 0);
+        ok &= test_compiled(argv[1], &test_dropons[n], 1);
+        ok &= test_options(argv[1], &test_dropons[n], 0);
+        ok &= test_options(argv[1], &test_dropons[n], 1);
+    }
+
+    ok &= test_many_overlap(argv[1]);
+    ok &= test_recolor(argv[1], 0);
+    ok &= test_recolor(argv[1], 1);
+    ok &= test_threads(0);
+    ok &= test_threads(1);
+
+    return (ok != 0) ? 0 : 1;
+}
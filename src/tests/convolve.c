@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../convolve.h"
+
+// the number of random blocks per test
+#define TEST_BLOCKS 10000
+
+// the largest difference between the sparse operators and mj_convolve(). both sum up the same products in
+// single precision, but in a different order.
+#define TEST_TOLERANCE 0.01
+
+static float test_random(float min, float max) {
+    return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+// a random block of an image and of a mask. the mask has between 1 and DCTSIZE2 non-zero coefficients.
+static unsigned long long test_random_blocks(mj_block_t *imageblock, mj_block_t *x1, mj_block_t *alphablock) {
+    unsigned long long nonzero = 0;
+    int                i, n;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        imageblock[i] = test_random(-1024.0f, 1024.0f);
+        x1[i] = test_random(-1024.0f, 1024.0f);
+        alphablock[i] = 0.0f;
+    }
+
+    n = 1 + rand() % DCTSIZE2;
+
+    while(n-- > 0) {
+        i = rand() % DCTSIZE2;
+
+        alphablock[i] = test_random(-0.25f, 0.25f);
+        nonzero |= 1ULL << i;
+    }
+
+    return nonzero;
+}
+
+// the sparse operators in mj_operator_index and mj_operator_coef against the full convolution with each weight of the mask
+static int test_operators(void) {
+    mj_block_t         imageblock[DCTSIZE2], alphablock[DCTSIZE2], x1[DCTSIZE2], x[DCTSIZE2], y[DCTSIZE2], reference[DCTSIZE2];
+    unsigned long long nonzero;
+    double             error, maxerror = 0.0;
+    int                n, i, k, l;
+
+    for(n = 0; n < TEST_BLOCKS; n++) {
+        nonzero = test_random_blocks(imageblock, x1, alphablock);
+
+        for(i = 0; i < DCTSIZE2; i++) {
+            x[i] = imageblock[i] - x1[i];
+            y[i] = 0.0f;
+        }
+
+        for(k = 0; k < DCTSIZE; k++) {
+            for(l = 0; l < DCTSIZE; l++) {
+                mj_convolve(x, y, alphablock[(k * DCTSIZE) + l], k, l);
+            }
+        }
+
+        for(i = 0; i < DCTSIZE2; i++) {
+            reference[i] = x1[i] + y[i];
+        }
+
+        mj_blend_block_dequantized(x1, imageblock, alphablock, nonzero);
+
+        for(i = 0; i < DCTSIZE2; i++) {
+            error = fabs((double)x1[i] - (double)reference[i]);
+            if(error > maxerror) {
+                maxerror = error;
+            }
+        }
+    }
+
+    printf("operators: max. error %g\n", maxerror);
+
+    return (maxerror <= TEST_TOLERANCE);
+}
+
+// the fused kernel against the separate steps: de-quantize the block of the JPEG, blend it with the block of the
+// dropon and quantize the result with a division. the kernel multiplies with the reciprocal of the quantization
+// value instead, which is allowed to round a coefficient differently if it is close to halfway.
+static int test_fused(void) {
+    JCOEF              coefs[DCTSIZE2], result[DCTSIZE2];
+    UINT16             quantval[DCTSIZE2];
+    mj_block_t         imageblock[DCTSIZE2], alphablock[DCTSIZE2], x1[DCTSIZE2];
+    mj_quantization_t  q;
+    unsigned long long nonzero;
+    double             v, error, maxerror = 0.0;
+    int                n, i, different = 0;
+
+    for(n = 0; n < TEST_BLOCKS; n++) {
+        nonzero = test_random_blocks(imageblock, x1, alphablock);
+
+        for(i = 0; i < DCTSIZE2; i++) {
+            quantval[i] = (UINT16)(1 + rand() % 255);
+            coefs[i] = (JCOEF)((rand() % 2049 - 1024) / quantval[i]);
+            imageblock[i] = test_random(-1024.0f, 1024.0f);
+        }
+
+        mj_init_quantization(&q, quantval);
+
+        memcpy(result, coefs, sizeof(coefs));
+        mj_blend_block(result, imageblock, alphablock, nonzero, &q);
+
+        for(i = 0; i < DCTSIZE2; i++) {
+            x1[i] = (float)coefs[i] * (float)quantval[i];
+        }
+
+        mj_blend_block_dequantized(x1, imageblock, alphablock, nonzero);
+
+        for(i = 0; i < DCTSIZE2; i++) {
+            v = (double)x1[i] / (double)quantval[i];
+            v = (v < 0.0) ? ceil(v - 0.5) : floor(v + 0.5);
+
+            error = fabs((double)result[i] - v);
+            if(error > maxerror) {
+                maxerror = error;
+            }
+
+            if(error != 0.0) {
+                different++;
+            }
+        }
+    }
+
+    printf("fused: max. error %g, %d of %d coefficients rounded differently\n", maxerror, different, TEST_BLOCKS * DCTSIZE2);
+
+    return (maxerror <= 1.0 && different <= TEST_BLOCKS * DCTSIZE2 / 1000);
+}
+
+// a random quantized block of the JPEG, a quantization table and a block of a dropon. a quarter of the blocks
+// of the dropon is far out of the range of the coefficients, such that the quantization saturates.
+static void test_random_quantized(JCOEF *coefs, UINT16 *quantval, mj_block_t *imageblock) {
+    float range = (rand() % 4 == 0) ? 1.0e7f : 2048.0f;
+    int   i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        coefs[i] = (JCOEF)(rand() % 65536 - 32768);
+        quantval[i] = (UINT16)(1 + rand() % 255);
+        imageblock[i] = test_random(-range, range);
+    }
+
+    return;
+}
+
+// a SIMD kernel against the scalar kernel, i.e. the quantized coefficients must be exactly the same
+static int test_compare(const char *name, const JCOEF *expected, const JCOEF *coefs, int *mismatches) {
+    if(memcmp(expected, coefs, DCTSIZE2 * sizeof(JCOEF)) == 0) {
+        return 1;
+    }
+
+    if((*mismatches)++ == 0) {
+        printf("%s: different from the scalar kernel\n", name);
+    }
+
+    return 0;
+}
+
+// the count of saturated coefficients, to make sure that the saturation is actually tested
+static int test_saturated(const JCOEF *coefs) {
+    int i, n = 0;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        if(coefs[i] == -32768 || coefs[i] == 32767) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+// the SIMD kernels against the scalar kernels, including coefficients that saturate
+static int test_kernels(void) {
+    JCOEF              coefs[DCTSIZE2], expected[DCTSIZE2], result[DCTSIZE2];
+    UINT16             quantval[DCTSIZE2];
+    mj_block_t         imageblock[DCTSIZE2], alphablock[DCTSIZE2], x1[DCTSIZE2], samples[DCTSIZE2];
+    mj_quantization_t  q;
+    unsigned long long nonzero;
+    float              alpha;
+    int                n, i, saturated = 0, mismatches = 0;
+
+    for(n = 0; n < TEST_BLOCKS; n++) {
+        nonzero = test_random_blocks(imageblock, x1, alphablock);
+        test_random_quantized(coefs, quantval, imageblock);
+        mj_init_quantization(&q, quantval);
+
+        for(i = 0; i < DCTSIZE2; i++) {
+            samples[i] = test_random(0.0f, 1.0f);
+        }
+
+        alpha = test_random(0.0f, 1.0f);
+
+        memcpy(expected, coefs, sizeof(coefs));
+        mj_blend_block_scalar(expected, imageblock, alphablock, nonzero, &q);
+        saturated += test_saturated(expected);
+
+#ifdef MJ_CONVOLVE_X86
+        if(__builtin_cpu_supports("sse4.1")) {
+            memcpy(result, coefs, sizeof(coefs));
+            mj_blend_block_sse41(result, imageblock, alphablock, nonzero, &q);
+            test_compare("mj_blend_block_sse41", expected, result, &mismatches);
+        }
+
+        if(__builtin_cpu_supports("avx2")) {
+            memcpy(result, coefs, sizeof(coefs));
+            mj_blend_block_avx2(result, imageblock, alphablock, nonzero, &q);
+            test_compare("mj_blend_block_avx2", expected, result, &mismatches);
+        }
+
+        if(__builtin_cpu_supports("avx512f")) {
+            memcpy(result, coefs, sizeof(coefs));
+            mj_blend_block_avx512(result, imageblock, alphablock, nonzero, &q);
+            test_compare("mj_blend_block_avx512", expected, result, &mismatches);
+        }
+#endif
+
+        memcpy(expected, coefs, sizeof(coefs));
+        mj_blend_block_uniform_scalar(expected, imageblock, alpha, &q);
+        saturated += test_saturated(expected);
+
+#ifdef MJ_CONVOLVE_X86
+        if(__builtin_cpu_supports("avx2")) {
+            memcpy(result, coefs, sizeof(coefs));
+            mj_blend_block_uniform_avx2(result, imageblock, alpha, &q);
+            test_compare("mj_blend_block_uniform_avx2", expected, result, &mismatches);
+        }
+#endif
+
+        memcpy(expected, coefs, sizeof(coefs));
+        mj_blend_block_samples_scalar(expected, imageblock, samples, &q);
+        saturated += test_saturated(expected);
+
+#ifdef MJ_CONVOLVE_X86
+        if(__builtin_cpu_supports("avx2")) {
+            memcpy(result, coefs, sizeof(coefs));
+            mj_blend_block_samples_avx2(result, imageblock, samples, &q);
+            test_compare("mj_blend_block_samples_avx2", expected, result, &mismatches);
+        }
+#endif
+    }
+
+    printf("kernels: %d saturated coefficients, %d mismatches\n", saturated, mismatches);
+
+    return (mismatches == 0 && saturated != 0);
+}
+
+int main(int argc, char **argv) {
+    int ok = 1;
+
+    srand(1);
+
+    ok &= test_operators();
+    ok &= test_fused();
+    ok &= test_kernels();
+
+    return (ok != 0) ? 0 : 1;
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../convolve.h"
+#include "../dct.h"
+#include "../fixed.h"
+#include "../libmodjpeg.h"
+
+// the largest difference of a quantized coefficient between composing in floating point and in fixed point
+#define TEST_MAX_ERROR 1
+
+// the number of random blocks for comparing the kernels
+#define TEST_BLOCKS 10000
+
+typedef struct {
+    const char * dropon;
+    const char * mask;
+    short        blend;
+    unsigned int align;
+    int          offset_x;
+    int          offset_y;
+    int          opacity;
+} test_case_t;
+
+static const test_case_t test_cases[] = {
+    {"dropon.png", NULL, 0, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 0, 0, MJ_BLEND_FULL},
+    {"dropon.png", NULL, 0, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 3, 5, MJ_BLEND_FULL},
+    {"dropon.png", NULL, 0, MJ_ALIGN_BOTTOM | MJ_ALIGN_RIGHT, -10, -10, 128},
+    {"dropon.jpg", "mask.jpg", 0, MJ_ALIGN_CENTER, 0, 0, MJ_BLEND_FULL},
+    {"dropon.jpg", "mask.jpg", 0, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, -16, -16, 64},
+    {"dropon.jpg", NULL, 128, MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 30, 25, MJ_BLEND_FULL},
+    {"dropon.jpg", NULL, 128, MJ_ALIGN_CENTER, 0, 0, 1},
+};
+
+static int test_read_dropon(mj_dropon_t *d, const char *images, const test_case_t *t, int fixed_point) {
+    char dropon[1024], mask[1024];
+
+    snprintf(dropon, sizeof(dropon), "%s/%s", images, t->dropon);
+    if(t->mask != NULL) {
+        snprintf(mask, sizeof(mask), "%s/%s", images, t->mask);
+    }
+
+    mj_init_dropon(d);
+    mj_set_dropon_fixed_point(d, fixed_point);
+
+    return mj_read_dropon_from_file(d, dropon, (t->mask != NULL) ? mask : NULL, t->blend);
+}
+
+static int test_compose(mj_jpeg_t *m, const char *images, const test_case_t *t, int fixed_point) {
+    mj_dropon_t         d;
+    mj_composeoptions_t o;
+    char                image[1024];
+    int                 rv;
+
+    snprintf(image, sizeof(image), "%s/image.jpg", images);
+
+    rv = mj_read_jpeg_from_file(m, image, 0);
+    if(rv != MJ_OK) {
+        return rv;
+    }
+
+    rv = test_read_dropon(&d, images, t, fixed_point);
+    if(rv != MJ_OK) {
+        mj_free_dropon(&d);
+        return rv;
+    }
+
+    mj_init_composeoptions(&o);
+    o.opacity = t->opacity;
+
+    rv = mj_compose_with_options(m, &d, t->align, t->offset_x, t->offset_y, &o);
+
+    mj_free_dropon(&d);
+
+    return rv;
+}
+
+// the largest difference of the quantized coefficients of two images with the same dimensions
+static int test_max_error(mj_jpeg_t *a, mj_jpeg_t *b) {
+    jpeg_component_info *component;
+    JBLOCKARRAY          rows_a, rows_b;
+    int                  c, l, k, i, error, maxerror = 0;
+
+    for(c = 0; c < a->cinfo.num_components; c++) {
+        component = &a->cinfo.comp_info[c];
+
+        for(l = 0; l < (int)component->height_in_blocks; l++) {
+            rows_a = (*a->cinfo.mem->access_virt_barray)((j_common_ptr)&a->cinfo, a->coef[c], l, 1, FALSE);
+            rows_b = (*b->cinfo.mem->access_virt_barray)((j_common_ptr)&b->cinfo, b->coef[c], l, 1, FALSE);
+
+            for(k = 0; k < (int)component->width_in_blocks; k++) {
+                for(i = 0; i < DCTSIZE2; i++) {
+                    error = abs(rows_a[0][k][i] - rows_b[0][k][i]);
+                    if(error > maxerror) {
+                        maxerror = error;
+                    }
+                }
+            }
+        }
+    }
+
+    return maxerror;
+}
+
+// compose every test case in floating point and in fixed point with the given kernels
+static int test_float_fixed(const char *images, int simd) {
+    mj_jpeg_t m_float, m_fixed;
+    int       ok = 1, n, error;
+
+    mj_select_convolve_kernels(simd);
+    mj_select_fixed_kernels(simd);
+
+    for(n = 0; n < (int)(sizeof(test_cases) / sizeof(test_cases[0])); n++) {
+        mj_init_jpeg(&m_float);
+        mj_init_jpeg(&m_fixed);
+
+        if(test_compose(&m_float, images, &test_cases[n], 0) != MJ_OK || test_compose(&m_fixed, images, &test_cases[n], 1) != MJ_OK) {
+            printf("%s kernels, case %d: composing failed\n", (simd != 0) ? "SIMD" : "scalar", n);
+            ok = 0;
+        }
+        else {
+            error = test_max_error(&m_float, &m_fixed);
+
+            printf("%s kernels, case %d: max. error %d\n", (simd != 0) ? "SIMD" : "scalar", n, error);
+
+            if(error > TEST_MAX_ERROR) {
+                ok = 0;
+            }
+        }
+
+        mj_free_jpeg(&m_float);
+        mj_free_jpeg(&m_fixed);
+    }
+
+    return ok;
+}
+
+// the uniform SIMD kernel against the scalar kernel, with the edge values of alpha in Q15
+static int test_uniform_kernels(void) {
+    static const int alphas[] = {0, 1, 2, 3, 16383, 16384, 16385, 32766, 32767, 32768};
+
+    JCOEF                  coefs[DCTSIZE2], expected[DCTSIZE2], result[DCTSIZE2];
+    UINT16                 quantval[DCTSIZE2];
+    int16_t                imageblock[DCTSIZE2];
+    mj_fixedquantization_t q;
+    int                    n, a, i, mismatches = 0;
+
+#ifdef MJ_CONVOLVE_X86
+    if(!__builtin_cpu_supports("avx2")) {
+        return 1;
+    }
+#else
+    return 1;
+#endif
+
+    srand(1);
+
+    for(n = 0; n < TEST_BLOCKS; n++) {
+        // the de-quantized coefficients of the image in Q1 fit into 16 bit
+        for(i = 0; i < DCTSIZE2; i++) {
+            quantval[i] = (UINT16)(1 + rand() % MJ_FIXED_MAX_QUANTVAL);
+            coefs[i] = (JCOEF)(rand() % (2 * (16383 / quantval[i]) + 1) - 16383 / quantval[i]);
+            imageblock[i] = (int16_t)(rand() % 65536 - 32768);
+        }
+
+        mj_init_fixed_quantization(&q, quantval);
+
+        for(a = 0; a < (int)(sizeof(alphas) / sizeof(alphas[0])); a++) {
+            memcpy(expected, coefs, sizeof(coefs));
+            mj_blend_block_uniform_fixed_scalar(expected, imageblock, alphas[a], &q);
+
+#ifdef MJ_CONVOLVE_X86
+            memcpy(result, coefs, sizeof(coefs));
+            mj_blend_block_uniform_fixed_avx2(result, imageblock, alphas[a], &q);
+
+            if(memcmp(expected, result, sizeof(expected)) != 0 && mismatches++ == 0) {
+                printf("mj_blend_block_uniform_fixed_avx2: different from the scalar kernel with alpha %d\n", alphas[a]);
+            }
+#endif
+        }
+    }
+
+    printf("uniform kernels: %d mismatches\n", mismatches);
+
+    return (mismatches == 0);
+}
+
+// a random block of samples, level shifted like the samples of a JPEG, transformed into the DCT domain
+static void test_random_coefficients(mj_block_t *coefs) {
+    float samples[DCTSIZE2];
+    int   i;
+
+    for(i = 0; i < DCTSIZE2; i++) {
+        samples[i] = (float)(rand() % 256 - 128);
+    }
+
+    mj_fdct(samples, coefs);
+
+    return;
+}
+
+// the SIMD kernel for the blocks in the pixel domain against the scalar kernel. the blocks of the JPEG and of the
+// dropon are transforms of samples, such that they are in the range the kernels are made for. the kernels are
+// called with an odd number of blocks, because the SIMD kernel blends two blocks at once.
+static int test_samples_kernels(void) {
+    JCOEF                  coefs[3][DCTSIZE2], expected[3][DCTSIZE2], result[3][DCTSIZE2];
+    UINT16                 quantval[DCTSIZE2];
+    int16_t                imageblock[3][DCTSIZE2], alphablock[3][DCTSIZE2];
+    mj_block_t             block[DCTSIZE2];
+    mj_fixedquantization_t q;
+    JCOEFPTR               blocks[3];
+    int16_t *              imageblocks[3], *alphablocks[3];
+    int                    n, b, i, mismatches = 0;
+
+#ifdef MJ_CONVOLVE_X86
+    if(!__builtin_cpu_supports("avx2")) {
+        return 1;
+    }
+#else
+    return 1;
+#endif
+
+    srand(1);
+
+    for(n = 0; n < TEST_BLOCKS; n++) {
+        for(i = 0; i < DCTSIZE2; i++) {
+            quantval[i] = (UINT16)(1 + rand() % MJ_FIXED_MAX_QUANTVAL);
+        }
+
+        mj_init_fixed_quantization(&q, quantval);
+
+        for(b = 0; b < 3; b++) {
+            test_random_coefficients(block);
+
+            for(i = 0; i < DCTSIZE2; i++) {
+                coefs[b][i] = (JCOEF)lroundf(block[i] / (float)quantval[i]);
+            }
+
+            test_random_coefficients(block);
+
+            for(i = 0; i < DCTSIZE2; i++) {
+                imageblock[b][i] = (int16_t)lroundf(block[i] * (float)(1 << MJ_FIXED_IMAGE_BITS));
+                alphablock[b][i] = (int16_t)(rand() % (1 << MJ_FIXED_SAMPLES_BITS));
+            }
+
+            imageblocks[b] = imageblock[b];
+            alphablocks[b] = alphablock[b];
+        }
+
+        memcpy(expected, coefs, sizeof(coefs));
+
+        for(b = 0; b < 3; b++) {
+            blocks[b] = expected[b];
+        }
+
+        mj_blend_blocks_samples_fixed_scalar(blocks, imageblocks, alphablocks, 3, &q);
+
+#ifdef MJ_CONVOLVE_X86
+        memcpy(result, coefs, sizeof(coefs));
+
+        for(b = 0; b < 3; b++) {
+            blocks[b] = result[b];
+        }
+
+        mj_blend_blocks_samples_fixed_avx2(blocks, imageblocks, alphablocks, 3, &q);
+
+        if(memcmp(expected, result, sizeof(expected)) != 0 && mismatches++ == 0) {
+            printf("mj_blend_blocks_samples_fixed_avx2: different from the scalar kernel\n");
+        }
+#endif
+    }
+
+    printf("samples kernels: %d mismatches\n", mismatches);
+
+    return (mismatches == 0);
+}
+
+int main(int argc, char **argv) {
+    int ok = 1;
+
+    if(argc != 2) {
+        fprintf(stderr, "usage: %s <directory with the images>\n", argv[0]);
+        return 1;
+    }
+
+    ok &= test_uniform_kernels();
+    ok &= test_samples_kernels();
+    ok &= test_float_fixed(argv[1], 0);
+    ok &= test_float_fixed(argv[1], 1);
+
+    return (ok != 0) ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2006+ Ingo Oppermann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libmodjpeg.h"
+#include "../store.h"
+
+// the compiled dropon file that is written into the working directory
+#define TEST_FILENAME "test-store.mjd"
+
+typedef struct {
+    const char *dropon;
+    const char *mask;
+    short       blend;
+} test_case_t;
+
+typedef struct {
+    unsigned int align;
+    int          offset_x;
+    int          offset_y;
+} test_position_t;
+
+static const test_case_t test_cases[] = {
+    {"dropon.png", NULL, 0},
+    {"dropon.jpg", "mask.jpg", 0},
+    {"dropon.jpg", NULL, 128},
+};
+
+// the first positions are compiled before the dropon is written, the others are only compiled after it is loaded
+static const test_position_t test_positions[] = {
+    {MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 0, 0},
+    {MJ_ALIGN_CENTER, 0, 0},
+    {MJ_ALIGN_TOP | MJ_ALIGN_LEFT, -20, -20},
+    {MJ_ALIGN_BOTTOM | MJ_ALIGN_RIGHT, 7, 3},
+    {MJ_ALIGN_TOP | MJ_ALIGN_LEFT, 3, 5},
+    {MJ_ALIGN_BOTTOM | MJ_ALIGN_RIGHT, -9, -11},
+};
+
+#define TEST_COMPILED_POSITIONS 4
+
+static int test_read_dropon(mj_dropon_t *d, const char *images, const test_case_t *t) {
+    char dropon[1024], mask[1024];
+
+    snprintf(dropon, sizeof(dropon), "%s/%s", images, t->dropon);
+    if(t->mask != NULL) {
+        snprintf(mask, sizeof(mask), "%s/%s", images, t->mask);
+    }
+
+    mj_init_dropon(d);
+
+    return mj_read_dropon_from_file(d, dropon, (t->mask != NULL) ? mask : NULL, t->blend);
+}
+
+// compose the dropon at the given positions onto a fresh copy of the image
+static int test_compose(mj_jpeg_t *m, const char *images, mj_dropon_t *d, int npositions) {
+    char image[1024];
+    int  rv, n;
+
+    snprintf(image, sizeof(image), "%s/image.jpg", images);
+
+    mj_init_jpeg(m);
+
+    rv = mj_read_jpeg_from_file(m, image, 0);
+    if(rv != MJ_OK) {
+        return rv;
+    }
+
+    for(n = 0; n < npositions; n++) {
+        rv = mj_compose(m, d, test_positions[n].align, test_positions[n].offset_x, test_positions[n].offset_y);
+        if(rv != MJ_OK) {
+            return rv;
+        }
+    }
+
+    return MJ_OK;
+}
+
+// the number of different quantized coefficients of two images with the same dimensions
+static int test_differences(mj_jpeg_t *a, mj_jpeg_t *b) {
+    jpeg_component_info *component;
+    JBLOCKARRAY          rows_a, rows_b;
+    int                  c, l, k, i, differences = 0;
+
+    for(c = 0; c < a->cinfo.num_components; c++) {
+        component = &a->cinfo.comp_info[c];
+
+        for(l = 0; l < (int)component->height_in_blocks; l++) {
+            rows_a = (*a->cinfo.mem->access_virt_barray)((j_common_ptr)&a->cinfo, a->coef[c], l, 1, FALSE);
+            rows_b = (*b->cinfo.mem->access_virt_barray)((j_common_ptr)&b->cinfo, b->coef[c], l, 1, FALSE);
+
+            for(k = 0; k < (int)component->width_in_blocks; k++) {
+                for(i = 0; i < DCTSIZE2; i++) {
+                    if(rows_a[0][k][i] != rows_b[0][k][i]) {
+                        differences++;
+                    }
+                }
+            }
+        }
+    }
+
+    return differences;
+}
+
+// compose with the loaded dropon and compare it with the composition of the original dropon
+static int test_loaded(const char *name, mj_jpeg_t *expected, const char *images, mj_dropon_t *d) {
+    mj_jpeg_t m;
+    int       ok = 1, differences;
+
+    if(test_compose(&m, images, d, (int)(sizeof(test_positions) / sizeof(test_positions[0]))) != MJ_OK) {
+        printf("%s: composing failed\n", name);
+        ok = 0;
+    }
+    else {
+        differences = test_differences(expected, &m);
+
+        printf("%s: %d different coefficients\n", name, differences);
+
+        if(differences != 0) {
+            ok = 0;
+        }
+    }
+
+    mj_free_jpeg(&m);
+
+    return ok;
+}
+
+// a corrupted copy of a compiled dropon must be rejected when it is loaded
+static int test_corrupted(const char *name, const unsigned char *memory, size_t len, size_t offset, int32_t value) {
+    mj_dropon_t    d;
+    unsigned char *corrupted;
+    int            rv;
+
+    corrupted = (unsigned char *)malloc(len);
+    if(corrupted == NULL) {
+        return 0;
+    }
+
+    memcpy(corrupted, memory, len);
+    memcpy(&corrupted[offset], &value, sizeof(value));
+
+    mj_init_dropon(&d);
+
+    rv = mj_read_dropon_from_memory(&d, corrupted, len, NULL, 0, 0);
+
+    printf("%s: %s\n", name, (rv != MJ_OK) ? "rejected" : "accepted");
+
+    mj_free_dropon(&d);
+    free(corrupted);
+
+    return (rv != MJ_OK);
+}
+
+// write the compiled dropons of a dropon, load them from memory and from a file, and compose with them
+static int test_roundtrip(const char *images, const test_case_t *t) {
+    mj_dropon_t              d, loaded;
+    mj_jpeg_t                expected;
+    const mj_storeheader_t * header;
+    const mj_storevariant_t *v;
+    unsigned char *          memory = NULL;
+    size_t                   len = 0, offset;
+    int                      ok = 1;
+
+    printf("%s%s%s:\n", t->dropon, (t->mask != NULL) ? " with " : "", (t->mask != NULL) ? t->mask : "");
+
+    // the composition of the original dropon compiles the variants that are written
+    if(test_read_dropon(&d, images, t) != MJ_OK || test_compose(&expected, images, &d, TEST_COMPILED_POSITIONS) != MJ_OK) {
+        printf("reading or composing the dropon failed\n");
+        mj_free_dropon(&d);
+        return 0;
+    }
+
+    if(mj_write_dropon_to_memory(&d, &memory, &len) != MJ_OK || mj_write_dropon_to_file(&d, TEST_FILENAME) != MJ_OK) {
+        printf("writing the dropon failed\n");
+        mj_free_dropon(&d);
+        mj_free_jpeg(&expected);
+        free(memory);
+        return 0;
+    }
+
+    mj_free_jpeg(&expected);
+
+    if(test_compose(&expected, images, &d, (int)(sizeof(test_positions) / sizeof(test_positions[0]))) != MJ_OK) {
+        printf("composing the dropon failed\n");
+        ok = 0;
+    }
+
+    mj_init_dropon(&loaded);
+
+    if(ok != 0 && mj_read_dropon_from_memory(&loaded, memory, len, NULL, 0, 0) == MJ_OK) {
+        ok &= test_loaded("from memory", &expected, images, &loaded);
+    }
+    else {
+        printf("from memory: loading failed\n");
+        ok = 0;
+    }
+
+    mj_free_dropon(&loaded);
+    mj_init_dropon(&loaded);
+
+    if(ok != 0 && mj_read_dropon_from_file(&loaded, TEST_FILENAME, NULL, 0) == MJ_OK) {
+        ok &= test_loaded("mapped from the file", &expected, images, &loaded);
+    }
+    else {
+        printf("mapped from the file: loading failed\n");
+        ok = 0;
+    }
+
+    mj_free_dropon(&loaded);
+    unlink(TEST_FILENAME);
+
+    header = (const mj_storeheader_t *)memory;
+    v = (const mj_storevariant_t *)&memory[header->variants_offset];
+
+    if(ok != 0 && header->nvariants != 0) {
+        offset = header->variants_offset + offsetof(mj_storevariant_t, image[0].width_in_blocks);
+        ok &= test_corrupted("width of a component", memory, len, offset, v->image[0].width_in_blocks + 1);
+
+        offset = header->variants_offset + offsetof(mj_storevariant_t, image[0].nblocks);
+        ok &= test_corrupted("number of blocks", memory, len, offset, v->image[0].nblocks - 1);
+
+        offset = header->variants_offset + offsetof(mj_storevariant_t, blockoffset_x);
+        ok &= test_corrupted("block offset", memory, len, offset, v->h_factor);
+
+        // the classes follow the blocks and the non-zero coefficients of a mask
+        if(v->alpha_ncomponents != 0) {
+            offset = v->alpha[0].blocks_offset + (size_t)v->alpha[0].nblocks * (DCTSIZE2 * sizeof(mj_block_t) + sizeof(unsigned long long));
+            ok &= test_corrupted("class of a block", memory, len, offset, 0x7f7f7f7f);
+        }
+    }
+
+    mj_free_dropon(&d);
+    mj_free_jpeg(&expected);
+    free(memory);
+
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int ok = 1, n;
+
+    if(argc != 2) {
+        fprintf(stderr, "usage: %s <directory with the images>\n", argv[0]);
+        return 1;
+    }
+
+    for(n = 0; n < (int)(sizeof(test_cases) / sizeof(test_cases[0])); n++) {
+        ok &= test_roundtrip(argv[1], &test_cases[n]);
+    }
+
+    return (ok != 0) ? 0 : 1;
+}